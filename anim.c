@@ -1,6 +1,8 @@
-
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include "utility.h"
 #include "anim.h"
@@ -12,52 +14,309 @@
 //  CONSTANTS
 //===================================================================
 
+#define ANIMATION_LIST_START    16          // animations room is made for at first
+#define FRAME_POOL_START        256         // frames room is made for at first
+#define FRAME_RANGE_START       4           // frames room is made for in a new animation
+
+//===================================================================
+//  TYPES
+//===================================================================
+
+// an animation's frames are frame_pool[first_frame] to frame_pool[first_frame+no_of_frames-1],
+// with room to grow up to first_frame+frame_capacity before the range has to move
+struct anim_s   {   int32_t    first_frame;
+                    int32_t    no_of_frames;
+                    int32_t    frame_capacity;
+                    int32_t    frame_wait;              // number of frames to wait before changing
+                };
 
+typedef struct anim_s anim_type;
 
 //===================================================================
 //  FILE VARIABLES
 //===================================================================
 
 
-static anim_type                *animation[MAX_ANIMATIONS];
+static anim_type                *animation = NULL;
+static int                      animation_capacity = 0;
 static int                      no_of_animations = 0;
 
+// the frames of every animation. sprite indices are stored in 16 bits until one doesn't fit,
+// then the whole pool is widened to 32 bits
+static void                     *frame_pool = NULL;
+static int                      frame_pool_wide = 0;
+static int                      frame_pool_size = 0;        // slots handed out to animations
+static int                      frame_pool_capacity = 0;
+static int                      frame_pool_unused = 0;      // slots left behind by moved ranges
+
+// bumped whenever an animation changes, values come from one counter so a reused index never
+// matches an old generation. animation_capacity long
+static uint32_t                 *animation_generation = NULL;
+static uint32_t                 generation_counter = 0;
+
+// animations changed since the last save, see ANI_Get_Changed_Animations(). generations above
+// saved_generation are changes, so an animation is listed once however often it changes
+static int                      *changed_animation = NULL;
+static int                      no_of_changed = 0;
+static int                      changed_capacity = 0;
+static uint32_t                 saved_generation = 0;
+
 
 //===================================================================
 //  PRIVATE FUNCTIONS
 //===================================================================
 
+// makes sure the list has room for count animations, returns 1 on success. the capacity doubles
+// so adding animations one at a time stays cheap
+static int Reserve_Animations( int count )
+{
+    if( count <= animation_capacity )
+    {
+        return 1;
+    }
 
-//===================================================================
-//  PUBLIC FUNCTION BODIES
-//===================================================================
+    int capacity = ( animation_capacity > 0 ) ? animation_capacity : ANIMATION_LIST_START;
+    while( capacity < count )
+    {
+        capacity = ( capacity > INT_MAX / 2 ) ? count : capacity * 2;
+    }
 
-// add a new animation
-void     ANI_Add_Animation()
+    if( (size_t)capacity > SIZE_MAX / sizeof( anim_type ) )
+    {
+        return 0;
+    }
+
+    animation = UTI_EC_Realloc( animation, sizeof( anim_type ) * capacity );
+    animation_generation = UTI_EC_Realloc( animation_generation, sizeof( uint32_t ) * capacity );
+
+    int i;
+    for( i = animation_capacity; i < capacity; i++ )
+    {
+        animation_generation[i] = 0;
+    }
+
+    animation_capacity = capacity;
+
+    return 1;
+}
+
+
+// mark an animation as changed
+static void Touch_Animation( int index )
 {
-    if( no_of_animations < MAX_ANIMATIONS )
+    if( animation_generation[index] <= saved_generation )
     {
-        animation[no_of_animations] = UTI_EC_Malloc( sizeof( anim_type ) );
+        if( no_of_changed == changed_capacity )
+        {
+            changed_capacity = ( changed_capacity > 0 ) ? changed_capacity * 2 : ANIMATION_LIST_START;
+            changed_animation = UTI_EC_Realloc( changed_animation, sizeof( int ) * changed_capacity );
+        }
+
+        changed_animation[no_of_changed++] = index;
+    }
+
+    animation_generation[index] = ++generation_counter;
+
+    return;
+}
+
+
+static int Get_Pool_Frame( int slot )
+{
+    if( frame_pool_wide )
+    {
+        return ((int32_t *)frame_pool)[slot];
+    }
+
+    return ((uint16_t *)frame_pool)[slot];
+}
+
+
+// the pool is widened first if value won't fit in 16 bits
+static void Set_Pool_Frame( int slot, int value )
+{
+    if( frame_pool_wide == 0 && ( value < 0 || value > UINT16_MAX ) )
+    {
+        int32_t *wide = UTI_EC_Malloc( sizeof( int32_t ) * ( frame_pool_capacity > 0 ? frame_pool_capacity : 1 ) );
 
-        // set all frames to '-1' (equivalent to '\0' in strings)
         int i;
-        for( i = 0; i < MAX_ANIMATION_FRAMES; i++ )
+        for( i = 0; i < frame_pool_size; i++ )
         {
-            animation[no_of_animations]->frame_list[i] = -1;
+            wide[i] = ((uint16_t *)frame_pool)[i];
         }
 
-        animation[no_of_animations]->frame_wait = 1;
-        animation[no_of_animations]->no_of_frames = 0;
-        
-        no_of_animations++;
+        UTI_EC_Free( frame_pool );
+        frame_pool = wide;
+        frame_pool_wide = 1;
+    }
+
+    if( frame_pool_wide )
+    {
+        ((int32_t *)frame_pool)[slot] = value;
+    }
+    else
+    {
+        ((uint16_t *)frame_pool)[slot] = value;
+    }
+
+    return;
+}
+
+
+// qsort comparison, orders animation indices by where their frames are in the pool
+static int Compare_First_Frame( const void *a, const void *b )
+{
+    int32_t first_a = animation[*(const int *)a].first_frame;
+    int32_t first_b = animation[*(const int *)b].first_frame;
+
+    return ( first_a > first_b ) - ( first_a < first_b );
+}
+
+
+// moves every animation's frames to the start of the pool, in order, dropping unused slots
+static void Compact_Frame_Pool()
+{
+    size_t slot_size = frame_pool_wide ? sizeof( int32_t ) : sizeof( uint16_t );
+    uint8_t *pool = frame_pool;
+    int i, next = 0;
+
+    // going through the ranges in pool order means each one only ever moves down, over space
+    // that has already been dealt with
+    int *order = UTI_EC_Malloc( sizeof( int ) * ( no_of_animations > 0 ? no_of_animations : 1 ) );
+    for( i = 0; i < no_of_animations; i++ )
+    {
+        order[i] = i;
+    }
+
+    qsort( order, no_of_animations, sizeof( int ), Compare_First_Frame );
+
+    for( i = 0; i < no_of_animations; i++ )
+    {
+        anim_type *anim = &animation[order[i]];
+
+        memmove( pool + next * slot_size, pool + anim->first_frame * slot_size, anim->no_of_frames * slot_size );
+
+        anim->first_frame = next;
+        anim->frame_capacity = anim->no_of_frames;
+        next += anim->no_of_frames;
+    }
+
+    UTI_EC_Free( order );
+
+    frame_pool_size = next;
+    frame_pool_unused = 0;
+
+    return;
+}
+
+
+// hands out count slots from the end of the pool, returns the first slot or -1 on failure
+static int Allocate_Frames( int count )
+{
+    // reclaim the space left by moved ranges once it is most of the pool
+    if( frame_pool_unused > FRAME_POOL_START && frame_pool_unused > frame_pool_size / 2 )
+    {
+        Compact_Frame_Pool();
+    }
+
+    if( count > INT_MAX - frame_pool_size )
+    {
+        return -1;
+    }
+
+    if( frame_pool_size + count > frame_pool_capacity )
+    {
+        int capacity = ( frame_pool_capacity > 0 ) ? frame_pool_capacity : FRAME_POOL_START;
+        while( capacity < frame_pool_size + count )
+        {
+            capacity = ( capacity > INT_MAX / 2 ) ? frame_pool_size + count : capacity * 2;
+        }
+
+        frame_pool = UTI_EC_Realloc( frame_pool, ( frame_pool_wide ? sizeof( int32_t ) : sizeof( uint16_t ) ) * capacity );
+        frame_pool_capacity = capacity;
+    }
+
+    int first = frame_pool_size;
+    frame_pool_size += count;
+
+    return first;
+}
+
+
+// makes sure the animation has room for count frames, moving its frames to a bigger range at
+// the end of the pool if needed. returns 1 on success
+static int Reserve_Frames( anim_type *anim, int count )
+{
+    if( count <= anim->frame_capacity )
+    {
+        return 1;
+    }
+
+    int capacity = ( anim->frame_capacity > 0 ) ? anim->frame_capacity : FRAME_RANGE_START;
+    while( capacity < count )
+    {
+        capacity *= 2;
+    }
+
+    // a compaction may move anim's own frames, so look the range up after allocating
+    int first = Allocate_Frames( capacity );
+    if( first < 0 )
+    {
+        return 0;
+    }
+
+    int i;
+    for( i = 0; i < anim->no_of_frames; i++ )
+    {
+        Set_Pool_Frame( first + i, Get_Pool_Frame( anim->first_frame + i ) );
+    }
+
+    frame_pool_unused += anim->frame_capacity;
 
-        ANI_Add_Frame( no_of_animations-1, 0 );
+    anim->first_frame = first;
+    anim->frame_capacity = capacity;
 
- 
+    return 1;
+}
+
+
+// adds an animation with no frames to the end of the list, returns its index or -1 on failure
+static int New_Animation( int frame_wait )
+{
+    if( Reserve_Animations( no_of_animations + 1 ) == 0 )
+    {
+        return -1;
+    }
+
+    anim_type *anim = &animation[no_of_animations];
+
+    anim->first_frame = 0;
+    anim->no_of_frames = 0;
+    anim->frame_capacity = 0;
+    anim->frame_wait = frame_wait;
+
+    Touch_Animation( no_of_animations );
+
+    return no_of_animations++;
+}
+
+
+//===================================================================
+//  PUBLIC FUNCTION BODIES
+//===================================================================
+
+// add a new animation
+void     ANI_Add_Animation()
+{
+    int index = New_Animation( 1 );
+
+    if( index < 0 )
+    {
+        UTI_Print_Error( "Cannot add animation, out of memory" );
         return;
     }
 
-    UTI_Print_Debug( "Cannot add animation, limit reached" );
+    ANI_Add_Frame( index, 0 );
 
     return;
 }
@@ -68,16 +327,18 @@ void    ANI_Remove_Animation( int index )
 
     if( no_of_animations > 1 && index < no_of_animations && index >= 0 )
     {
-        UTI_EC_Free( animation[index] );
-        animation[index] = NULL;
+        frame_pool_unused += animation[index].frame_capacity;
 
-        for( index += 1; index < no_of_animations; index++ )
-        {
-            // rearrange animation list
-            animation[index-1] = animation[index];
-        }
+        // rearrange animation list
+        memmove( &animation[index], &animation[index+1], sizeof( anim_type ) * ( no_of_animations - index - 1 ) );
 
         no_of_animations--;
+
+        // everything after has moved down an index
+        for( ; index < no_of_animations; index++ )
+        {
+            Touch_Animation( index );
+        }
     }
 
     return;
@@ -94,7 +355,7 @@ int     ANI_Add_Frame( int anim_index, int sprite_index  )
     }
 
     anim_type *temp;
-    temp = animation[anim_index];
+    temp = &animation[anim_index];
 
 
     if( temp->no_of_frames >= MAX_ANIMATION_FRAMES )
@@ -103,7 +364,15 @@ int     ANI_Add_Frame( int anim_index, int sprite_index  )
         return 0;
     }
 
-    temp->frame_list[temp->no_of_frames++] = sprite_index;
+    if( Reserve_Frames( temp, temp->no_of_frames + 1 ) == 0 )
+    {
+        UTI_Print_Error( "Cannot add frame, out of memory" );
+        return 0;
+    }
+
+    Set_Pool_Frame( temp->first_frame + temp->no_of_frames++, sprite_index );
+
+    Touch_Animation( anim_index );
 
     return 1;
 }
@@ -119,9 +388,9 @@ void    ANI_Set_Frame( int anim_index, int frame_index, int value )
     }
 
     anim_type *temp;
-    temp = animation[anim_index];
+    temp = &animation[anim_index];
 
-    if( frame_index < 0 || frame_index > temp->no_of_frames )
+    if( frame_index < 0 || frame_index >= temp->no_of_frames )
     {
         UTI_Print_Debug( "Invalid frame_index" );
         return;
@@ -133,7 +402,9 @@ void    ANI_Set_Frame( int anim_index, int frame_index, int value )
         return;
     }
 
-    temp->frame_list[frame_index] = value;
+    Set_Pool_Frame( temp->first_frame + frame_index, value );
+
+    Touch_Animation( anim_index );
 
     return;
 }
@@ -148,21 +419,23 @@ void    ANI_Remove_Frame( int anim_index, int frame_index )
     }
 
     anim_type *temp;
-    temp = animation[anim_index];
+    temp = &animation[anim_index];
 
-    if( frame_index < 1 || frame_index > temp->no_of_frames )
+    if( frame_index < 1 || frame_index >= temp->no_of_frames )
     {
         UTI_Print_Error( "Invalid frame index" );
         return;
     }
 
-    for( ; frame_index <= temp->no_of_frames; frame_index++ )
+    for( ; frame_index < temp->no_of_frames - 1; frame_index++ )
     {
-        temp->frame_list[frame_index] = temp->frame_list[frame_index+1];
+        Set_Pool_Frame( temp->first_frame + frame_index, Get_Pool_Frame( temp->first_frame + frame_index + 1 ) );
     }
 
     temp->no_of_frames--;
 
+    Touch_Animation( anim_index );
+
     return;
 }
 
@@ -176,11 +449,12 @@ void    ANI_Delete_Frame( int anim_index )
     }
 
     anim_type *temp;
-    temp = animation[anim_index];
+    temp = &animation[anim_index];
 
     if( temp->no_of_frames > 1 )
     {
-        temp->frame_list[--(temp->no_of_frames)] = -1;
+        temp->no_of_frames--;
+        Touch_Animation( anim_index );
     }
 
     return;
@@ -192,7 +466,7 @@ int     ANI_Get_Number_Of_Frames( int anim_index )
 {
     if( anim_index >= 0 && anim_index < no_of_animations )
     {
-        return animation[anim_index]->no_of_frames;
+        return animation[anim_index].no_of_frames;
     }
 
     return -1;
@@ -208,14 +482,14 @@ int     ANI_Get_Frame( int anim_index, int frame_index )
     }
 
     anim_type *temp;
-    temp = animation[anim_index];
+    temp = &animation[anim_index];
 
-    if( frame_index < 0 || frame_index > ( temp->no_of_frames ) )
+    if( frame_index < 0 || frame_index >= temp->no_of_frames )
     {
         return -1;
     }
 
-    return temp->frame_list[frame_index];
+    return Get_Pool_Frame( temp->first_frame + frame_index );
 
 }
 
@@ -228,16 +502,40 @@ int     ANI_Get_Number_Of_Animations()
 
 
 
-void    ANI_Free()
+// returns a value that changes every time the animation is edited, 0 for an invalid index
+uint32_t ANI_Get_Animation_Generation( int anim_index )
 {
-    int counter;
-
-    for( counter = 0; counter < no_of_animations; counter++ )
+    if( anim_index < 0 || anim_index >= no_of_animations )
     {
-        UTI_EC_Free( animation[counter] );
-        animation[counter] = NULL;
+        return 0;
     }
 
+    return animation_generation[anim_index];
+}
+
+
+void    ANI_Free()
+{
+    UTI_EC_Free( animation );
+    UTI_EC_Free( frame_pool );
+    UTI_EC_Free( animation_generation );
+    UTI_EC_Free( changed_animation );
+
+    animation = NULL;
+    animation_capacity = 0;
+    no_of_animations = 0;
+
+    frame_pool = NULL;
+    frame_pool_wide = 0;
+    frame_pool_size = 0;
+    frame_pool_capacity = 0;
+    frame_pool_unused = 0;
+
+    animation_generation = NULL;
+    changed_animation = NULL;
+    no_of_changed = 0;
+    changed_capacity = 0;
+
     return;
 }
 
@@ -248,8 +546,7 @@ void    ANI_Free()
 
 #define MAX_DELAY               1024
 
-anim_type       *current_anim = NULL;
-
+// the player keeps the index of its animation, the list can move as it grows
 int     current_animation = 0;
 int     current_frame = 0;
 int     playing = 0;
@@ -257,37 +554,48 @@ int     frame_delay = 1;                    // speed of animation cycle, lower i
 int     frame_timer = 0;
 int     loop = 0;
 
+// returns the animation being played, NULL if it no longer exists
+static anim_type *Get_Current_Anim()
+{
+    if( current_animation < 0 || current_animation >= no_of_animations )
+    {
+        return NULL;
+    }
+
+    return &animation[current_animation];
+}
+
 void    ANI_Init_Animation()
 {
     //ANI_Add_Animation();
-    current_anim = animation[0];
+    current_animation = 0;
 }
 
 
 void    ANI_Set_Animations( int anim_index )
 {
-    if( anim_index < 0 || anim_index > no_of_animations )
+    if( anim_index < 0 || anim_index >= no_of_animations )
     {
         UTI_Print_Debug( "Invalid animation index" );
         return;
     }
 
-    current_anim = animation[anim_index];
+    current_animation = anim_index;
 
     return;
 }
 
 void    ANI_Play_Animation( int anim_index )
 {
-    if( anim_index < 0 || anim_index > no_of_animations )
+    if( anim_index < 0 || anim_index >= no_of_animations )
     {
         UTI_Print_Debug( "Invalid animation index" );
         return;
     }
 
-    current_anim = animation[anim_index];
+    current_animation = anim_index;
     current_frame = 0;
-    frame_timer = current_anim->frame_wait;
+    frame_timer = animation[anim_index].frame_wait;
 
     playing = 1;
 }
@@ -300,12 +608,28 @@ void    ANI_Stop_Animation()
 
 
 
-void    ANI_Update_Animation()
+// returns 1 if the animation is being played
+int     ANI_Is_Playing()
+{
+    return playing;
+}
+
+
+// returns 1 if the frame shown by the player has changed
+int     ANI_Update_Animation()
 {
     // this is called every frame, handles most of the animation
     if( playing == 0 )
     {
-        return;
+        return 0;
+    }
+
+    anim_type *current_anim = Get_Current_Anim();
+    if( current_anim == NULL )
+    {
+        // removed while playing
+        playing = 0;
+        return 1;
     }
 
     // check if its time to update the animation cycle
@@ -313,18 +637,20 @@ void    ANI_Update_Animation()
     if( frame_timer <= 0 )
     {
         current_frame++;
-        if( current_anim->frame_list[current_frame] < 0 )
+        if( current_frame >= current_anim->no_of_frames )
         {
             current_frame = 0;
 
-            // we've reached a negative index, the end of the cycle
+            // we've gone past the last frame, the end of the cycle
             playing = ( loop == 1 ) ? 1 : 0;
         }
 
         frame_timer = current_anim->frame_wait;
+
+        return 1;
     }
 
-    return;
+    return 0;
 }
 
 
@@ -338,9 +664,16 @@ void    ANI_Loop_Toggle()
 
 void    ANI_Speed_Up()
 {
+    anim_type *current_anim = Get_Current_Anim();
+    if( current_anim == NULL )
+    {
+        return;
+    }
+
     if( current_anim->frame_wait > 1 )
     {
         current_anim->frame_wait--;
+        Touch_Animation( current_animation );
     }
     else
     {
@@ -353,9 +686,16 @@ void    ANI_Speed_Up()
 
 void    ANI_Speed_Down()
 {
+    anim_type *current_anim = Get_Current_Anim();
+    if( current_anim == NULL )
+    {
+        return;
+    }
+
     if( current_anim->frame_wait < MAX_DELAY )
     {
         current_anim->frame_wait++;
+        Touch_Animation( current_animation );
     }
     else
     {
@@ -374,7 +714,13 @@ int     *ANI_Get_Loop_Address()
 
 int     ANI_Get_Current_Frame()
 {
-    return current_anim->frame_list[current_frame];
+    anim_type *current_anim = Get_Current_Anim();
+    if( current_anim == NULL || current_frame >= current_anim->no_of_frames )
+    {
+        return -1;
+    }
+
+    return Get_Pool_Frame( current_anim->first_frame + current_frame );
 }
 
 
@@ -382,53 +728,86 @@ int     ANI_Get_Current_Frame()
 //  File I/O
 //==============================
 
-// retrieve data pointer for saving to file
-anim_type   *ANI_Get_Animation( int index )
+// returns the number of player frames to wait between animation frames, -1 on fail
+int         ANI_Get_Frame_Wait( int anim_index )
 {
-    if( index >= 0 && index < no_of_animations )
+    if( anim_index >= 0 && anim_index < no_of_animations )
     {
-        return animation[index];
+        return animation[anim_index].frame_wait;
     }
 
-    return NULL;
+    return -1;
 }
 
-// takes a pointer of data loaded from file
-int         ANI_Load_Animation( int32_t *frames, int no_of_frames, int speed )
+
+// copies the animation's frames to frames, which must have room for ANI_Get_Number_Of_Frames(),
+// returns the number of frames copied
+int         ANI_Copy_Frames( int anim_index, int32_t *frames )
+{
+    if( anim_index < 0 || anim_index >= no_of_animations )
+    {
+        UTI_Print_Debug( "Invalid animation index" );
+        return 0;
+    }
+
+    anim_type *anim = &animation[anim_index];
+
+    int i;
+    for( i = 0; i < anim->no_of_frames; i++ )
+    {
+        frames[i] = Get_Pool_Frame( anim->first_frame + i );
+    }
+
+    return anim->no_of_frames;
+}
+
+
+// returns the indices of animations added or changed since ANI_Mark_Animations_Saved(), in the
+// order they first changed. indices of animations since removed are included. count is set to
+// how many
+const int   *ANI_Get_Changed_Animations( int *count )
 {
-    printf( "Attempting to load animation, %d frame%s, %d delay\n", 
-        no_of_frames, ( no_of_frames > 1 ) ? "s" : "",  speed );
+    *count = no_of_changed;
+
+    return changed_animation;
+}
 
 
-    if( no_of_animations >= MAX_ANIMATIONS-1 )
+// clears the list of changed animations, call once they have been saved
+void        ANI_Mark_Animations_Saved()
+{
+    no_of_changed = 0;
+    saved_generation = generation_counter;
+
+    return;
+}
+
+
+// adds an animation with the given frames to the end of the list
+int         ANI_Load_Animation( int32_t *frames, int no_of_frames, int speed )
+{
+    if( no_of_frames < 0 || no_of_frames > MAX_ANIMATION_FRAMES )
     {
-        UTI_Print_Debug( "Cannot load animation, limit reached" );
+        UTI_Print_Error( "Invalid number of frames" );
         return 0;
     }
 
-    anim_type       *temp = NULL;
-    temp = UTI_EC_Malloc( sizeof( anim_type ) );
+    int index = New_Animation( speed );
+    if( index < 0 || Reserve_Frames( &animation[index], no_of_frames ) == 0 )
+    {
+        UTI_Print_Error( "Cannot load animation, out of memory" );
+        return 0;
+    }
 
+    anim_type *temp = &animation[index];
 
     int i;
-    for( i = 0; i < MAX_ANIMATION_FRAMES; i++ )
+    for( i = 0; i < no_of_frames; i++ )
     {
-        if( i < no_of_frames )
-        {
-            temp->frame_list[i] = frames[i];
-        }
-        else
-        {
-            temp->frame_list[i] = -1;
-        }
+        Set_Pool_Frame( temp->first_frame + i, frames[i] );
     }
 
-    
-
-    temp->no_of_frames      = no_of_frames;
-    temp->frame_wait        = speed;
-
-    animation[no_of_animations++] = temp;
+    temp->no_of_frames = no_of_frames;
 
     return 1;
 }
@@ -438,15 +817,19 @@ int         ANI_Load_Animation( int32_t *frames, int no_of_frames, int speed )
 //  TESTING
 //===================================================================
 
+// prints the frames of the animation along with how the frame pool is being used
 void ANI_Print_Frame_List( int index )
 {
     int i;
-    for( i = 0; animation[index]->frame_list[i] != -1; i++ )
+    for( i = 0; i < ANI_Get_Number_Of_Frames( index ); i++ )
     {
-        printf( "%d\t", animation[index]->frame_list[i] );
+        printf( "%d\t", ANI_Get_Frame( index, i ) );
     }
 
     putchar( '\n' );
 
+    printf( "Frame pool: %d of %d slots used, %d unused, %d bit\n", frame_pool_size - frame_pool_unused,
+            frame_pool_capacity, frame_pool_unused, frame_pool_wide ? 32 : 16 );
+
     return;
 }
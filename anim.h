@@ -18,20 +18,7 @@
 //  CONSTANTS
 //===================================================================
 
-#define MAX_ANIMATIONS          1024
-#define MAX_ANIMATION_FRAMES    1024
-
-//===================================================================
-//  TYPES
-//===================================================================
-
-// the list of frames is terminated by '-1' this is a signal to go to the beginning (or next anim)
-struct anim_s   {   int32_t    frame_list[MAX_ANIMATION_FRAMES];        // a list of sprite indices
-                    int32_t    frame_wait;              // number of frames to wait before changing
-                    int32_t    no_of_frames;
-                };
-
-typedef struct anim_s anim_type;
+#define MAX_ANIMATION_FRAMES    1024        // most frames one animation can have
 
 //===================================================================
 //  PROTOTYPES
@@ -64,12 +51,15 @@ void    ANI_Remove_Frame( int anim_index, int frame_index );
 // return number of frames in an animation
 int     ANI_Get_Number_Of_Frames( int anim_index );
 
-// return index of a given frame in a given animation, -1 on fail
+// return index of a given frame in a given animation, -1 on fail or past the last frame
 int     ANI_Get_Frame( int anim_index, int frame_index );
 
 // return the number of animations
 int     ANI_Get_Number_Of_Animations();
 
+// returns a value that changes every time the animation is edited, 0 for an invalid index
+uint32_t ANI_Get_Animation_Generation( int anim_index );
+
 // free used memory TODO needs fixed
 void    ANI_Free();
 
@@ -81,7 +71,11 @@ void    ANI_Play_Animation( int anim_index );
 
 void    ANI_Stop_Animation();
 
-void    ANI_Update_Animation();
+// call once per frame, returns 1 if the frame shown by the player has changed
+int     ANI_Update_Animation();
+
+// returns 1 if the animation is being played
+int     ANI_Is_Playing();
 
 void    ANI_Loop_Toggle();
 
@@ -97,16 +91,29 @@ int     ANI_Get_Current_Frame();
 //  File I/O
 //==============================
 
-// retrieve data pointer for saving to file
-anim_type   *ANI_Get_Animation( int index );
+// returns the number of player frames to wait between animation frames, -1 on fail
+int         ANI_Get_Frame_Wait( int anim_index );
+
+// copies the animation's frames to frames, which must have room for ANI_Get_Number_Of_Frames(),
+// returns the number of frames copied
+int         ANI_Copy_Frames( int anim_index, int32_t *frames );
+
+// returns the indices of animations added or changed since ANI_Mark_Animations_Saved(), in the
+// order they first changed. indices of animations since removed are included. count is set to
+// how many
+const int   *ANI_Get_Changed_Animations( int *count );
+
+// clears the list of changed animations, call once they have been saved
+void        ANI_Mark_Animations_Saved();
 
-// takes a pointer of data loaded from file
-int         ANI_Load_Animation( int32_t *anim, int no_of_frames, int speed );
+// adds an animation with the given frames to the end of the list
+int         ANI_Load_Animation( int32_t *frames, int no_of_frames, int speed );
 
 //===================================================================
 //  TESTING AND DEBUGING
 //===================================================================
 
+// prints the frames of the animation along with how the frame pool is being used
 void ANI_Print_Frame_List( int index );
 
 
@@ -0,0 +1,420 @@
+//====================================================================
+//
+//  batch.c
+//
+//  checks, changes and writes sprite files from the command line
+//  without opening a window
+//
+//====================================================================
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "defs.h"
+#include "utility.h"
+#include "palette.h"
+#include "sprite.h"
+#include "anim.h"
+#include "file.h"
+#include "export.h"
+#include "thread.h"
+#include "batch.h"
+
+
+//====================================================================
+//  CONSTANTS
+//====================================================================
+
+#define BAT_MAX_ACTIONS             64
+#define BAT_MAX_REPORTS             8           // problems printed for each file, the rest are counted
+
+
+//====================================================================
+//  TYPES
+//====================================================================
+
+// a change made to every sprite of each file, see SPR_Change_Range()
+struct bat_action_s {   int     op;                 // SPR_OP_
+                        int     value;
+                    };
+
+typedef struct bat_action_s bat_action_type;
+
+
+//====================================================================
+//  FILE VARIABLES
+//====================================================================
+
+static bat_action_type      action[BAT_MAX_ACTIONS];    // in the order given
+static int                  no_of_actions = 0;
+static int                  check_files = 0;
+static int                  export_atlas = 0;
+static int                  export_strips = 0;
+static int                  export_scaling = 0;
+static char                 *output_dir = NULL;         // files are only written when this is set
+
+// the command line name of each SPR_OP_ operation
+static const char           *op_name[SPR_NO_OF_OPS] = {
+    "--shift-left",
+    "--shift-right",
+    "--shift-up",
+    "--shift-down",
+    "--flip-h",
+    "--flip-v",
+    "--clear",
+    "--palette"
+};
+
+
+//====================================================================
+//  PRIVATE FUNCTIONS
+//====================================================================
+
+static void Batch_Usage( const char *prog_name )
+{
+    printf( "Usage:%s --batch [ACTIONS] [OPTIONS] FILENAME...\n\n", prog_name );
+    printf( "Each file is opened, the actions are done to every sprite in the order given, then it is\n" );
+    printf( "checked and written. No window is opened.\n\n" );
+    printf( "Actions:\n" );
+    printf( "  --shift-left, --shift-right, --shift-up, --shift-down\n" );
+    printf( "  --flip-h, --flip-v, --clear\n" );
+    printf( "  --palette N          give every sprite user palette N\n" );
+    printf( "Options:\n" );
+    printf( "  -c, --check          fail files with frames, palettes or colours that don't exist\n" );
+    printf( "  -o, --output DIR     write each file as version 2 into DIR under its own name\n" );
+    printf( "  -a, --atlas          export each file's sprites as PNG sprite sheets and a JSON index,\n" );
+    printf( "                       into DIR if given, beside the file if not\n" );
+    printf( "  -s, --strips         export each animation as a PNG strip of its frames, as for -a\n" );
+    printf( "  -j, --threads N      export on N threads, one for each cpu if not given\n" );
+    printf( "  --scaling            export sheets and strips on 1 to N threads and time each\n" );
+    printf( "  -l, -z, -n, -d       as for a single file\n" );
+    printf( "\n" );
+
+    return;
+}
+
+
+// returns the SPR_OP_ operation an action is named for, -1 if it isn't one
+static int Find_Op( const char *name )
+{
+    int op;
+    for( op = 0; op < SPR_NO_OF_OPS; op++ )
+    {
+        if( strcmp( name, op_name[op] ) == 0 )
+        {
+            return op;
+        }
+    }
+
+    return -1;
+}
+
+
+// returns ms since start
+static double Ms_Since( const struct timespec *start )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( now.tv_sec - start->tv_sec ) * 1000.0 + ( now.tv_nsec - start->tv_nsec ) / 1000000.0;
+}
+
+
+// reports anything in the open file that refers to a sprite, palette or colour that doesn't
+// exist, returns how many problems there are
+static int Check_File( const char *name )
+{
+    int no_of_sprites       = SPR_Get_Number_Of_Sprites();
+    int no_of_animations    = ANI_Get_Number_Of_Animations();
+    int no_of_palettes      = PAL_Get_Number_Of_Palettes();
+    int problems = 0;
+    int i, j, value;
+
+    //======= ANIMATIONS =======//
+
+    for( i = 0; i < no_of_animations; i++ )
+    {
+        for( j = 0; j < ANI_Get_Number_Of_Frames( i ); j++ )
+        {
+            value = ANI_Get_Frame( i, j );
+            if( value < 0 || value >= no_of_sprites )
+            {
+                if( problems++ < BAT_MAX_REPORTS )
+                {
+                    printf( "%s: animation %d frame %d shows sprite %d, there are %d\n", name, i, j, value, no_of_sprites );
+                }
+            }
+        }
+    }
+
+    //======= SPRITES =======//
+
+    // palette 0 is always there, one is added to a file that has none when it is edited
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        value = SPR_Get_Sprite_Palette_Index( i );
+        if( value < 0 || ( value > 0 && value >= no_of_palettes ) )
+        {
+            if( problems++ < BAT_MAX_REPORTS )
+            {
+                printf( "%s: sprite %d uses palette %d, there are %d\n", name, i, value, no_of_palettes );
+            }
+        }
+    }
+
+    //======= PALETTES =======//
+
+    for( i = 0; i < no_of_palettes; i++ )
+    {
+        for( j = 0; j < PAL_USER_SIZE; j++ )
+        {
+            value = PAL_Get_User_Palette_Index( i, j );
+            if( value < 0 || value >= PAL_MAIN_SIZE )
+            {
+                if( problems++ < BAT_MAX_REPORTS )
+                {
+                    printf( "%s: palette %d colour %d is %d, there are %d\n", name, i, j, value, PAL_MAIN_SIZE );
+                }
+            }
+        }
+    }
+
+    if( problems > BAT_MAX_REPORTS )
+    {
+        printf( "%s: %d more problems\n", name, problems - BAT_MAX_REPORTS );
+    }
+
+    return problems;
+}
+
+
+// exports the open file's sheets and strips under its name without the extension, in output_dir
+// if there is one. returns 1 on success
+static int Export_File( const char *name )
+{
+    const char *base = strrchr( name, '/' );
+    const char *extension;
+    char *atlas_name;
+    int length, exported = 1;
+
+    base = ( base != NULL ) ? base + 1 : name;
+    extension = strrchr( base, '.' );
+    length = ( extension != NULL && extension != base ) ? extension - base : (int)strlen( base );
+
+    atlas_name = UTI_EC_Malloc( strlen( name ) + ( output_dir ? strlen( output_dir ) : 0 ) + 2 );
+
+    if( output_dir != NULL )
+    {
+        sprintf( atlas_name, "%s/%.*s", output_dir, length, base );
+    }
+    else
+    {
+        sprintf( atlas_name, "%.*s%.*s", (int)( base - name ), name, length, base );
+    }
+
+    if( export_scaling )
+    {
+        exported = EXP_Benchmark_Threads( atlas_name );
+    }
+
+    if( exported && export_atlas )
+    {
+        exported = EXP_Write_Atlas( atlas_name );
+    }
+
+    if( exported && export_strips )
+    {
+        exported = EXP_Write_Animations( atlas_name );
+    }
+
+    UTI_EC_Free( atlas_name );
+
+    return exported;
+}
+
+
+// opens, changes, checks and writes one file, everything is freed again after. returns 1 on
+// success
+static int Process_File( char *name )
+{
+    char *output_name = NULL;
+    int processed, i;
+
+    PAL_Init();
+    PAL_Generate_Main_Palette();
+    ANI_Init_Animation();
+    SPR_Init();
+
+    FIL_Set_Filename( name );
+    processed = ( FIL_Open_File() == FIL_OPEN_OK );
+
+    if( processed )
+    {
+        if( FIL_Get_Options() & FIL_OPTION_SHARE )
+        {
+            SPR_Share_Storage();
+        }
+
+        if( FIL_Get_Options() & FIL_OPTION_NIBBLES )
+        {
+            SPR_Pack_Storage();
+        }
+
+        for( i = 0; i < no_of_actions; i++ )
+        {
+            SPR_Change_Range( action[i].op, 0, SPR_Get_Number_Of_Sprites(), action[i].value );
+        }
+    }
+
+    if( processed && check_files && Check_File( name ) > 0 )
+    {
+        printf( "%s failed its check\n", name );
+        processed = 0;
+    }
+
+    if( processed && output_dir != NULL )
+    {
+        const char *base = strrchr( name, '/' );
+        base = ( base != NULL ) ? base + 1 : name;
+
+        output_name = UTI_EC_Malloc( strlen( output_dir ) + strlen( base ) + 2 );
+        sprintf( output_name, "%s/%s", output_dir, base );
+
+        FIL_Set_Filename( output_name );
+        processed = FIL_Write_File();
+    }
+
+    if( processed && ( export_atlas || export_strips || export_scaling ) )
+    {
+        processed = Export_File( name );
+    }
+
+    SPR_Free();
+    ANI_Free();
+    PAL_Free();
+    FIL_Free();
+
+    UTI_EC_Free( output_name );
+
+    return processed;
+}
+
+
+//====================================================================
+//  PUBLIC FUNCTIONS
+//====================================================================
+
+// runs the batch given on the command line, argv[1] being --batch. returns the exit status, 0 if
+// every file was processed
+int         BAT_Run( int argc, char *argv[] )
+{
+    // the cpu time it has taken to get here, loading the program and its libraries
+    struct timespec startup;
+    clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &startup );
+
+    char **file = UTI_EC_Malloc( sizeof( char * ) * argc );
+    int no_of_files = 0;
+    int i, op;
+
+    //======= ARGUMENTS =======//
+
+    for( i = 2; i < argc; i++ )
+    {
+        if( argv[i][0] != '-' )
+        {
+            file[no_of_files++] = argv[i];
+        }
+        else if( strcmp( argv[i], "-h" ) == 0 || strcmp( argv[i], "--help" ) == 0 )
+        {
+            Batch_Usage( argv[0] );
+            UTI_EC_Free( file );
+            return 0;
+        }
+        else if( strcmp( argv[i], "-c" ) == 0 || strcmp( argv[i], "--check" ) == 0 )
+        {
+            check_files = 1;
+        }
+        else if( strcmp( argv[i], "-a" ) == 0 || strcmp( argv[i], "--atlas" ) == 0 )
+        {
+            export_atlas = 1;
+        }
+        else if( strcmp( argv[i], "-s" ) == 0 || strcmp( argv[i], "--strips" ) == 0 )
+        {
+            export_strips = 1;
+        }
+        else if( strcmp( argv[i], "--scaling" ) == 0 )
+        {
+            export_scaling = 1;
+        }
+        else if( ( strcmp( argv[i], "-j" ) == 0 || strcmp( argv[i], "--threads" ) == 0 ) && i + 1 < argc )
+        {
+            EXP_Set_Threads( atoi( argv[++i] ) );
+        }
+        else if( ( strcmp( argv[i], "-o" ) == 0 || strcmp( argv[i], "--output" ) == 0 ) && i + 1 < argc )
+        {
+            output_dir = argv[++i];
+        }
+        else if( ( op = Find_Op( argv[i] ) ) >= 0 && no_of_actions < BAT_MAX_ACTIONS &&
+                 ( op != SPR_OP_SET_PALETTE || i + 1 < argc ) )
+        {
+            action[no_of_actions].op = op;
+            action[no_of_actions].value = ( op == SPR_OP_SET_PALETTE ) ? atoi( argv[++i] ) : 0;
+            no_of_actions++;
+        }
+        else if( FIL_Parse_Option( argv[i] ) == 0 )
+        {
+            printf( "Unknown or incomplete option '%s'\n", argv[i] );
+            Batch_Usage( argv[0] );
+            UTI_EC_Free( file );
+            return 1;
+        }
+    }
+
+    if( no_of_files == 0 )
+    {
+        Batch_Usage( argv[0] );
+        UTI_EC_Free( file );
+        return 1;
+    }
+
+    //======= PROCESS =======//
+
+    struct timespec start;
+    struct stat file_stat;
+    uint64_t bytes = 0;
+    int failed = 0;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for( i = 0; i < no_of_files; i++ )
+    {
+        if( stat( file[i], &file_stat ) == 0 )
+        {
+            bytes += file_stat.st_size;
+        }
+
+        if( Process_File( file[i] ) == 0 )
+        {
+            printf( "Unable to process %s\n", file[i] );
+            failed++;
+        }
+    }
+
+    double ms = Ms_Since( &start );
+    double seconds = ( ms > 0.0 ) ? ms / 1000.0 : 0.001;
+
+    printf( "\nProcessed %d files, %d failed, in %.1f ms: %.1f files/sec, %.1f MB/s read\n",
+            no_of_files, failed, ms, no_of_files / seconds, bytes / seconds / ( 1024.0 * 1024.0 ) );
+    printf( "Started in %.2f ms of cpu time\n", startup.tv_sec * 1000.0 + startup.tv_nsec / 1000000.0 );
+
+    // the exports' threads are kept for every file, end them now
+    THR_Stop_Threads();
+
+    UTI_EC_Free( file );
+
+    return failed > 0;
+}
@@ -0,0 +1,25 @@
+//===================================================================
+//
+//  batch.h
+//
+//  checks, changes and writes sprite files from the command line
+//  without opening a window
+//
+//===================================================================
+
+#ifndef __batch_h__
+#define __batch_h__
+
+
+//===================================================================
+//  PROTOTYPES
+//===================================================================
+
+// runs the batch given on the command line, argv[1] being --batch. each file is opened, changed,
+// checked and written in turn, then the time taken is printed. no window is opened and SDL isn't
+// started. returns the exit status, 0 if every file was processed
+int         BAT_Run( int argc, char *argv[] );
+
+
+
+#endif // __batch_h__
@@ -127,7 +127,6 @@
 
 #define PAL_MAIN_SIZE               64
 #define PAL_USER_SIZE               16
-#define PAL_MAX_USER_PALETTES       1024
 
 
 
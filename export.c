@@ -0,0 +1,1107 @@
+//====================================================================
+//
+//  export.c
+//
+//  writes the sprites out as images for other programs to use
+//
+//====================================================================
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "defs.h"
+#include "utility.h"
+#include "palette.h"
+#include "sprite.h"
+#include "anim.h"
+#include "png.h"
+#include "thread.h"
+#include "export.h"
+
+
+//====================================================================
+//  CONSTANTS
+//====================================================================
+
+#define EXP_MIN_SHEET_SIZE          32          // smallest side a sheet is packed on, a power of 2
+#define EXP_BAND_ROWS               64          // rows of a sheet drawn at a time
+#define EXP_SHEET_COLORS            ( PAL_MAIN_SIZE + 1 )   // transparent then the main palette
+#define EXP_SPRITE_BATCH            1024        // sprites looked at by each job
+
+
+//====================================================================
+//  TYPES
+//====================================================================
+
+// a distinct image, what one or more sprites look like trimmed to the pixels that aren't
+// transparent
+struct exp_frame_s {    int             sprite;             // the first sprite that looks like this
+                        int             trim_x;             // where the image is in that sprite
+                        int             trim_y;
+                        int             w;
+                        int             h;
+                        uint32_t        hash;
+                        int             next;               // next frame with the same hash bucket
+                        int             sheet;              // where it is packed, -1 until it is
+                        int             x;
+                        int             y;
+                   };
+
+typedef struct exp_frame_s exp_frame_type;
+
+// the frame a sprite shows and where its image is in the sprite
+struct exp_sprite_s {   int             frame;              // -1 when the sprite is all transparent
+                        int             trim_x;
+                        int             trim_y;
+                        int             w;                  // 0 when the sprite is all transparent
+                        int             h;
+                        uint32_t        hash;
+                    };
+
+typedef struct exp_sprite_s exp_sprite_type;
+
+// a level stretch of the skyline, the top edge of what has been packed on a sheet so far
+struct exp_skyline_s {  int             x;
+                        int             y;
+                        int             w;
+                     };
+
+typedef struct exp_skyline_s exp_skyline_type;
+
+struct exp_sheet_s {    int             w;
+                        int             h;
+                        int             first;              // its frames in placed, top to bottom
+                        int             count;
+                   };
+
+typedef struct exp_sheet_s exp_sheet_type;
+
+
+//====================================================================
+//  FILE VARIABLES
+//====================================================================
+
+static int                          no_of_threads = 0;          // 0 for one for each cpu
+static int                          quiet = 0;                  // set while benchmarking
+
+// set up by EXP_Write_Atlas() and freed before it returns
+static exp_frame_type               *frame = NULL;
+static int                          no_of_frames = 0;
+static exp_sprite_type              *sprite_frame = NULL;       // one for each sprite
+static exp_sheet_type               *sheet = NULL;
+static int                          no_of_sheets = 0;
+static int                          *placed = NULL;             // frames by sheet then row
+static int                          *job_written = NULL;        // set by each output job
+
+// what is being exported, copied before any threads start so they never call into the sprite,
+// palette or animation code. see Copy_Sprites() and Copy_Animations()
+static uint8_t                      *sprite_pixels = NULL;      // SPRITE_SIZE for each sprite
+static int                          *sprite_table = NULL;       // the table each sprite uses
+static int                          no_of_sprites = 0;
+static uint8_t                      *table = NULL;              // a table for each palette
+static int                          blank_table = 0;            // all transparent, after the others
+static uint32_t                     sheet_palette[EXP_SHEET_COLORS];
+
+static int                          *anim_frames = NULL;        // every animation's frames
+static int                          *anim_first = NULL;         // where each starts, and the end
+static int                          *anim_wait = NULL;
+static int                          no_of_anims = 0;
+
+// a skyline covers the whole width of a sheet, so it never has more stretches than that
+static exp_skyline_type             skyline[EXP_MAX_SHEET_SIZE + 1];
+static int                          skyline_size = 0;
+
+
+//====================================================================
+//  PRIVATE FUNCTIONS
+//====================================================================
+
+// the number of threads jobs are run on
+static int Threads()
+{
+    return ( no_of_threads > 0 ) ? no_of_threads : THR_Get_Number_Of_CPUs();
+}
+
+
+static int Power_Of_Two_At_Least( int n )
+{
+    int p = 1;
+    while( p < n )
+    {
+        p *= 2;
+    }
+
+    return p;
+}
+
+
+//==========================
+//  COPIES
+//==========================
+
+// copies every sprite and makes a table of the sheet colour of each pixel value for each
+// palette, 0 for transparent and 1 more than the main palette colour for the rest. sprites whose
+// palette doesn't exist use an all transparent table after the others
+static void Copy_Sprites()
+{
+    int no_of_palettes = PAL_Get_Number_Of_Palettes();
+    int i, value, main_index, palette;
+
+    table = UTI_EC_Malloc( (size_t)PAL_COLOR_TABLE_SIZE * ( no_of_palettes + 1 ) );
+    memset( table, 0, (size_t)PAL_COLOR_TABLE_SIZE * ( no_of_palettes + 1 ) );
+
+    for( i = 0; i < no_of_palettes; i++ )
+    {
+        for( value = 1; value < PAL_USER_SIZE; value++ )
+        {
+            main_index = PAL_Get_User_Palette_Index( i, value );
+            if( main_index >= 0 && main_index < PAL_MAIN_SIZE )
+            {
+                table[(size_t)i * PAL_COLOR_TABLE_SIZE + value] = main_index + 1;
+            }
+        }
+    }
+
+    blank_table = no_of_palettes;
+
+    sheet_palette[0] = 0;
+    for( i = 0; i < PAL_MAIN_SIZE; i++ )
+    {
+        sheet_palette[i + 1] = PAL_Get_Main_Palette_Color( i );
+    }
+
+    no_of_sprites = SPR_Get_Number_Of_Sprites();
+    sprite_pixels = UTI_EC_Malloc( (size_t)SPRITE_SIZE * ( no_of_sprites + 1 ) );
+    sprite_table = UTI_EC_Malloc( sizeof( int ) * ( no_of_sprites + 1 ) );
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        memcpy( sprite_pixels + (size_t)i * SPRITE_SIZE, SPR_Get_Sprite( i ), SPRITE_SIZE );
+
+        palette = SPR_Get_Sprite_Palette_Index( i );
+        sprite_table[i] = ( palette >= 0 && palette < no_of_palettes ) ? palette : no_of_palettes;
+    }
+
+    return;
+}
+
+
+static void Copy_Animations()
+{
+    int i, j, total = 0;
+
+    no_of_anims = ANI_Get_Number_Of_Animations();
+    anim_first = UTI_EC_Malloc( sizeof( int ) * ( no_of_anims + 1 ) );
+    anim_wait = UTI_EC_Malloc( sizeof( int ) * ( no_of_anims + 1 ) );
+
+    for( i = 0; i < no_of_anims; i++ )
+    {
+        anim_first[i] = total;
+        anim_wait[i] = ANI_Get_Frame_Wait( i );
+        total += ANI_Get_Number_Of_Frames( i );
+    }
+    anim_first[no_of_anims] = total;
+
+    anim_frames = UTI_EC_Malloc( sizeof( int ) * ( total + 1 ) );
+    for( i = 0; i < no_of_anims; i++ )
+    {
+        for( j = anim_first[i]; j < anim_first[i + 1]; j++ )
+        {
+            anim_frames[j] = ANI_Get_Frame( i, j - anim_first[i] );
+        }
+    }
+
+    return;
+}
+
+
+static void Free_Copies()
+{
+    UTI_EC_Free( sprite_pixels );
+    UTI_EC_Free( sprite_table );
+    UTI_EC_Free( table );
+    UTI_EC_Free( anim_frames );
+    UTI_EC_Free( anim_first );
+    UTI_EC_Free( anim_wait );
+
+    sprite_pixels = NULL;
+    sprite_table = NULL;
+    table = NULL;
+    anim_frames = NULL;
+    anim_first = NULL;
+    anim_wait = NULL;
+    no_of_sprites = 0;
+    no_of_anims = 0;
+
+    return;
+}
+
+
+//==========================
+//  FRAMES
+//==========================
+
+// fills in the SPRITE_SIZE sheet colours of a copied sprite. no two main palette colours are the
+// same, so this compares the same as the RGBA colours would
+static void Resolve_Sprite( int index, uint8_t *color )
+{
+    const uint8_t *pixels = sprite_pixels + (size_t)index * SPRITE_SIZE;
+    const uint8_t *colors = table + (size_t)sprite_table[index] * PAL_COLOR_TABLE_SIZE;
+    int i;
+
+    for( i = 0; i < SPRITE_SIZE; i++ )
+    {
+        color[i] = colors[pixels[i]];
+    }
+
+    return;
+}
+
+
+// finds the smallest rectangle holding every pixel that isn't transparent, returns 0 if they all
+// are
+static int Trim_Sprite( const uint8_t *color, int *trim_x, int *trim_y, int *w, int *h )
+{
+    uint32_t row, columns = 0;
+    int top = -1, bottom = -1;
+    int x, y;
+
+    for( y = 0; y < SPRITE_H; y++ )
+    {
+        // a bit for each pixel in the row that is showing
+        row = 0;
+        for( x = 0; x < SPRITE_W; x++ )
+        {
+            row |= (uint32_t)( color[y * SPRITE_W + x] != 0 ) << x;
+        }
+
+        if( row != 0 )
+        {
+            top = ( top < 0 ) ? y : top;
+            bottom = y;
+            columns |= row;
+        }
+    }
+
+    if( columns == 0 )
+    {
+        return 0;
+    }
+
+    *trim_x = __builtin_ctz( columns );
+    *trim_y = top;
+    *w = 32 - __builtin_clz( columns ) - *trim_x;
+    *h = bottom - top + 1;
+
+    return 1;
+}
+
+
+static uint32_t Hash_Image( const uint8_t *color, int trim_x, int trim_y, int w, int h )
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)( w << 8 | h );
+    int x, y;
+
+    for( y = trim_y; y < trim_y + h; y++ )
+    {
+        for( x = trim_x; x < trim_x + w; x++ )
+        {
+            hash = ( hash ^ color[y * SPRITE_W + x] ) * 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+
+// returns 1 if a frame has the same image as the trimmed colours
+static int Same_Image( const exp_frame_type *f, const uint8_t *color, int trim_x, int trim_y )
+{
+    uint8_t image[SPRITE_SIZE];
+    int y;
+
+    Resolve_Sprite( f->sprite, image );
+
+    for( y = 0; y < f->h; y++ )
+    {
+        if( memcmp( &image[( f->trim_y + y ) * SPRITE_W + f->trim_x], &color[( trim_y + y ) * SPRITE_W + trim_x],
+                    f->w ) != 0 )
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// trims and hashes each sprite in a batch of EXP_SPRITE_BATCH, a job for THR_Run()
+static void Find_Images( void *data, int batch )
+{
+    exp_sprite_type *image;
+    uint8_t color[SPRITE_SIZE];
+    int i, end;
+
+    (void)data;
+
+    end = ( batch + 1 ) * EXP_SPRITE_BATCH;
+    end = ( end > no_of_sprites ) ? no_of_sprites : end;
+
+    for( i = batch * EXP_SPRITE_BATCH; i < end; i++ )
+    {
+        image = &sprite_frame[i];
+        Resolve_Sprite( i, color );
+
+        if( Trim_Sprite( color, &image->trim_x, &image->trim_y, &image->w, &image->h ) == 0 )
+        {
+            image->trim_x = 0;
+            image->trim_y = 0;
+            image->w = 0;
+            image->h = 0;
+            continue;
+        }
+
+        image->hash = Hash_Image( color, image->trim_x, image->trim_y, image->w, image->h );
+    }
+
+    return;
+}
+
+
+// works out the frame each sprite shows, adding a frame for each different image. sprites are
+// trimmed and hashed on every thread, then given frames in order so the ids are always the same
+static void Find_Frames()
+{
+    int no_of_buckets = Power_Of_Two_At_Least( 2 * no_of_sprites + 1 );
+    int *bucket = UTI_EC_Malloc( sizeof( int ) * no_of_buckets );
+    exp_sprite_type *image;
+    uint8_t color[SPRITE_SIZE];
+    int i, id;
+
+    frame = UTI_EC_Malloc( sizeof( exp_frame_type ) * ( no_of_sprites + 1 ) );
+    sprite_frame = UTI_EC_Malloc( sizeof( exp_sprite_type ) * ( no_of_sprites + 1 ) );
+    no_of_frames = 0;
+
+    THR_Run( Find_Images, NULL, ( no_of_sprites + EXP_SPRITE_BATCH - 1 ) / EXP_SPRITE_BATCH, Threads() );
+
+    for( i = 0; i < no_of_buckets; i++ )
+    {
+        bucket[i] = -1;
+    }
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        image = &sprite_frame[i];
+        image->frame = -1;
+
+        if( image->w == 0 )
+        {
+            continue;
+        }
+
+        // only sprites whose hash matches are looked at again
+        for( id = bucket[image->hash & ( no_of_buckets - 1 )]; id >= 0; id = frame[id].next )
+        {
+            if( frame[id].hash == image->hash && frame[id].w == image->w && frame[id].h == image->h )
+            {
+                Resolve_Sprite( i, color );
+                if( Same_Image( &frame[id], color, image->trim_x, image->trim_y ) )
+                {
+                    break;
+                }
+            }
+        }
+
+        if( id < 0 )
+        {
+            id = no_of_frames++;
+
+            frame[id].sprite = i;
+            frame[id].trim_x = image->trim_x;
+            frame[id].trim_y = image->trim_y;
+            frame[id].w = image->w;
+            frame[id].h = image->h;
+            frame[id].hash = image->hash;
+            frame[id].sheet = -1;
+            frame[id].next = bucket[image->hash & ( no_of_buckets - 1 )];
+            bucket[image->hash & ( no_of_buckets - 1 )] = id;
+        }
+
+        image->frame = id;
+    }
+
+    UTI_EC_Free( bucket );
+
+    return;
+}
+
+
+//==========================
+//  PACKING
+//==========================
+
+// tallest first, then widest, then in the order they were found so packing is always the same
+static int Compare_Frames( const void *a, const void *b )
+{
+    const exp_frame_type *fa = &frame[*(const int *)a];
+    const exp_frame_type *fb = &frame[*(const int *)b];
+
+    if( fa->h != fb->h )
+    {
+        return fb->h - fa->h;
+    }
+
+    if( fa->w != fb->w )
+    {
+        return fb->w - fa->w;
+    }
+
+    return *(const int *)a - *(const int *)b;
+}
+
+
+// the width a frame takes on the skyline, padding included unless it is against the edge
+static int Span( int x, int w, int sheet_w )
+{
+    return ( x + w + EXP_PADDING > sheet_w ) ? sheet_w - x : w + EXP_PADDING;
+}
+
+
+// finds the lowest place a w by h frame fits, the leftmost of the lowest. sets x and y and returns
+// the stretch it starts on, or -1 if it doesn't fit
+static int Find_Place( int w, int h, int sheet_w, int sheet_h, int *x, int *y )
+{
+    int best = -1;
+    int i, j, top, left;
+
+    for( i = 0; i < skyline_size && skyline[i].x + w <= sheet_w; i++ )
+    {
+        // it sits on the highest stretch under it
+        top = 0;
+        left = Span( skyline[i].x, w, sheet_w );
+        for( j = i; left > 0; j++ )
+        {
+            top = ( skyline[j].y > top ) ? skyline[j].y : top;
+            left -= skyline[j].w;
+        }
+
+        if( top + h <= sheet_h && ( best < 0 || top < *y ) )
+        {
+            best = i;
+            *x = skyline[i].x;
+            *y = top;
+        }
+    }
+
+    return best;
+}
+
+
+// raises the skyline over a frame placed on stretch i
+static void Place_Frame( int i, int x, int y, int w, int h, int sheet_w )
+{
+    int span = Span( x, w, sheet_w );
+    int j, cut;
+
+    memmove( &skyline[i + 1], &skyline[i], sizeof( exp_skyline_type ) * ( skyline_size - i ) );
+    skyline_size++;
+
+    skyline[i].x = x;
+    skyline[i].y = y + h + EXP_PADDING;
+    skyline[i].w = span;
+
+    // stretches it covers are cut back or removed
+    j = i + 1;
+    while( j < skyline_size && skyline[j].x < x + span )
+    {
+        cut = x + span - skyline[j].x;
+        if( skyline[j].w > cut )
+        {
+            skyline[j].x += cut;
+            skyline[j].w -= cut;
+            break;
+        }
+
+        memmove( &skyline[j], &skyline[j + 1], sizeof( exp_skyline_type ) * ( skyline_size - j - 1 ) );
+        skyline_size--;
+    }
+
+    // neighbours at the same height become one
+    j = 0;
+    while( j + 1 < skyline_size )
+    {
+        if( skyline[j].y == skyline[j + 1].y )
+        {
+            skyline[j].w += skyline[j + 1].w;
+            memmove( &skyline[j + 1], &skyline[j + 2], sizeof( exp_skyline_type ) * ( skyline_size - j - 2 ) );
+            skyline_size--;
+        }
+        else
+        {
+            j++;
+        }
+    }
+
+    return;
+}
+
+
+// packs as many of the count frames listed in order as fit on a side by side sheet, bottom left
+// first. sets the width and height used and returns how many were packed
+static int Pack_Sheet( const int *order, int count, int side, int sheet_index, int *used_w, int *used_h )
+{
+    exp_frame_type *f;
+    int placed = 0;
+    int i, at, x = 0, y = 0;
+
+    skyline[0].x = 0;
+    skyline[0].y = 0;
+    skyline[0].w = side;
+    skyline_size = 1;
+
+    *used_w = 0;
+    *used_h = 0;
+
+    for( i = 0; i < count; i++ )
+    {
+        f = &frame[order[i]];
+        f->sheet = -1;
+
+        at = Find_Place( f->w, f->h, side, side, &x, &y );
+        if( at < 0 )
+        {
+            continue;
+        }
+
+        Place_Frame( at, x, y, f->w, f->h, side );
+
+        f->sheet = sheet_index;
+        f->x = x;
+        f->y = y;
+
+        *used_w = ( x + f->w > *used_w ) ? x + f->w : *used_w;
+        *used_h = ( y + f->h > *used_h ) ? y + f->h : *used_h;
+        placed++;
+    }
+
+    return placed;
+}
+
+
+// packs every frame onto as few sheets as it can. each is the smallest power of two square that
+// holds what is left, up to EXP_MAX_SHEET_SIZE, then cut down to a power of two around what it
+// holds
+static void Pack_Frames()
+{
+    int *order = UTI_EC_Malloc( sizeof( int ) * ( no_of_frames + 1 ) );
+    int remaining = no_of_frames;
+    int i, n, side, placed, used_w, used_h;
+    int64_t area;
+
+    for( i = 0; i < no_of_frames; i++ )
+    {
+        order[i] = i;
+    }
+
+    qsort( order, no_of_frames, sizeof( int ), Compare_Frames );
+
+    sheet = UTI_EC_Malloc( sizeof( exp_sheet_type ) * ( no_of_frames + 1 ) );
+    no_of_sheets = 0;
+
+    while( remaining > 0 )
+    {
+        area = 0;
+        for( i = 0; i < remaining; i++ )
+        {
+            area += (int64_t)( frame[order[i]].w + EXP_PADDING ) * ( frame[order[i]].h + EXP_PADDING );
+        }
+
+        side = EXP_MIN_SHEET_SIZE;
+        while( side < EXP_MAX_SHEET_SIZE && (int64_t)side * side < area )
+        {
+            side *= 2;
+        }
+
+        // a square holding their area can still be too small for them to fit
+        placed = Pack_Sheet( order, remaining, side, no_of_sheets, &used_w, &used_h );
+        while( placed < remaining && side < EXP_MAX_SHEET_SIZE )
+        {
+            side *= 2;
+            placed = Pack_Sheet( order, remaining, side, no_of_sheets, &used_w, &used_h );
+        }
+
+        sheet[no_of_sheets].w = Power_Of_Two_At_Least( used_w );
+        sheet[no_of_sheets].h = Power_Of_Two_At_Least( used_h );
+        no_of_sheets++;
+
+        // the frames that didn't fit go on the next sheet, still in order
+        for( i = 0, n = 0; i < remaining; i++ )
+        {
+            if( frame[order[i]].sheet < 0 )
+            {
+                order[n++] = order[i];
+            }
+        }
+
+        remaining = n;
+    }
+
+    UTI_EC_Free( order );
+
+    return;
+}
+
+
+//==========================
+//  WRITING
+//==========================
+
+// sheet then row then column, the order a sheet's frames are drawn in
+static int Compare_Places( const void *a, const void *b )
+{
+    const exp_frame_type *fa = &frame[*(const int *)a];
+    const exp_frame_type *fb = &frame[*(const int *)b];
+
+    if( fa->sheet != fb->sheet )
+    {
+        return fa->sheet - fb->sheet;
+    }
+
+    if( fa->y != fb->y )
+    {
+        return fa->y - fb->y;
+    }
+
+    return fa->x - fb->x;
+}
+
+
+// draws the frames placed on a sheet a band of rows at a time and writes it to name_N.png.
+// return 1 on success
+static int Write_Sheet( const char *name, int sheet_index )
+{
+    int w = sheet[sheet_index].w, h = sheet[sheet_index].h;
+    const int *on_sheet = placed + sheet[sheet_index].first;
+    int count = sheet[sheet_index].count;
+    uint8_t color[SPRITE_SIZE];
+    const exp_frame_type *f;
+    int first = 0;
+    int i, y, top, rows, end;
+
+    char *filename = UTI_EC_Malloc( strlen( name ) + 16 );
+    sprintf( filename, "%s_%d.png", name, sheet_index );
+
+    png_type *png = PNG_Open( filename, w, h, 8, sheet_palette, EXP_SHEET_COLORS );
+    UTI_EC_Free( filename );
+
+    if( png == NULL )
+    {
+        return 0;
+    }
+
+    uint8_t *band = UTI_EC_Malloc( (size_t)w * EXP_BAND_ROWS );
+
+    for( top = 0; top < h; top += EXP_BAND_ROWS )
+    {
+        rows = ( h - top < EXP_BAND_ROWS ) ? h - top : EXP_BAND_ROWS;
+        memset( band, 0, (size_t)w * rows );
+
+        // frames are no taller than a sprite, so one starting further up than that has ended
+        while( first < count && frame[on_sheet[first]].y + SPRITE_H <= top )
+        {
+            first++;
+        }
+
+        for( i = first; i < count && frame[on_sheet[i]].y < top + rows; i++ )
+        {
+            f = &frame[on_sheet[i]];
+            Resolve_Sprite( f->sprite, color );
+
+            y = ( f->y > top ) ? f->y : top;
+            end = ( f->y + f->h < top + rows ) ? f->y + f->h : top + rows;
+            for( ; y < end; y++ )
+            {
+                memcpy( band + (size_t)( y - top ) * w + f->x,
+                        color + ( f->trim_y + y - f->y ) * SPRITE_W + f->trim_x, f->w );
+            }
+        }
+
+        PNG_Write_Rows( png, band, rows );
+    }
+
+    UTI_EC_Free( band );
+
+    return PNG_Close( png );
+}
+
+
+// lists the frames on each sheet top to bottom
+static void Place_Frames()
+{
+    int i, first;
+
+    placed = UTI_EC_Malloc( sizeof( int ) * ( no_of_frames + 1 ) );
+
+    for( i = 0; i < no_of_frames; i++ )
+    {
+        placed[i] = i;
+    }
+
+    qsort( placed, no_of_frames, sizeof( int ), Compare_Places );
+
+    for( i = 0, first = 0; i < no_of_sheets; i++ )
+    {
+        sheet[i].first = first;
+        sheet[i].count = 0;
+        while( first < no_of_frames && frame[placed[first]].sheet == i )
+        {
+            sheet[i].count++;
+            first++;
+        }
+    }
+
+    return;
+}
+
+
+// writes where every frame, sprite and animation is to name.json. return 1 on success
+static int Write_Index( const char *name )
+{
+    char *filename = UTI_EC_Malloc( strlen( name ) + 8 );
+    sprintf( filename, "%s.json", name );
+
+    FILE *file = fopen( filename, "w" );
+    UTI_EC_Free( filename );
+
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create atlas index" );
+        return 0;
+    }
+
+    // sheets are named relative to the index
+    const char *base = strrchr( name, '/' );
+    base = ( base != NULL ) ? base + 1 : name;
+
+    int i, j;
+
+    fprintf( file, "{\n  \"sprite_width\": %d,\n  \"sprite_height\": %d,\n", SPRITE_W, SPRITE_H );
+
+    fprintf( file, "  \"sheets\": [\n" );
+    for( i = 0; i < no_of_sheets; i++ )
+    {
+        fprintf( file, "    { \"image\": \"%s_%d.png\", \"w\": %d, \"h\": %d }%s\n", base, i, sheet[i].w, sheet[i].h,
+                 ( i + 1 < no_of_sheets ) ? "," : "" );
+    }
+
+    // where each frame is on its sheet
+    fprintf( file, "  ],\n  \"frames\": [\n" );
+    for( i = 0; i < no_of_frames; i++ )
+    {
+        fprintf( file, "    { \"sheet\": %d, \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d }%s\n", frame[i].sheet,
+                 frame[i].x, frame[i].y, frame[i].w, frame[i].h, ( i + 1 < no_of_frames ) ? "," : "" );
+    }
+
+    // the frame each sprite shows and where it goes in the sprite, -1 for nothing
+    fprintf( file, "  ],\n  \"sprites\": [\n" );
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        fprintf( file, "    { \"frame\": %d, \"x\": %d, \"y\": %d }%s\n", sprite_frame[i].frame,
+                 sprite_frame[i].trim_x, sprite_frame[i].trim_y, ( i + 1 < no_of_sprites ) ? "," : "" );
+    }
+
+    // the sprites each animation shows
+    fprintf( file, "  ],\n  \"animations\": [\n" );
+    for( i = 0; i < no_of_anims; i++ )
+    {
+        fprintf( file, "    { \"wait\": %d, \"frames\": [", anim_wait[i] );
+        for( j = anim_first[i]; j < anim_first[i + 1]; j++ )
+        {
+            fprintf( file, "%s%d", ( j > anim_first[i] ) ? ", " : " ", anim_frames[j] );
+        }
+        fprintf( file, " ] }%s\n", ( i + 1 < no_of_anims ) ? "," : "" );
+    }
+
+    fprintf( file, "  ]\n}\n" );
+
+    int written = ( ferror( file ) == 0 );
+    if( fclose( file ) != 0 )
+    {
+        written = 0;
+    }
+
+    if( written == 0 )
+    {
+        UTI_Print_Error( "Unable to write atlas index" );
+    }
+
+    return written;
+}
+
+
+
+
+// writes count copied sprites side by side to filename, a missing sprite is left transparent.
+// sprites that all use one user palette are written as 4 bit pixels with its colours, others as
+// a sheet is. return 1 on success
+static int Write_Strip( const char *filename, const int *sprites, int count )
+{
+    int w = ( ( count > 0 ) ? count : 1 ) * SPRITE_W;
+    uint32_t palette[PAL_USER_SIZE];
+    uint8_t color[SPRITE_SIZE];
+    const uint8_t *pixels;
+    int i, x, y, shared_table;
+
+    shared_table = ( count > 0 && sprites[0] >= 0 && sprites[0] < no_of_sprites ) ? sprite_table[sprites[0]] : -1;
+    for( i = 0; i < count && shared_table >= 0; i++ )
+    {
+        if( sprites[i] < 0 || sprites[i] >= no_of_sprites || sprite_table[sprites[i]] != shared_table )
+        {
+            shared_table = -1;
+        }
+    }
+
+    if( shared_table == blank_table )
+    {
+        shared_table = -1;
+    }
+
+    uint8_t *strip = UTI_EC_Malloc( (size_t)w * SPRITE_H );
+    memset( strip, 0, (size_t)w * SPRITE_H );
+
+    for( i = 0; i < count; i++ )
+    {
+        if( sprites[i] < 0 || sprites[i] >= no_of_sprites )
+        {
+            continue;
+        }
+
+        if( shared_table >= 0 )
+        {
+            // values outside the user palette are transparent, as they are on a sheet
+            pixels = sprite_pixels + (size_t)sprites[i] * SPRITE_SIZE;
+            for( x = 0; x < SPRITE_SIZE; x++ )
+            {
+                color[x] = ( pixels[x] < PAL_USER_SIZE ) ? pixels[x] : 0;
+            }
+        }
+        else
+        {
+            Resolve_Sprite( sprites[i], color );
+        }
+
+        for( y = 0; y < SPRITE_H; y++ )
+        {
+            memcpy( strip + (size_t)y * w + i * SPRITE_W, color + y * SPRITE_W, SPRITE_W );
+        }
+    }
+
+    png_type *png;
+    if( shared_table >= 0 )
+    {
+        for( i = 0; i < PAL_USER_SIZE; i++ )
+        {
+            palette[i] = sheet_palette[table[(size_t)shared_table * PAL_COLOR_TABLE_SIZE + i]];
+        }
+
+        png = PNG_Open( filename, w, SPRITE_H, 4, palette, PAL_USER_SIZE );
+    }
+    else
+    {
+        png = PNG_Open( filename, w, SPRITE_H, 8, sheet_palette, EXP_SHEET_COLORS );
+    }
+
+    int written = 0;
+    if( png != NULL )
+    {
+        PNG_Write_Rows( png, strip, SPRITE_H );
+        written = PNG_Close( png );
+    }
+
+    UTI_EC_Free( strip );
+
+    return written;
+}
+
+
+//==========================
+//  JOBS
+//==========================
+
+// writes the index or a sheet, a job for THR_Run(). the index is first as it takes about as long
+// as a sheet, the sheets are biggest first
+static void Atlas_Job( void *data, int index )
+{
+    const char *name = data;
+
+    job_written[index] = ( index == 0 ) ? Write_Index( name ) : Write_Sheet( name, index - 1 );
+
+    return;
+}
+
+
+// writes an animation's strip, a job for THR_Run()
+static void Strip_Job( void *data, int index )
+{
+    const char *name = data;
+    char *filename = UTI_EC_Malloc( strlen( name ) + 24 );
+
+    sprintf( filename, "%s_anim_%d.png", name, index );
+    job_written[index] = Write_Strip( filename, anim_frames + anim_first[index], anim_first[index + 1] - anim_first[index] );
+
+    UTI_EC_Free( filename );
+
+    return;
+}
+
+
+// runs count jobs and returns 1 if they all wrote what they had to
+static int Run_Jobs( thr_job_type job, const char *name, int count )
+{
+    int written = 1;
+    int i;
+
+    job_written = UTI_EC_Malloc( sizeof( int ) * ( count + 1 ) );
+
+    THR_Run( job, (void *)name, count, Threads() );
+
+    for( i = 0; i < count; i++ )
+    {
+        written &= job_written[i];
+    }
+
+    UTI_EC_Free( job_written );
+    job_written = NULL;
+
+    return written;
+}
+
+
+static double Ms_Since( const struct timespec *start )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( now.tv_sec - start->tv_sec ) * 1000.0 + ( now.tv_nsec - start->tv_nsec ) / 1000000.0;
+}
+
+
+//====================================================================
+//  PUBLIC FUNCTIONS
+//====================================================================
+
+// sets how many threads exports run on, 0 for one for each cpu
+void        EXP_Set_Threads( int count )
+{
+    no_of_threads = ( count > 0 ) ? count : 0;
+
+    return;
+}
+
+
+// writes every sprite to power of two sprite sheets, name_N.png, and an index of them to
+// name.json. return 1 on success
+int         EXP_Write_Atlas( const char *name )
+{
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    int written;
+
+    Copy_Sprites();
+    Copy_Animations();
+
+    Find_Frames();
+    Pack_Frames();
+    Place_Frames();
+
+    written = Run_Jobs( Atlas_Job, name, 1 + no_of_sheets );
+
+    if( written && quiet == 0 )
+    {
+        printf( "Exported %d sprites as %d frames on %d sheets to %s.json in %.1f ms on %d threads\n", no_of_sprites,
+                no_of_frames, no_of_sheets, name, Ms_Since( &start ), Threads() );
+    }
+
+    UTI_EC_Free( frame );
+    UTI_EC_Free( sprite_frame );
+    UTI_EC_Free( sheet );
+    UTI_EC_Free( placed );
+    frame = NULL;
+    sprite_frame = NULL;
+    sheet = NULL;
+    placed = NULL;
+    no_of_frames = 0;
+    no_of_sheets = 0;
+
+    Free_Copies();
+
+    return written;
+}
+
+
+// writes each animation's frames as a strip to name_anim_N.png. return 1 on success
+int         EXP_Write_Animations( const char *name )
+{
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    int written;
+
+    Copy_Sprites();
+    Copy_Animations();
+
+    written = Run_Jobs( Strip_Job, name, no_of_anims );
+
+    if( written && quiet == 0 )
+    {
+        printf( "Exported %d animations to %s_anim_N.png in %.1f ms on %d threads\n", no_of_anims, name,
+                Ms_Since( &start ), Threads() );
+    }
+
+    Free_Copies();
+
+    return written;
+}
+
+
+// exports the sheets and strips on 1, 2, 4 and so on threads, up to the number EXP_Set_Threads()
+// gives, and prints how long each takes. return 1 if every export was written
+int         EXP_Benchmark_Threads( const char *name )
+{
+    int max_threads = Threads();
+    int saved_threads = no_of_threads;
+    int written = 1;
+    double atlas_ms, total_ms, one_thread_ms = 0.0;
+    struct timespec start;
+    int t;
+
+    printf( "Export on 1 to %d threads, %d sprites and %d animations\n", max_threads,
+            SPR_Get_Number_Of_Sprites(), ANI_Get_Number_Of_Animations() );
+    printf( "%-8s %10s %10s %8s\n", "threads", "atlas", "total", "speedup" );
+
+    quiet = 1;
+
+    for( t = 1; t <= max_threads && written; t = ( t < max_threads && t * 2 > max_threads ) ? max_threads : t * 2 )
+    {
+        no_of_threads = t;
+
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        written &= EXP_Write_Atlas( name );
+        atlas_ms = Ms_Since( &start );
+        written &= EXP_Write_Animations( name );
+        total_ms = Ms_Since( &start );
+
+        one_thread_ms = ( t == 1 ) ? total_ms : one_thread_ms;
+
+        printf( "%-8d %8.1fms %8.1fms %7.2fx\n", t, atlas_ms, total_ms, one_thread_ms / total_ms );
+    }
+
+    quiet = 0;
+    no_of_threads = saved_threads;
+
+    return written;
+}
@@ -0,0 +1,47 @@
+//===================================================================
+//
+//  export.h
+//
+//  writes the sprites out as images for other programs to use
+//
+//===================================================================
+
+#ifndef __export_h__
+#define __export_h__
+
+
+//===================================================================
+//  CONSTANTS
+//===================================================================
+
+#define EXP_MAX_SHEET_SIZE      2048        // widest and tallest a sheet can be, a power of 2
+#define EXP_PADDING             1           // transparent pixels between frames on a sheet
+
+
+//===================================================================
+//  PROTOTYPES
+//===================================================================
+
+// writes every sprite in its own palette's colours to power of two sprite sheets, name_0.png,
+// name_1.png and so on, and an index of where each sprite is and what each animation shows to
+// name.json. pixel 0 is transparent, transparent edges are trimmed and identical frames are only
+// stored once. sheets are 8 bit PNGs of the main palette. PAL_Generate_Main_Palette() must have
+// been called. return 1 on success
+int         EXP_Write_Atlas( const char *name );
+
+// writes each animation's frames as a strip to name_anim_0.png, name_anim_1.png and so on.
+// frames that all use one user palette are written as 4 bit pixels with its colours, others as a
+// sheet is. return 1 on success
+int         EXP_Write_Animations( const char *name );
+
+// sets how many threads exports are spread over, 0 (the default) for one for each cpu. the
+// files written are the same whatever it is
+void        EXP_Set_Threads( int count );
+
+// exports the sheets and strips on 1, 2, 4 and so on threads, up to the number EXP_Set_Threads()
+// gives, and prints how long each takes. return 1 if every export was written
+int         EXP_Benchmark_Threads( const char *name );
+
+
+
+#endif // __export_h__
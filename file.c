@@ -1,10 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "defs.h"
 #include "utility.h"
-#include "anim.h"           // for 'anim_type' definition
+#include "anim.h"
 #include "sprite.h"
 #include "palette.h"
 #include "file.h"
@@ -13,7 +22,17 @@
 //  CONSTANTS
 //====================================================================
 
+#define     FIL_MAX_CHUNKS          65536       // far more than a file needs, bounds the directory
+#define     FIL_COMPACT_CHUNKS      1024        // a file with more chunks is rewritten when saved
+#define     FIL_MERGE_GAP           8           // unchanged records saved to join two runs of changes
+#define     FIL_WRITE_BUFFER        ( 1 << 20 ) // bytes gathered before each write to the disk
+#define     FIL_PACKED_SPRITE_MAX   ( 1 + 5 + SPRITE_SIZE )     // mode, palette and raw pixels
+#define     FIL_PACK_MAX_RUN        130
+#define     FIL_WHOLE_FILE_CHUNKS   5           // most chunks a whole file is written as
 
+#define     FIL_AUTOSAVE_SUFFIX     ".autosave"
+#define     FIL_AUTOSAVE_INTERVAL   30000       // ms between autosaves
+#define     FIL_AUTOSAVE_RETRY      1000        // ms to wait when the last autosave is still writing
 
 
 //====================================================================
@@ -24,7 +43,92 @@
 int             argc = 0;
 char**          argv = NULL;
 
-char*           filename;
+char*           filename = NULL;
+
+static int      options = 0;            // FIL_OPTION_ flags set on the command line
+
+static uint8_t  *file_map = NULL;       // the loaded file, sprites can point into it
+static size_t   file_map_size = 0;
+
+// sprite chunks of the loaded file in directory order, for filling in sprites lazily
+static file_chunk_type  *sprite_chunk = NULL;
+static int              no_of_sprite_chunks = 0;
+
+// every shared definition in the loaded file, SPRITE_SIZE each, for filling in shared sprites
+static uint8_t          *file_definition = NULL;
+static uint32_t         no_of_file_definitions = 0;
+
+// the working file's chunk directory as it was last read or written, so saving can add what has
+// changed to the end of the file instead of rewriting it. NULL when it has to be written in full
+static char            *saved_filename = NULL;
+static file_chunk_type  *saved_chunk = NULL;
+static int              no_of_saved_chunks = 0;
+static uint64_t         saved_file_size = 0;
+
+// how many of each there were when memory last matched the working file
+static int              saved_no_of_sprites = 0;
+static int              saved_no_of_animations = 0;
+static int              saved_no_of_palettes = 0;
+
+static uint64_t         write_pos = 0;          // offset the next chunk data goes at
+
+// packed sprite chunk for the full save being written, NULL when sprites are written as they are.
+// it holds the definitions instead when sprites are shared
+static uint8_t          *packed_sprites = NULL;
+static size_t           packed_size = 0;
+
+// when sprites are shared the full save being written numbers their definitions in the order
+// the sprites first use them. shared_index has the number for each definition id
+static int              *shared_order = NULL;           // definition id of each number
+static int              *shared_index = NULL;
+static int              no_of_shared = 0;
+
+// copy of everything as it was at the last autosave, written out by the autosave thread while
+// editing carries on. the main thread only changes it while no autosave is pending, and only
+// copies records whose generation has changed since
+//
+// sprites are copied the way the sprite code keeps them, two pixels to a byte when packed and as
+// the id of a copied definition when shared, into a record each. while sprites are loaded
+// lazily those that haven't changed since autosave started have no record, the autosave thread
+// reads them from autosave_map instead
+static uint32_t         *snapshot_sprite_generation = NULL;
+static int              *snapshot_sprite_record = NULL;     // record of each sprite, -1 for none
+static int              snapshot_no_of_sprites = 0;
+static int              snapshot_sprite_capacity = 0;
+static uint8_t          *snapshot_record = NULL;            // Snapshot_Record_Size() each
+static int              snapshot_no_of_records = 0;
+static int              snapshot_record_capacity = 0;
+static int              snapshot_storage = 0;               // SPR_STORAGE_ flags the records have
+static uint8_t          *snapshot_definition = NULL;        // by id, Snapshot_Pixel_Size() each
+static int              snapshot_definition_capacity = 0;
+static uint8_t          **snapshot_animation = NULL;        // one ANIM record each
+static uint32_t         *snapshot_animation_generation = NULL;
+static int              snapshot_no_of_animations = 0;
+static int              snapshot_animation_capacity = 0;
+static user_palette_type *snapshot_palette = NULL;
+static uint32_t         *snapshot_palette_generation = NULL;
+static int              snapshot_no_of_palettes = 0;
+static int              snapshot_palette_capacity = 0;
+
+static char             *autosave_filename = NULL;  // set while autosaving
+
+// the working file mapped again for the autosave thread, edits to borrowed sprites go to private
+// copies of file_map's pages and never reach it. NULL unless sprites are loaded lazily
+static uint8_t          *autosave_map = NULL;
+static size_t           autosave_map_size = 0;
+static pthread_t        autosave_thread;
+static pthread_mutex_t  autosave_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   autosave_wake = PTHREAD_COND_INITIALIZER;
+static int              autosave_pending = 0;       // the snapshot is waiting to be written
+static int              autosave_quit = 0;
+static double           next_autosave = 0.0;        // ms, see Get_Time()
+
+// autosave timings, guarded by autosave_lock
+static double           autosave_start = 0.0;       // when the pending snapshot was taken
+static double           autosave_pause = 0.0;       // ms the main thread spent taking it
+static double           autosave_max_pause = 0.0;
+static double           autosave_total_latency = 0.0;
+static int              no_of_autosaves = 0;
 
 
 //====================================================================
@@ -34,9 +138,17 @@ char*           filename;
 
 void        usage()
 {
-    printf( "Usage:%s [FILENAME] [OPTIONS]\n\n", argv[0] );
+    printf( "Usage:%s [FILENAME] [OPTIONS]\n", argv[0] );
+    printf( "   or:%s --batch [ACTIONS] [OPTIONS] FILENAME...   see --batch --help\n\n", argv[0] );
+    printf( "Options:\n" );
+    printf( "  -b, --bench          time the drawing, sprite and PNG kernels and quit, no file needed\n" );
+    printf( "  -l, --lazy           read v2 sprite data as it is used, sprite chunks aren't checksummed\n" );
+    printf( "  -z, --compress       pack sprites when the whole file is written\n" );
+    printf( "  -n, --nibbles        hold sprites two pixels to a byte in memory while they fit\n" );
+    printf( "  -d, --dedup          keep and write identical sprites once\n" );
+    printf( "  -v, --verbose        print autosave timings\n" );
+    printf( "\n" );
 
-    // TODO list options
     return;
 }
 
@@ -46,234 +158,2714 @@ void        usage()
 //====================================================================
 
 
+// sets the FIL_OPTION_ flag for one command line option, returns 0 if it isn't one
+int         FIL_Parse_Option( const char *option )
+{
+    if( strcmp( option, "-b" ) == 0 || strcmp( option, "--bench" ) == 0 )
+    {
+        options |= FIL_OPTION_BENCHMARK;
+    }
+    else if( strcmp( option, "-l" ) == 0 || strcmp( option, "--lazy" ) == 0 )
+    {
+        options |= FIL_OPTION_LAZY;
+    }
+    else if( strcmp( option, "-z" ) == 0 || strcmp( option, "--compress" ) == 0 )
+    {
+        options |= FIL_OPTION_COMPRESS;
+    }
+    else if( strcmp( option, "-n" ) == 0 || strcmp( option, "--nibbles" ) == 0 )
+    {
+        options |= FIL_OPTION_NIBBLES;
+    }
+    else if( strcmp( option, "-d" ) == 0 || strcmp( option, "--dedup" ) == 0 )
+    {
+        options |= FIL_OPTION_SHARE;
+    }
+    else if( strcmp( option, "-v" ) == 0 || strcmp( option, "--verbose" ) == 0 )
+    {
+        options |= FIL_OPTION_VERBOSE;
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
 // check user args
 void        FIL_Parse_Arguments( int m_argc, char *m_argv[] )
 {
     argc = m_argc;
     argv = m_argv;
 
-    if( argc < 2 )
+    int i;
+    for( i = 1; i < argc; i++ )
     {
-        usage();
-        UTI_Quiet_Exit( 1 );
+        if( argv[i][0] != '-' )
+        {
+            // only one working file
+            if( filename != NULL )
+            {
+                usage();
+                UTI_Quiet_Exit( 1 );
+            }
+
+            filename = argv[i];
+        }
+        else if( FIL_Parse_Option( argv[i] ) == 0 )
+        {
+            printf( "Unknown option '%s'\n", argv[i] );
+            usage();
+            UTI_Quiet_Exit( 1 );
+        }
+    }
+
+    // benchmarks don't need a file
+    if( options & FIL_OPTION_BENCHMARK )
+    {
+        return;
     }
 
-    // check filename is the first argument passed
-    if( argv[1][0] == '-' )
+    if( filename == NULL )
     {
         usage();
         UTI_Quiet_Exit( 1 );
     }
 
-    filename = argv[1];
-
     printf( "Working file is '%s'\n", filename );
 
     return;
 }
 
-// attempt to open a file, name given through FIL_Parse_Arguments, return 1 on success
-int         FIL_Open_File()
+
+// returns the FIL_OPTION_ flags given on the command line
+int         FIL_Get_Options()
 {
-    FILE *file = NULL;
-    char file_check[5];
+    return options;
+}
 
-    file = fopen( filename, "rb" );
-    if( file == NULL )
-    {
-        // need to create new data
-        UTI_Print_Error( "Unable to open file" );
-        return 0;
-    }
 
-    // TODO - read entire file to buffer, then parse
+// makes name the working file, for opening and saving more than one file in a run
+void        FIL_Set_Filename( char *name )
+{
+    filename = name;
 
-    fread( file_check, 4, 1, file );
-    file_check[4] = '\0';
+    return;
+}
 
-    if( strcmp( file_check, SIGNATURE ) != 0 )
+// unmaps the loaded file, anything still using its memory must have let go of it first
+static void Unmap_File()
+{
+    if( file_map != NULL )
     {
-        UTI_Print_Error( "Cannot open file, signature check failed" );
-        return 0;
+        munmap( file_map, file_map_size );
     }
 
-    // TODO
-    // read all data from the file
+    UTI_EC_Free( sprite_chunk );
+    UTI_EC_Free( file_definition );
 
-    rewind( file );
+    file_map = NULL;
+    file_map_size = 0;
+    sprite_chunk = NULL;
+    no_of_sprite_chunks = 0;
+    file_definition = NULL;
+    no_of_file_definitions = 0;
 
-    file_header_type        *header = NULL;
-    header = UTI_EC_Malloc( sizeof( file_header_type ) );
-
-    fread( header, sizeof( file_header_type ), 1, file );
+    return;
+}
 
-    printf( "File Specs: No of Sprites              = %d\n", header->no_of_sprites );
-    printf( "            No of Animations           = %d\n", header->no_of_animations );
-    printf( "            No of Palettes             = %d\n", header->no_of_palettes );
-    printf( "            Animation Offset           = %d\n", header->animation_offset );
-    printf( "            Palette Offset             = %d\n", header->palette_offset );
 
-    int i;      // generic counter
+// asks for part of the loaded file to be read in the background, it's needed soon
+static void Advise_Will_Need( uint64_t offset, uint64_t length )
+{
+    uint64_t page = sysconf( _SC_PAGESIZE );
+    uint64_t start = offset - offset % page;
 
-    //======= EXTRACT SPRITE DEFINITION DATA =======//
-    sprite_type             *sprite_buffer = NULL;            // temp buffer
-    
-    for( i = 0; i < header->no_of_sprites; i++ )
+    if( offset >= file_map_size )
     {
-        sprite_buffer = UTI_EC_Malloc( sizeof( sprite_type ) );
-        fread( sprite_buffer, sizeof( sprite_type ), 1, file );
-        SPR_Load_Sprite( sprite_buffer );
+        return;
     }
-    // sprite_buffer malloc'd memory will be freed by SPR code
-    
-    
-    //======= EXTRACT ANIMATION DATA =======//
-    int32_t                 *frame_buffer = NULL, no_of_frames = 0, frame_wait = 0;
-    frame_buffer = UTI_EC_Malloc( sizeof( int32_t ) * MAX_ANIMATION_FRAMES );     // most ever needed
 
-    for( i = 0; i < header->no_of_animations; i++ )
+    if( length > file_map_size - offset )
     {
-        fread( &no_of_frames, sizeof( int32_t ), 1, file );
-        fread( &frame_wait, sizeof( int32_t ), 1, file );
-        fread( frame_buffer, sizeof( int32_t ), no_of_frames, file );
-        ANI_Load_Animation( frame_buffer, no_of_frames, frame_wait );
+        length = file_map_size - offset;
     }
 
-    UTI_EC_Free( frame_buffer );
+    madvise( file_map + start, length + ( offset - start ), MADV_WILLNEED );
 
-    //======= EXTRACT PALETTE DATA =======//
+    return;
+}
+
+
+//======= LITTLE ENDIAN FIELDS =======//
+
+static int Host_Is_Little_Endian()
+{
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
 
-    user_palette_type           *palette = NULL;
+static uint16_t Read_U16( const uint8_t *p )
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t Read_U32( const uint8_t *p )
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t Read_U64( const uint8_t *p )
+{
+    return Read_U32( p ) | (uint64_t)Read_U32( p + 4 ) << 32;
+}
+
+static void Write_U16( uint8_t *p, uint16_t value )
+{
+    p[0] = value;
+    p[1] = value >> 8;
+
+    return;
+}
+
+static void Write_U32( uint8_t *p, uint32_t value )
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+
+    return;
+}
+
+static void Write_U64( uint8_t *p, uint64_t value )
+{
+    Write_U32( p, value );
+    Write_U32( p + 4, value >> 32 );
+
+    return;
+}
+
+
+static void Decode_Header( const uint8_t *p, file_header_v2_type *header )
+{
+    memcpy( header->signature, p, 4 );
+    header->marker              = Read_U32( p + 4 );
+    header->version             = Read_U16( p + 8 );
+    header->header_size         = Read_U16( p + 10 );
+    header->no_of_chunks        = Read_U32( p + 12 );
+    header->directory_offset    = Read_U64( p + 16 );
+    header->directory_checksum  = Read_U32( p + 24 );
+    header->flags               = Read_U32( p + 28 );
+
+    return;
+}
+
+static void Encode_Header( uint8_t *p, const file_header_v2_type *header )
+{
+    memcpy( p, header->signature, 4 );
+    Write_U32( p + 4, header->marker );
+    Write_U16( p + 8, header->version );
+    Write_U16( p + 10, header->header_size );
+    Write_U32( p + 12, header->no_of_chunks );
+    Write_U64( p + 16, header->directory_offset );
+    Write_U32( p + 24, header->directory_checksum );
+    Write_U32( p + 28, header->flags );
+
+    return;
+}
+
+static void Decode_Chunk_Entry( const uint8_t *p, file_chunk_type *chunk )
+{
+    chunk->type         = Read_U32( p );
+    chunk->flags        = Read_U32( p + 4 );
+    chunk->offset       = Read_U64( p + 8 );
+    chunk->size         = Read_U64( p + 16 );
+    chunk->count        = Read_U32( p + 24 );
+    chunk->first_index  = Read_U32( p + 28 );
+    chunk->checksum     = Read_U32( p + 32 );
+    chunk->reserved     = Read_U32( p + 36 );
+
+    return;
+}
+
+static void Encode_Chunk_Entry( uint8_t *p, const file_chunk_type *chunk )
+{
+    Write_U32( p, chunk->type );
+    Write_U32( p + 4, chunk->flags );
+    Write_U64( p + 8, chunk->offset );
+    Write_U64( p + 16, chunk->size );
+    Write_U32( p + 24, chunk->count );
+    Write_U32( p + 28, chunk->first_index );
+    Write_U32( p + 32, chunk->checksum );
+    Write_U32( p + 36, chunk->reserved );
+
+    return;
+}
+
+
+// remembers the chunk directory of the working file, and what was in it, for the next save
+static void Set_Saved_Layout( const file_chunk_type *chunk, int no_of_chunks, uint64_t file_size )
+{
+    UTI_EC_Free( saved_chunk );
+    UTI_EC_Free( saved_filename );
+
+    saved_filename = UTI_EC_Malloc( strlen( filename ) + 1 );
+    strcpy( saved_filename, filename );
+
+    saved_chunk = UTI_EC_Malloc( sizeof( file_chunk_type ) * ( no_of_chunks + 1 ) );
+    memcpy( saved_chunk, chunk, sizeof( file_chunk_type ) * no_of_chunks );
+
+    no_of_saved_chunks = no_of_chunks;
+    saved_file_size = file_size;
+
+    return;
+}
+
+
+// everything in memory now matches the file
+static void Mark_All_Saved()
+{
+    saved_no_of_sprites = SPR_Get_Number_Of_Sprites();
+    saved_no_of_animations = ANI_Get_Number_Of_Animations();
+    saved_no_of_palettes = PAL_Get_Number_Of_Palettes();
+
+    SPR_Mark_Sprites_Saved();
+    ANI_Mark_Animations_Saved();
+    PAL_Mark_Palettes_Saved();
+
+    return;
+}
+
+
+// returns the size of the chunks of a type in the working file that have all of flags set, 0 if
+// there are none
+static uint64_t Get_Saved_Size( uint32_t type, uint32_t flags )
+{
+    uint64_t size = 0;
+    int i;
 
-    for( i = 0; i < header->no_of_palettes; i++ )
+    for( i = 0; i < no_of_saved_chunks; i++ )
     {
-        palette = UTI_EC_Malloc( sizeof( user_palette_type ) );
-        fread( palette, sizeof( user_palette_type ), 1, file );
-        if( palette != NULL )
+        if( saved_chunk[i].type == type && ( saved_chunk[i].flags & flags ) == flags )
         {
-            PAL_Load_Palette( palette );
+            size += saved_chunk[i].size;
         }
     }
 
-    //======= FREE MEMORY =======//
+    return size;
+}
 
-    UTI_EC_Free( header );
 
-    fclose( file );
+// returns the size of the packed chunks in the working file, 0 if it isn't packed
+static uint64_t Get_Saved_Packed_Size()
+{
+    return Get_Saved_Size( FIL_CHUNK_SPRITES, FIL_CHUNK_PACKED ) + Get_Saved_Size( FIL_CHUNK_DEFINITIONS, FIL_CHUNK_PACKED );
+}
 
-    printf( "File opened successfully.\n\n" );
 
-    return 1;
+static int Compare_Index( const void *a, const void *b )
+{
+    return *(const int *)a - *(const int *)b;
 }
 
-// write data to file, filename given by user cmd line args. return 1 on success
-int         FIL_Write_File()
+// copies the changed indices below limit to sorted and sorts them, returns how many there are
+static int Get_Changed( const int *changed, int count, int limit, int *sorted )
 {
-    FILE *file = NULL;
-    int error = 0;
+    int i, n = 0;
+    for( i = 0; i < count; i++ )
+    {
+        if( changed[i] < limit )
+        {
+            sorted[n++] = changed[i];
+        }
+    }
 
-    file = fopen( filename, "wb" );
-    if( file == NULL )
+    qsort( sorted, n, sizeof( int ), Compare_Index );
+
+    return n;
+}
+
+
+// returns the end of the run of changes starting at sorted[*next], joining runs separated by
+// less than FIL_MERGE_GAP unchanged records. *next is moved past the run
+static int Get_Run_End( const int *sorted, int count, int *next )
+{
+    int end = sorted[(*next)++] + 1;
+
+    while( *next < count && sorted[*next] - end < FIL_MERGE_GAP )
     {
-        UTI_Print_Error( "Unable to create file" );
-        return 0;
+        end = sorted[(*next)++] + 1;
     }
 
-    // generate header
-    file_header_type    *header = NULL;
-    header = UTI_EC_Malloc( sizeof( file_header_type ) );
+    return end;
+}
+
+
+//======= VERSION 1 =======//
 
-    strncpy( header->signature, SIGNATURE, 4 );
-    header->no_of_sprites           = SPR_Get_Number_Of_Sprites();
-    header->no_of_animations        = ANI_Get_Number_Of_Animations();
-    header->no_of_palettes          = PAL_Get_Number_Of_Palettes();
+// builds everything from a mapped version 1 file, return 1 on success. sprites are borrowed from
+// the mapping
+static int Open_V1( uint8_t *map, size_t size )
+{
+    file_header_type        header;
+    memcpy( &header, map, sizeof( file_header_type ) );
+
+    printf( "File Specs: No of Sprites              = %d\n", header.no_of_sprites );
+    printf( "            No of Animations           = %d\n", header.no_of_animations );
+    printf( "            No of Palettes             = %d\n", header.no_of_palettes );
+    printf( "            Animation Offset           = %d\n", header.animation_offset );
+    printf( "            Palette Offset             = %d\n", header.palette_offset );
+
+    //======= CHECK SECTION SIZES =======//
+
+    // sections follow each other, sprites, animations then palettes
+    uint64_t sprite_end = sizeof( file_header_type ) + (uint64_t)header.no_of_sprites * sizeof( sprite_type );
 
-    // write header
-    fwrite( header, sizeof( file_header_type ), 1, file );
+    if( header.no_of_sprites < 0 || header.no_of_animations < 0 || header.no_of_palettes < 0 ||
+        sprite_end > size )
+    {
+        UTI_Print_Error( "Cannot open file, sprite data is missing" );
+        return 0;
+    }
 
-    // get sprite data
+    // animations are variable length, so walk them once before building anything
+    uint64_t pos = sprite_end;
+    int32_t no_of_frames = 0, frame_wait = 0;
     int i;
-    uint8_t *data = NULL;
-    for( i = 0; i < header->no_of_sprites; i++ )
+
+    for( i = 0; i < header.no_of_animations; i++ )
     {
-        data = SPR_Get_Sprite( i );
-        if( data != NULL )
+        if( pos + 2 * sizeof( int32_t ) > size )
         {
-            fwrite( data, sizeof( sprite_type ), 1, file );
+            break;
         }
-        else
+
+        memcpy( &no_of_frames, map + pos, sizeof( int32_t ) );
+
+        if( no_of_frames < 0 || no_of_frames > MAX_ANIMATION_FRAMES ||
+            pos + ( 2 + (uint64_t)no_of_frames ) * sizeof( int32_t ) > size )
         {
-            printf( "Null Sprite data pointer: %d\n", i );
-            error = 1;
             break;
         }
+
+        pos += ( 2 + (uint64_t)no_of_frames ) * sizeof( int32_t );
+    }
+
+    uint64_t palette_start = pos;
+
+    if( i < header.no_of_animations || palette_start + (uint64_t)header.no_of_palettes * sizeof( user_palette_type ) > size )
+    {
+        UTI_Print_Error( "Cannot open file, animation or palette data is missing" );
+        return 0;
+    }
+
+    if( header.animation_offset != (int64_t)sprite_end || header.palette_offset != (int64_t)palette_start )
+    {
+        UTI_Print_Debug( "Section offsets in the header are wrong, using the actual positions" );
+    }
+
+    //======= EXTRACT SPRITE DEFINITION DATA =======//
+
+    // sprites are used in place, edits go to private copies of the pages
+    if( SPR_Borrow_Sprites( (sprite_type *)( map + sizeof( file_header_type ) ), header.no_of_sprites ) == 0 )
+    {
+        UTI_Print_Error( "Unable to load sprites" );
+    }
+
+    //======= EXTRACT ANIMATION DATA =======//
+
+    // frames are copied out, there is no guarantee about alignment
+    int32_t *frame_buffer = UTI_EC_Malloc( sizeof( int32_t ) * MAX_ANIMATION_FRAMES );
+
+    for( pos = sprite_end, i = 0; i < header.no_of_animations; i++ )
+    {
+        memcpy( &no_of_frames, map + pos, sizeof( int32_t ) );
+        memcpy( &frame_wait, map + pos + sizeof( int32_t ), sizeof( int32_t ) );
+        memcpy( frame_buffer, map + pos + 2 * sizeof( int32_t ), sizeof( int32_t ) * no_of_frames );
+
+        ANI_Load_Animation( frame_buffer, no_of_frames, frame_wait );
+
+        pos += ( 2 + (uint64_t)no_of_frames ) * sizeof( int32_t );
+    }
+
+    UTI_EC_Free( frame_buffer );
+
+    //======= EXTRACT PALETTE DATA =======//
+
+    user_palette_type           *palette = PAL_Load_Palettes( header.no_of_palettes );
+
+    if( palette == NULL && header.no_of_palettes > 0 )
+    {
+        UTI_Print_Error( "Unable to load palettes" );
+    }
+    else if( header.no_of_palettes > 0 )
+    {
+        memcpy( palette, map + palette_start, sizeof( user_palette_type ) * header.no_of_palettes );
     }
 
-    printf( "Written data for %d sprite definitions\n", i );
+    return 1;
+}
+
 
-    // get animation data
+//======= VERSION 2 =======//
 
+// the two pixels each packed byte holds, in order
+static uint8_t  nibble_pixels[256][2];
+static int      nibble_pixels_made = 0;
 
-    header->animation_offset = ftell( file );
 
-    anim_type       *anim = NULL;
-    for( i = 0; i < header->no_of_animations; i++ )
+// unpacks one sprite of a packed sprite chunk, returns where the next one starts or NULL if it
+// runs past end or makes no sense. the pixels are built up in a buffer with room for runs and
+// copies to be written 16 at a time, then copied out, so most only go round once
+static const uint8_t *Unpack_Sprite( const uint8_t *p, const uint8_t *end, sprite_type *sprite )
+{
+    uint8_t         pixel[SPRITE_SIZE + 16];
+    uint8_t         *out = pixel;
+    uint32_t        palette = 0;
+    uint8_t         pattern[16];
+    int             mode, control, shift, n, i;
+
+    if( p >= end )
+    {
+        return NULL;
+    }
+
+    mode = *p++;
+
+    for( shift = 0; ; shift += 7 )
     {
-        anim = ANI_Get_Animation( i );
-        if( anim != NULL )
+        if( p >= end || shift > 28 )
         {
-            fwrite( &(anim->no_of_frames), 4, 1, file );
-            fwrite( &(anim->frame_wait), 4, 1, file );
-            fwrite( anim->frame_list, 4, anim->no_of_frames, file );
+            return NULL;
         }
-        else
+
+        palette |= (uint32_t)( *p & 0x7f ) << shift;
+        if( ( *p++ & 0x80 ) == 0 )
         {
-            printf( "Null animation data pointer: Index %d\n", i );
-            error = 1;
             break;
         }
     }
-    
-    printf( "Written data for %d animations\n", i );
 
-    // write palette data
-    header->palette_offset = ftell( file );
+    sprite->palette = palette;
 
-    user_palette_type *palette = NULL;
-    for( i = 0; i < header->no_of_palettes; i++ )
+    if( mode == FIL_PACK_RAW )
     {
-        palette = PAL_Get_Palette( i );
-        if( palette != NULL )
+        if( end - p < SPRITE_SIZE )
+        {
+            return NULL;
+        }
+
+        memcpy( sprite->definition, p, SPRITE_SIZE );
+        return p + SPRITE_SIZE;
+    }
+
+    if( mode != FIL_PACK_NIBBLES )
+    {
+        return NULL;
+    }
+
+    while( out < pixel + SPRITE_SIZE )
+    {
+        if( p >= end )
+        {
+            return NULL;
+        }
+
+        control = *p++;
+        n = ( control < 128 ) ? control + 1 : control - 125;
+
+        if( pixel + SPRITE_SIZE - out < 2 * n || end - p < ( control < 128 ? n : 1 ) )
+        {
+            return NULL;
+        }
+
+        if( control < 128 && end - p >= ( n + 7 ) / 8 * 8 )
         {
-            fwrite( palette, PAL_USER_SIZE, 1, file );
+            // reads whole groups of 8, which is fine while they are in the block
+            for( i = 0; i < n; i += 8 )
+            {
+                memcpy( out + 2 * i,      nibble_pixels[p[i]],     2 );
+                memcpy( out + 2 * i + 2,  nibble_pixels[p[i + 1]], 2 );
+                memcpy( out + 2 * i + 4,  nibble_pixels[p[i + 2]], 2 );
+                memcpy( out + 2 * i + 6,  nibble_pixels[p[i + 3]], 2 );
+                memcpy( out + 2 * i + 8,  nibble_pixels[p[i + 4]], 2 );
+                memcpy( out + 2 * i + 10, nibble_pixels[p[i + 5]], 2 );
+                memcpy( out + 2 * i + 12, nibble_pixels[p[i + 6]], 2 );
+                memcpy( out + 2 * i + 14, nibble_pixels[p[i + 7]], 2 );
+            }
+
+            p += n;
+        }
+        else if( control < 128 )
+        {
+            for( i = 0; i < n; i++ )
+            {
+                memcpy( out + 2 * i, nibble_pixels[p[i]], 2 );
+            }
+
+            p += n;
         }
         else
         {
-            printf( "Null palette data pointer: Index %d\n", i );
-            error = 1;
-            break;
+            // the pixel pair repeated, laid out a byte at a time so it is the same on any host
+            for( i = 0; i < 16; i += 2 )
+            {
+                memcpy( pattern + i, nibble_pixels[*p], 2 );
+            }
+
+            for( i = 0; i < 2 * n; i += 16 )
+            {
+                memcpy( out + i, pattern, 16 );
+            }
+
+            p++;
         }
+
+        out += 2 * n;
     }
 
-    printf( "Written data for %d palettes\n", i );
+    memcpy( sprite->definition, pixel, SPRITE_SIZE );
+
+    return p;
+}
 
-    //re-write header, now that it has the palette and animation offsets
-    rewind( file );
-    fwrite( header, sizeof( file_header_type ), 1, file );
 
-    UTI_EC_Free( header );
-    fclose( file );
+// fills in nibble_pixels the first time it is needed
+static void Make_Nibble_Pixels()
+{
+    int i;
 
-    if( error == 1 )
+    if( nibble_pixels_made )
     {
-        printf( "WARNING: Possible errors writing file '%s'\n", filename );
+        return;
     }
-    else
+
+    for( i = 0; i < 256; i++ )
     {
-        printf( "Successfully written data to %s\n", filename );
+        nibble_pixels[i][0] = i & 0x0f;
+        nibble_pixels[i][1] = i >> 4;
     }
+    nibble_pixels_made = 1;
 
-    return 1;
+    return;
 }
 
 
+// fills in sprites start to end-1 from a packed sprite chunk of the loaded file mapped at map,
+// dest being sprite start. whole blocks are unpacked straight into place, the ends of the range
+// through a buffer
+static void Unpack_Sprite_Range( const uint8_t *map, const file_chunk_type *chunk, uint32_t start, uint32_t end, sprite_type *dest )
+{
+    const uint8_t   *data = map + chunk->offset;
+    sprite_type     buffer[FIL_PACK_BLOCK];
+    uint32_t        first = start - chunk->first_index;
+    uint32_t        last = end - chunk->first_index;
+    uint32_t        block, block_first, block_end, from, to, i;
+
+    Make_Nibble_Pixels();
+
+    for( block = first / FIL_PACK_BLOCK; block * FIL_PACK_BLOCK < last; block++ )
+    {
+        block_first = block * FIL_PACK_BLOCK;
+        block_end = ( chunk->count - block_first > FIL_PACK_BLOCK ) ? block_first + FIL_PACK_BLOCK : chunk->count;
+        from = ( first > block_first ) ? first : block_first;
+        to = ( last < block_end ) ? last : block_end;
+
+        sprite_type *target = ( from == block_first && to == block_end ) ? &dest[block_first - first] : buffer;
+        const uint8_t *p = data + Read_U32( data + 4 * block );
+        const uint8_t *p_end = data + Read_U32( data + 4 * ( block + 1 ) );
+
+        for( i = 0; i < block_end - block_first && p != NULL; i++ )
+        {
+            p = Unpack_Sprite( p, p_end, &target[i] );
+        }
+
+        if( p == NULL )
+        {
+            UTI_Print_Error( "Sprite data is damaged, some sprites have been left blank" );
+            memset( &target[i - 1], 0, sizeof( sprite_type ) * ( block_end - block_first - ( i - 1 ) ) );
+        }
+
+        if( target == buffer )
+        {
+            memcpy( &dest[from - first], &buffer[from - block_first], sizeof( sprite_type ) * ( to - from ) );
+        }
+    }
+
+    return;
+}
+
+
+// checks the block table of a packed sprite chunk, returns 1 if every block lies in the chunk in
+// order
+static int Check_Packed_Chunk( const uint8_t *data, const file_chunk_type *chunk )
+{
+    uint64_t no_of_blocks = ( (uint64_t)chunk->count + FIL_PACK_BLOCK - 1 ) / FIL_PACK_BLOCK;
+    uint64_t previous = 4 * ( no_of_blocks + 1 );
+    uint64_t i, offset;
+
+    if( chunk->size < previous || Read_U32( data ) != previous )
+    {
+        return 0;
+    }
+
+    for( i = 1; i <= no_of_blocks; i++ )
+    {
+        offset = Read_U32( data + 4 * i );
+        if( offset < previous || offset > chunk->size )
+        {
+            return 0;
+        }
+
+        previous = offset;
+    }
+
+    return previous == chunk->size;
+}
+
+
+// fills in count sprites from first out of the sprite chunks of the loaded file mapped at map,
+// later chunks overwriting earlier ones and anything no chunk covers left blank. when loading
+// lazily from file_map it also asks for the sprites after these to be read ahead
+static void Read_Sprite_Range( const uint8_t *map, int first, int count, sprite_type *sprites )
+{
+    int read_ahead = ( map == file_map && ( options & FIL_OPTION_LAZY ) );
+    int little_endian = Host_Is_Little_Endian();
+    int i;
+    uint32_t j;
+
+    memset( sprites, 0, sizeof( sprite_type ) * count );
+
+    for( i = 0; i < no_of_sprite_chunks; i++ )
+    {
+        const file_chunk_type *chunk = &sprite_chunk[i];
+        uint64_t start = ( chunk->first_index > (uint32_t)first ) ? chunk->first_index : (uint32_t)first;
+        uint64_t end = (uint64_t)chunk->first_index + chunk->count;
+
+        if( end > (uint64_t)first + count )
+        {
+            end = (uint64_t)first + count;
+        }
+
+        if( start >= end )
+        {
+            continue;
+        }
+
+        const uint8_t *record = map + chunk->offset + ( start - chunk->first_index ) * FIL_SPRITE_RECORD_SIZE;
+        sprite_type *dest = &sprites[start - first];
+
+        if( chunk->flags & FIL_CHUNK_SHARED )
+        {
+            int damaged = 0;
+
+            record = map + chunk->offset + ( start - chunk->first_index ) * FIL_SHARED_RECORD_SIZE;
+            for( j = 0; j < end - start; j++, record += FIL_SHARED_RECORD_SIZE )
+            {
+                uint32_t definition = Read_U32( record );
+
+                if( definition < no_of_file_definitions )
+                {
+                    memcpy( dest[j].definition, file_definition + (size_t)SPRITE_SIZE * definition, SPRITE_SIZE );
+                }
+                else
+                {
+                    memset( dest[j].definition, 0, SPRITE_SIZE );
+                    damaged = 1;
+                }
+
+                dest[j].palette = Read_U32( record + 4 );
+            }
+
+            if( damaged )
+            {
+                UTI_Print_Error( "Sprite data is damaged, some sprites have been left blank" );
+            }
+
+            if( read_ahead )
+            {
+                Advise_Will_Need( chunk->offset + ( end - chunk->first_index ) * FIL_SHARED_RECORD_SIZE,
+                                  (uint64_t)count * FIL_SHARED_RECORD_SIZE );
+            }
+
+            continue;
+        }
+
+        if( chunk->flags & FIL_CHUNK_PACKED )
+        {
+            Unpack_Sprite_Range( map, chunk, start, end, dest );
+
+            if( read_ahead )
+            {
+                const uint8_t *data = map + chunk->offset;
+                uint64_t no_of_blocks = ( (uint64_t)chunk->count + FIL_PACK_BLOCK - 1 ) / FIL_PACK_BLOCK;
+                uint64_t next = ( end - chunk->first_index + FIL_PACK_BLOCK - 1 ) / FIL_PACK_BLOCK;
+                uint64_t ahead = next + ( count + FIL_PACK_BLOCK - 1 ) / FIL_PACK_BLOCK;
+
+                ahead = ( ahead < no_of_blocks ) ? ahead : no_of_blocks;
+                Advise_Will_Need( chunk->offset + Read_U32( data + 4 * next ),
+                                  Read_U32( data + 4 * ahead ) - Read_U32( data + 4 * next ) );
+            }
+
+            continue;
+        }
+
+        if( little_endian )
+        {
+            // records are laid out exactly as sprite_type
+            memcpy( dest, record, ( end - start ) * FIL_SPRITE_RECORD_SIZE );
+        }
+        else
+        {
+            for( j = 0; j < end - start; j++, record += FIL_SPRITE_RECORD_SIZE )
+            {
+                memcpy( dest[j].definition, record, SPRITE_SIZE );
+                dest[j].palette = Read_U32( record + SPRITE_SIZE );
+            }
+        }
+
+        if( read_ahead )
+        {
+            // sprites tend to be used in order
+            Advise_Will_Need( chunk->offset + ( end - chunk->first_index ) * FIL_SPRITE_RECORD_SIZE,
+                              (uint64_t)count * FIL_SPRITE_RECORD_SIZE );
+        }
+    }
+
+    return;
+}
+
+
+// fills in count sprites from first out of the loaded file, given to SPR_Load_Sprites_Lazily()
+static void Load_Sprite_Range( int first, int count, sprite_type *sprites )
+{
+    Read_Sprite_Range( file_map, first, count, sprites );
+
+    return;
+}
+
+
+// fills in file_definition from a DEFS chunk of the loaded file
+static void Load_Definitions( const file_chunk_type *chunk )
+{
+    uint8_t *dest = file_definition + (size_t)SPRITE_SIZE * chunk->first_index;
+    sprite_type buffer[FIL_PACK_BLOCK];
+    uint32_t i, j, n;
+
+    if( ( chunk->flags & FIL_CHUNK_PACKED ) == 0 )
+    {
+        memcpy( dest, file_map + chunk->offset, (size_t)SPRITE_SIZE * chunk->count );
+        return;
+    }
+
+    // unpacked a block at a time as sprites, their palette indices are 0
+    for( i = 0; i < chunk->count; i += n )
+    {
+        n = ( chunk->count - i < FIL_PACK_BLOCK ) ? chunk->count - i : FIL_PACK_BLOCK;
+        Unpack_Sprite_Range( file_map, chunk, chunk->first_index + i, chunk->first_index + i + n, buffer );
+
+        for( j = 0; j < n; j++ )
+        {
+            memcpy( dest + (size_t)SPRITE_SIZE * ( i + j ), buffer[j].definition, SPRITE_SIZE );
+        }
+    }
+
+    return;
+}
+
+
+// checks a chunk holds count items starting at first_index out of no_of_items, and, for fixed
+// size records, exactly record_size bytes each. returns 1 if it does
+static int Check_Chunk_Range( const file_chunk_type *chunk, uint32_t no_of_items, uint64_t record_size )
+{
+    if( (uint64_t)chunk->first_index + chunk->count > no_of_items )
+    {
+        return 0;
+    }
+
+    if( record_size > 0 && chunk->size != (uint64_t)chunk->count * record_size )
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// builds everything from a mapped version 2 file, return 1 on success. the directory and every
+// chunk are checked before anything is built. a single sprite chunk covering every sprite is
+// borrowed from the mapping when the host is little endian, otherwise sprites are copied out
+static int Open_V2( uint8_t *map, size_t size )
+{
+    if( size < FIL_HEADER_SIZE )
+    {
+        UTI_Print_Error( "Cannot open file, header is missing" );
+        return 0;
+    }
+
+    file_header_v2_type     header;
+    Decode_Header( map, &header );
+
+    if( header.version != FIL_VERSION || header.header_size < FIL_HEADER_SIZE )
+    {
+        UTI_Print_Error( "Cannot open file, unsupported version" );
+        return 0;
+    }
+
+    //======= READ CHUNK DIRECTORY =======//
+
+    if( header.no_of_chunks > FIL_MAX_CHUNKS || header.directory_offset > size ||
+        (uint64_t)header.no_of_chunks * FIL_CHUNK_ENTRY_SIZE > size - header.directory_offset )
+    {
+        UTI_Print_Error( "Cannot open file, chunk directory is missing" );
+        return 0;
+    }
+
+    const uint8_t *directory = map + header.directory_offset;
+
+    if( UTI_CRC32( 0, directory, (size_t)header.no_of_chunks * FIL_CHUNK_ENTRY_SIZE ) != header.directory_checksum )
+    {
+        UTI_Print_Error( "Cannot open file, chunk directory is damaged" );
+        return 0;
+    }
+
+    file_chunk_type *chunk = UTI_EC_Malloc( sizeof( file_chunk_type ) * ( header.no_of_chunks + 1 ) );
+    const file_chunk_type *meta = NULL;
+    int i;
+
+    for( i = 0; i < (int)header.no_of_chunks; i++ )
+    {
+        Decode_Chunk_Entry( directory + (size_t)i * FIL_CHUNK_ENTRY_SIZE, &chunk[i] );
+
+        if( chunk[i].offset > size || chunk[i].size > size - chunk[i].offset )
+        {
+            UTI_Print_Error( "Cannot open file, chunk data is missing" );
+            UTI_EC_Free( chunk );
+            return 0;
+        }
+
+        // lazily loaded sprites would all have to be read to check them
+        if( ( chunk[i].type != FIL_CHUNK_SPRITES || ( options & FIL_OPTION_LAZY ) == 0 ) &&
+            UTI_CRC32( 0, map + chunk[i].offset, chunk[i].size ) != chunk[i].checksum )
+        {
+            UTI_Print_Error( "Cannot open file, chunk data is damaged" );
+            UTI_EC_Free( chunk );
+            return 0;
+        }
+
+        if( chunk[i].type == FIL_CHUNK_META )
+        {
+            meta = &chunk[i];
+        }
+    }
+
+    if( meta == NULL || meta->size < FIL_META_SIZE )
+    {
+        UTI_Print_Error( "Cannot open file, no META chunk" );
+        UTI_EC_Free( chunk );
+        return 0;
+    }
+
+    uint32_t no_of_sprites      = Read_U32( map + meta->offset );
+    uint32_t no_of_animations   = Read_U32( map + meta->offset + 4 );
+    uint32_t no_of_palettes     = Read_U32( map + meta->offset + 8 );
+    uint32_t sprite_w           = Read_U32( map + meta->offset + 12 );
+    uint32_t sprite_h           = Read_U32( map + meta->offset + 16 );
+    uint32_t palette_size       = Read_U32( map + meta->offset + 20 );
+
+    printf( "File Specs: Version                    = %d\n", header.version );
+    printf( "            No of Chunks               = %u\n", header.no_of_chunks );
+    printf( "            No of Sprites              = %u\n", no_of_sprites );
+    printf( "            No of Animations           = %u\n", no_of_animations );
+    printf( "            No of Palettes             = %u\n", no_of_palettes );
+
+    if( sprite_w != SPRITE_W || sprite_h != SPRITE_H || palette_size != PAL_USER_SIZE ||
+        no_of_sprites > INT_MAX || no_of_animations > INT_MAX || no_of_palettes > INT_MAX )
+    {
+        UTI_Print_Error( "Cannot open file, sprite or palette sizes don't match" );
+        UTI_EC_Free( chunk );
+        return 0;
+    }
+
+    //======= CHECK CHUNK RANGES =======//
+
+    // the newest record of each animation, they are variable length so have to be walked
+    const uint8_t **animation_record = UTI_EC_Malloc( sizeof( uint8_t * ) * ( no_of_animations + 1 ) );
+    int valid = 1;
+    uint32_t j;
+
+    for( i = 0; i < (int)no_of_animations; i++ )
+    {
+        animation_record[i] = NULL;
+    }
+
+    for( i = 0; i < (int)header.no_of_chunks && valid == 1; i++ )
+    {
+        const uint8_t *data = map + chunk[i].offset;
+        uint64_t pos = 0;
+
+        switch( chunk[i].type )
+        {
+            case FIL_CHUNK_META:
+                break;
+
+            case FIL_CHUNK_SPRITES:
+                if( chunk[i].flags == FIL_CHUNK_PACKED )
+                {
+                    valid = Check_Chunk_Range( &chunk[i], no_of_sprites, 0 ) && Check_Packed_Chunk( data, &chunk[i] );
+                }
+                else if( chunk[i].flags == FIL_CHUNK_SHARED )
+                {
+                    valid = Check_Chunk_Range( &chunk[i], no_of_sprites, FIL_SHARED_RECORD_SIZE );
+                }
+                else
+                {
+                    valid = ( chunk[i].flags == 0 ) && Check_Chunk_Range( &chunk[i], no_of_sprites, FIL_SPRITE_RECORD_SIZE );
+                }
+                no_of_sprite_chunks++;
+                break;
+
+            // there are never more shared definitions than sprites
+            case FIL_CHUNK_DEFINITIONS:
+                if( chunk[i].flags == FIL_CHUNK_PACKED )
+                {
+                    valid = Check_Chunk_Range( &chunk[i], no_of_sprites, 0 ) && Check_Packed_Chunk( data, &chunk[i] );
+                }
+                else
+                {
+                    valid = ( chunk[i].flags == 0 ) && Check_Chunk_Range( &chunk[i], no_of_sprites, SPRITE_SIZE );
+                }
+
+                if( valid && chunk[i].first_index + chunk[i].count > no_of_file_definitions )
+                {
+                    no_of_file_definitions = chunk[i].first_index + chunk[i].count;
+                }
+                break;
+
+            case FIL_CHUNK_PALETTES:
+                valid = Check_Chunk_Range( &chunk[i], no_of_palettes, PAL_USER_SIZE );
+                break;
+
+            case FIL_CHUNK_ANIMATIONS:
+                valid = Check_Chunk_Range( &chunk[i], no_of_animations, 0 );
+
+                for( j = 0; j < chunk[i].count && valid == 1; j++ )
+                {
+                    uint32_t no_of_frames = ( pos + 8 <= chunk[i].size ) ? Read_U32( data + pos ) : UINT32_MAX;
+
+                    if( no_of_frames > MAX_ANIMATION_FRAMES || pos + 8 + 4 * (uint64_t)no_of_frames > chunk[i].size )
+                    {
+                        valid = 0;
+                        break;
+                    }
+
+                    animation_record[chunk[i].first_index + j] = data + pos;
+                    pos += 8 + 4 * (uint64_t)no_of_frames;
+                }
+
+                if( pos != chunk[i].size )
+                {
+                    valid = 0;
+                }
+                break;
+
+            default:
+                // written by something newer, nothing here needs it
+                UTI_Print_Debug( "Skipping unknown chunk" );
+                break;
+        }
+    }
+
+    if( valid == 0 )
+    {
+        UTI_Print_Error( "Cannot open file, chunk doesn't match the META counts" );
+        UTI_EC_Free( animation_record );
+        UTI_EC_Free( chunk );
+        return 0;
+    }
+
+    //======= EXTRACT SHARED DEFINITIONS =======//
+
+    // kept unpacked, shared sprites are filled in from them
+    if( no_of_file_definitions > 0 )
+    {
+        file_definition = UTI_EC_Malloc( (size_t)SPRITE_SIZE * no_of_file_definitions );
+        memset( file_definition, 0, (size_t)SPRITE_SIZE * no_of_file_definitions );
+
+        for( i = 0; i < (int)header.no_of_chunks; i++ )
+        {
+            if( chunk[i].type == FIL_CHUNK_DEFINITIONS )
+            {
+                Load_Definitions( &chunk[i] );
+            }
+        }
+    }
+
+    //======= EXTRACT SPRITE DEFINITION DATA =======//
+
+    // the sprite chunks are kept, they are needed to fill in sprites lazily
+    sprite_chunk = UTI_EC_Malloc( sizeof( file_chunk_type ) * ( no_of_sprite_chunks + 1 ) );
+    for( i = 0, j = 0; i < (int)header.no_of_chunks; i++ )
+    {
+        if( chunk[i].type == FIL_CHUNK_SPRITES )
+        {
+            sprite_chunk[j++] = chunk[i];
+        }
+
+        // a file with shared sprites stays shared
+        if( chunk[i].type == FIL_CHUNK_SPRITES && chunk[i].flags == FIL_CHUNK_SHARED )
+        {
+            options |= FIL_OPTION_SHARE;
+        }
+    }
+
+    const file_chunk_type *only = sprite_chunk;
+    int loaded;
+
+    if( no_of_sprite_chunks == 1 && only->first_index == 0 && only->count == no_of_sprites &&
+        only->flags == 0 && Host_Is_Little_Endian() && only->offset % sizeof( uint32_t ) == 0 )
+    {
+        // records are laid out exactly as sprite_type, use them where they lie, the system reads
+        // them in as they are touched
+        loaded = SPR_Borrow_Sprites( (sprite_type *)( map + only->offset ), no_of_sprites );
+    }
+    else if( options & FIL_OPTION_LAZY )
+    {
+        loaded = SPR_Load_Sprites_Lazily( no_of_sprites, Load_Sprite_Range );
+    }
+    else
+    {
+        sprite_type *sprite = SPR_Load_Sprites( no_of_sprites );
+
+        loaded = ( sprite != NULL || no_of_sprites == 0 );
+        if( sprite != NULL )
+        {
+            Load_Sprite_Range( 0, no_of_sprites, sprite );
+        }
+    }
+
+    // nothing else is built, the file mustn't look opened with its sprites missing
+    if( loaded == 0 )
+    {
+        UTI_Print_Error( "Cannot open file, unable to load sprites" );
+        SPR_Free();
+        UTI_EC_Free( animation_record );
+        UTI_EC_Free( chunk );
+        return 0;
+    }
+
+    //======= EXTRACT ANIMATION DATA =======//
+
+    int32_t *frame_buffer = UTI_EC_Malloc( sizeof( int32_t ) * MAX_ANIMATION_FRAMES );
+
+    for( i = 0; i < (int)no_of_animations; i++ )
+    {
+        if( animation_record[i] == NULL )
+        {
+            // not in any chunk, a single blank frame like a newly added animation
+            frame_buffer[0] = 0;
+            ANI_Load_Animation( frame_buffer, 1, 1 );
+            continue;
+        }
+
+        uint32_t no_of_frames = Read_U32( animation_record[i] );
+        int32_t frame_wait = Read_U32( animation_record[i] + 4 );
+
+        for( j = 0; j < no_of_frames; j++ )
+        {
+            frame_buffer[j] = Read_U32( animation_record[i] + 8 + 4 * j );
+        }
+
+        ANI_Load_Animation( frame_buffer, no_of_frames, frame_wait );
+    }
+
+    UTI_EC_Free( frame_buffer );
+    UTI_EC_Free( animation_record );
+
+    //======= EXTRACT PALETTE DATA =======//
+
+    user_palette_type           *palette = PAL_Load_Palettes( no_of_palettes );
+
+    if( palette == NULL && no_of_palettes > 0 )
+    {
+        UTI_Print_Error( "Unable to load palettes" );
+    }
+    else if( no_of_palettes > 0 )
+    {
+        memset( palette, 0, sizeof( user_palette_type ) * no_of_palettes );
+
+        for( i = 0; i < (int)header.no_of_chunks; i++ )
+        {
+            if( chunk[i].type == FIL_CHUNK_PALETTES )
+            {
+                memcpy( &palette[chunk[i].first_index], map + chunk[i].offset, chunk[i].size );
+            }
+        }
+    }
+
+    Set_Saved_Layout( chunk, header.no_of_chunks, size );
+    UTI_EC_Free( chunk );
+
+    return 1;
+}
+
+
+// attempt to open a file, name given through FIL_Parse_Arguments, returns a FIL_OPEN_ status. the
+// file is mapped into memory and checked, then everything is built from it in one pass. sprite data
+// is used where it lies, the mapping is private so edited pages are copied and the file is
+// never changed
+int         FIL_Open_File()
+{
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+    {
+        // need to create new data, unless it is there and can't be read
+        int missing = ( errno == ENOENT );
+
+        UTI_Print_Error( "Unable to open file" );
+        return missing ? FIL_OPEN_MISSING : FIL_OPEN_FAILED;
+    }
+
+    struct stat file_stat;
+    if( fstat( fd, &file_stat ) != 0 || (size_t)file_stat.st_size < sizeof( file_header_type ) )
+    {
+        UTI_Print_Error( "Cannot open file, too small to be a sprite file" );
+        close( fd );
+        return FIL_OPEN_FAILED;
+    }
+
+    size_t size = file_stat.st_size;
+    uint8_t *map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+
+    // the mapping stays valid after the descriptor is closed
+    close( fd );
+
+    if( map == MAP_FAILED )
+    {
+        UTI_Print_Error( "Unable to map file" );
+        return FIL_OPEN_FAILED;
+    }
+
+    if( memcmp( map, SIGNATURE, 4 ) != 0 )
+    {
+        UTI_Print_Error( "Cannot open file, signature check failed" );
+        munmap( map, size );
+        return FIL_OPEN_FAILED;
+    }
+
+    // keep the mapping for the sprites, FIL_Free() releases it
+    Unmap_File();
+    file_map = map;
+    file_map_size = size;
+
+    // v1 has its sprite count where v2 has the marker
+    int opened;
+    if( Read_U32( map + 4 ) == FIL_V2_MARKER )
+    {
+        opened = Open_V2( map, size );
+    }
+    else
+    {
+        opened = Open_V1( map, size );
+    }
+
+    if( opened == 0 )
+    {
+        Unmap_File();
+        return FIL_OPEN_FAILED;
+    }
+
+    // saving only has to write what changes from here
+    Mark_All_Saved();
+
+    printf( "File opened successfully.\n\n" );
+
+    return FIL_OPEN_OK;
+}
+
+
+// releases the memory mapped file, call after SPR_Free()
+void        FIL_Free()
+{
+    Unmap_File();
+
+    UTI_EC_Free( saved_chunk );
+    UTI_EC_Free( saved_filename );
+    saved_chunk = NULL;
+    saved_filename = NULL;
+    no_of_saved_chunks = 0;
+
+    UTI_EC_Free( autosave_filename );
+    autosave_filename = NULL;
+
+    return;
+}
+
+
+// pads to the next chunk boundary and starts a chunk there. with file NULL nothing is written,
+// the chunk is only measured
+static void Begin_Chunk( FILE *file, file_chunk_type *chunk, uint32_t type, uint32_t first_index, uint32_t count )
+{
+    static const uint8_t zero[FIL_CHUNK_ALIGN] = { 0 };
+    uint64_t padding = ( FIL_CHUNK_ALIGN - write_pos % FIL_CHUNK_ALIGN ) % FIL_CHUNK_ALIGN;
+
+    if( file != NULL && padding > 0 )
+    {
+        fwrite( zero, 1, padding, file );
+    }
+
+    write_pos += padding;
+
+    memset( chunk, 0, sizeof( file_chunk_type ) );
+    chunk->type = type;
+    chunk->offset = write_pos;
+    chunk->count = count;
+    chunk->first_index = first_index;
+
+    return;
+}
+
+
+// adds data to the chunk that was last begun. measuring, with file NULL, works out the chunk's
+// size and checksum, writing only counts the size so it can be checked against the measured one.
+// return 1 on success
+static int Write_Chunk_Data( FILE *file, file_chunk_type *chunk, const void *data, size_t length )
+{
+    chunk->size += length;
+    write_pos += length;
+
+    if( file == NULL )
+    {
+        chunk->checksum = UTI_CRC32( chunk->checksum, data, length );
+        return 1;
+    }
+
+    return fwrite( data, 1, length, file ) == length;
+}
+
+
+// writes a META chunk with the counts given, return 1 on success
+static int Write_Meta_Chunk( FILE *file, file_chunk_type *chunk, int no_of_sprites, int no_of_animations, int no_of_palettes )
+{
+    uint8_t meta[FIL_META_SIZE];
+
+    Write_U32( meta, no_of_sprites );
+    Write_U32( meta + 4, no_of_animations );
+    Write_U32( meta + 8, no_of_palettes );
+    Write_U32( meta + 12, SPRITE_W );
+    Write_U32( meta + 16, SPRITE_H );
+    Write_U32( meta + 20, PAL_USER_SIZE );
+
+    Begin_Chunk( file, chunk, FIL_CHUNK_META, 0, 1 );
+
+    return Write_Chunk_Data( file, chunk, meta, FIL_META_SIZE );
+}
+
+
+// writes sprite records first to end-1 into the chunk that was last begun, return 1 on success
+static int Write_Sprite_Records( FILE *file, file_chunk_type *chunk, int first, int end )
+{
+    uint8_t record[FIL_SPRITE_RECORD_SIZE];
+    int i, written = 1;
+
+    for( i = first; i < end; i++ )
+    {
+        memcpy( record, SPR_Get_Sprite( i ), SPRITE_SIZE );
+        Write_U32( record + SPRITE_SIZE, SPR_Get_Sprite_Palette_Index( i ) );
+        written &= Write_Chunk_Data( file, chunk, record, FIL_SPRITE_RECORD_SIZE );
+    }
+
+    return written;
+}
+
+
+// fills in the ANIM record of an animation, record must have room for MAX_ANIMATION_FRAMES.
+// returns its size in bytes
+static size_t Encode_Animation( uint8_t *record, int index, int32_t *frame_buffer )
+{
+    int no_of_frames = ANI_Copy_Frames( index, frame_buffer );
+    int i;
+
+    Write_U32( record, no_of_frames );
+    Write_U32( record + 4, ANI_Get_Frame_Wait( index ) );
+    for( i = 0; i < no_of_frames; i++ )
+    {
+        Write_U32( record + 8 + 4 * i, frame_buffer[i] );
+    }
+
+    return 8 + 4 * no_of_frames;
+}
+
+
+// packs one sprite as described in file.h into out, which must have room for
+// FIL_PACKED_SPRITE_MAX bytes. returns the packed size
+static size_t Pack_Sprite( const sprite_type *sprite, uint8_t *out )
+{
+    const uint8_t   *pixel = sprite->definition;
+    uint8_t         nibble[SPRITE_SIZE / 2];
+    uint8_t         *p = out + 1;
+    uint32_t        palette = sprite->palette;
+    uint8_t         bits = 0;
+    int             i, run, start;
+
+    while( palette >= 0x80 )
+    {
+        *p++ = (uint8_t)( palette | 0x80 );
+        palette >>= 7;
+    }
+    *p++ = (uint8_t)palette;
+
+    for( i = 0; i < SPRITE_SIZE; i++ )
+    {
+        bits |= pixel[i];
+    }
+
+    // pixels the editor didn't write might not fit in a nibble
+    if( bits > 0x0f )
+    {
+        out[0] = FIL_PACK_RAW;
+        memcpy( p, pixel, SPRITE_SIZE );
+        return p + SPRITE_SIZE - out;
+    }
+
+    out[0] = FIL_PACK_NIBBLES;
+
+    for( i = 0; i < SPRITE_SIZE / 2; i++ )
+    {
+        nibble[i] = pixel[2 * i] | pixel[2 * i + 1] << 4;
+    }
+
+    // runs of three or more repeat, everything between them is copied
+    for( i = 0, start = 0; i < SPRITE_SIZE / 2; i += run )
+    {
+        for( run = 1; i + run < SPRITE_SIZE / 2 && run < FIL_PACK_MAX_RUN && nibble[i + run] == nibble[i]; run++ );
+
+        if( run < 3 )
+        {
+            continue;
+        }
+
+        if( i > start )
+        {
+            *p++ = i - start - 1;
+            memcpy( p, &nibble[start], i - start );
+            p += i - start;
+        }
+
+        *p++ = run + 125;
+        *p++ = nibble[i];
+        start = i + run;
+    }
+
+    if( start < SPRITE_SIZE / 2 )
+    {
+        *p++ = SPRITE_SIZE / 2 - start - 1;
+        memcpy( p, &nibble[start], SPRITE_SIZE / 2 - start );
+        p += SPRITE_SIZE / 2 - start;
+    }
+
+    return p - out;
+}
+
+
+// fills in a sprite as it is written, for Pack_Sprites()
+static void Get_Sprite_Record( int index, sprite_type *sprite )
+{
+    memcpy( sprite->definition, SPR_Get_Sprite( index ), SPRITE_SIZE );
+    sprite->palette = SPR_Get_Sprite_Palette_Index( index );
+
+    return;
+}
+
+
+// fills in the shared definition numbered index as a sprite with palette index 0, for
+// Pack_Sprites()
+static void Get_Definition_Record( int index, sprite_type *sprite )
+{
+    memcpy( sprite->definition, SPR_Get_Definition( shared_order[index] ), SPRITE_SIZE );
+    sprite->palette = 0;
+
+    return;
+}
+
+
+// packs count sprites, each filled in by get_sprite, as the data of a packed sprite chunk,
+// returns it and sets size. free with UTI_EC_Free
+static uint8_t *Pack_Sprites( void (*get_sprite)( int, sprite_type * ), int count, size_t *size )
+{
+    sprite_type sprite;
+    size_t no_of_blocks = ( (size_t)count + FIL_PACK_BLOCK - 1 ) / FIL_PACK_BLOCK;
+    uint8_t *data = UTI_EC_Malloc( 4 * ( no_of_blocks + 1 ) + (size_t)FIL_PACKED_SPRITE_MAX * count );
+    size_t pos = 4 * ( no_of_blocks + 1 );
+    int i;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( i % FIL_PACK_BLOCK == 0 )
+        {
+            Write_U32( data + 4 * ( i / FIL_PACK_BLOCK ), pos );
+        }
+
+        get_sprite( i, &sprite );
+        pos += Pack_Sprite( &sprite, data + pos );
+    }
+
+    Write_U32( data + 4 * no_of_blocks, pos );
+    *size = pos;
+
+    return data;
+}
+
+
+// numbers the shared definitions in the order sprites first use them, for a full save. any
+// sprites not loaded yet are loaded first
+static void Number_Definitions()
+{
+    int no_of_sprites = SPR_Get_Number_Of_Sprites();
+    int limit, i, id;
+
+    SPR_Own_Sprites();
+    limit = SPR_Get_Definition_Id_Limit();
+
+    shared_index = UTI_EC_Malloc( sizeof( int ) * ( limit + 1 ) );
+    shared_order = UTI_EC_Malloc( sizeof( int ) * ( SPR_Get_Number_Of_Definitions() + 1 ) );
+    no_of_shared = 0;
+
+    for( i = 0; i < limit; i++ )
+    {
+        shared_index[i] = -1;
+    }
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        id = SPR_Get_Definition_Id( i );
+        if( shared_index[id] < 0 )
+        {
+            shared_index[id] = no_of_shared;
+            shared_order[no_of_shared++] = id;
+        }
+    }
+
+    return;
+}
+
+
+// frees the numbering from Number_Definitions()
+static void Free_Numbering()
+{
+    UTI_EC_Free( shared_index );
+    UTI_EC_Free( shared_order );
+    shared_index = NULL;
+    shared_order = NULL;
+    no_of_shared = 0;
+
+    return;
+}
+
+
+// writes a shared record for each of count sprites into the chunk that was last begun, return 1
+// on success
+static int Write_Shared_Records( FILE *file, file_chunk_type *chunk, int count )
+{
+    uint8_t records[FIL_SHARED_RECORD_SIZE * FIL_PACK_BLOCK];
+    size_t n = 0;
+    int i, written = 1;
+
+    for( i = 0; i < count; i++ )
+    {
+        Write_U32( records + n, shared_index[SPR_Get_Definition_Id( i )] );
+        Write_U32( records + n + 4, SPR_Get_Sprite_Palette_Index( i ) );
+        n += FIL_SHARED_RECORD_SIZE;
+
+        if( n == sizeof( records ) || i == count - 1 )
+        {
+            written &= Write_Chunk_Data( file, chunk, records, n );
+            n = 0;
+        }
+    }
+
+    return written;
+}
+
+
+// writes animation records first to end-1 into the chunk that was last begun, return 1 on
+// success
+static int Write_Animation_Records( FILE *file, file_chunk_type *chunk, int first, int end )
+{
+    int32_t         *frame_buffer = UTI_EC_Malloc( sizeof( int32_t ) * MAX_ANIMATION_FRAMES );
+    uint8_t         *record = UTI_EC_Malloc( 8 + 4 * MAX_ANIMATION_FRAMES );
+    int             i, written = 1;
+
+    for( i = first; i < end; i++ )
+    {
+        written &= Write_Chunk_Data( file, chunk, record, Encode_Animation( record, i, frame_buffer ) );
+    }
+
+    UTI_EC_Free( record );
+    UTI_EC_Free( frame_buffer );
+
+    return written;
+}
+
+
+// writes every sprite, animation and palette as the four chunks of a whole file, and the shared
+// definitions as a fifth when sprites are shared. return 1 on success
+static int Write_All_Chunks( FILE *file, file_chunk_type *chunk )
+{
+    int no_of_sprites       = SPR_Get_Number_Of_Sprites();
+    int no_of_animations    = ANI_Get_Number_Of_Animations();
+    int no_of_palettes      = PAL_Get_Number_Of_Palettes();
+    const sprite_type *sprites = SPR_Get_Sprites();
+    int written;
+
+    written = Write_Meta_Chunk( file, &chunk[0], no_of_sprites, no_of_animations, no_of_palettes );
+
+    Begin_Chunk( file, &chunk[1], FIL_CHUNK_SPRITES, 0, no_of_sprites );
+    if( shared_order != NULL )
+    {
+        chunk[1].flags = FIL_CHUNK_SHARED;
+        written &= Write_Shared_Records( file, &chunk[1], no_of_sprites );
+    }
+    else if( packed_sprites != NULL )
+    {
+        chunk[1].flags = FIL_CHUNK_PACKED;
+        written &= Write_Chunk_Data( file, &chunk[1], packed_sprites, packed_size );
+    }
+    else if( Host_Is_Little_Endian() && sprites != NULL && no_of_sprites > 0 )
+    {
+        // sprite_type is the record layout, so they go in one write
+        written &= Write_Chunk_Data( file, &chunk[1], sprites, sizeof( sprite_type ) * no_of_sprites );
+    }
+    else
+    {
+        written &= Write_Sprite_Records( file, &chunk[1], 0, no_of_sprites );
+    }
+
+    Begin_Chunk( file, &chunk[2], FIL_CHUNK_ANIMATIONS, 0, no_of_animations );
+    written &= Write_Animation_Records( file, &chunk[2], 0, no_of_animations );
+
+    // palettes are bytes and stored together so go in one write
+    Begin_Chunk( file, &chunk[3], FIL_CHUNK_PALETTES, 0, no_of_palettes );
+    if( no_of_palettes > 0 )
+    {
+        written &= Write_Chunk_Data( file, &chunk[3], PAL_Get_Palettes(), sizeof( user_palette_type ) * no_of_palettes );
+    }
+
+    // each definition once, packed instead of the sprites when they would be
+    if( shared_order != NULL )
+    {
+        Begin_Chunk( file, &chunk[4], FIL_CHUNK_DEFINITIONS, 0, no_of_shared );
+        if( packed_sprites != NULL )
+        {
+            chunk[4].flags = FIL_CHUNK_PACKED;
+            written &= Write_Chunk_Data( file, &chunk[4], packed_sprites, packed_size );
+        }
+        else
+        {
+            int i;
+            for( i = 0; i < no_of_shared; i++ )
+            {
+                written &= Write_Chunk_Data( file, &chunk[4], SPR_Get_Definition( shared_order[i] ), SPRITE_SIZE );
+            }
+        }
+    }
+
+    return written;
+}
+
+
+// bytes of pixels each sprite or definition takes in the snapshot
+static int Snapshot_Pixel_Size()
+{
+    return ( snapshot_storage & SPR_STORAGE_PACKED ) ? SPRITE_SIZE / 2 : SPRITE_SIZE;
+}
+
+
+// bytes each sprite record takes in the snapshot, its pixels or definition id then its palette
+// index
+static int Snapshot_Record_Size()
+{
+    return ( snapshot_storage & SPR_STORAGE_SHARED ) ? FIL_SHARED_RECORD_SIZE : Snapshot_Pixel_Size() + 4;
+}
+
+
+// fills in SPRITE_SIZE pixels from ones copied into the snapshot
+static void Get_Snapshot_Pixels( uint8_t *pixel, const uint8_t *data )
+{
+    int i;
+
+    if( ( snapshot_storage & SPR_STORAGE_PACKED ) == 0 )
+    {
+        memcpy( pixel, data, SPRITE_SIZE );
+        return;
+    }
+
+    for( i = 0; i < SPRITE_SIZE / 2; i++ )
+    {
+        memcpy( pixel + 2 * i, nibble_pixels[data[i]], 2 );
+    }
+
+    return;
+}
+
+
+// fills in count sprites of the snapshot from first, out of their records or, for runs of
+// sprites without one, the working file
+static void Get_Snapshot_Sprites( int first, int count, sprite_type *sprites )
+{
+    int i, end, record;
+
+    for( i = 0; i < count; i = end )
+    {
+        record = snapshot_sprite_record[first + i];
+        end = i + 1;
+
+        if( record < 0 )
+        {
+            for( ; end < count && snapshot_sprite_record[first + end] < 0; end++ );
+
+            Read_Sprite_Range( autosave_map, first + i, end - i, &sprites[i] );
+            continue;
+        }
+
+        const uint8_t *data = snapshot_record + (size_t)Snapshot_Record_Size() * record;
+
+        if( snapshot_storage & SPR_STORAGE_SHARED )
+        {
+            Get_Snapshot_Pixels( sprites[i].definition, snapshot_definition + (size_t)Snapshot_Pixel_Size() * Read_U32( data ) );
+            sprites[i].palette = Read_U32( data + 4 );
+        }
+        else
+        {
+            Get_Snapshot_Pixels( sprites[i].definition, data );
+            sprites[i].palette = Read_U32( data + Snapshot_Pixel_Size() );
+        }
+    }
+
+    return;
+}
+
+
+// writes the autosave snapshot as the four chunks of a whole file, return 1 on success. sprites
+// are written full size a block at a time, however they were copied
+static int Write_Snapshot_Chunks( FILE *file, file_chunk_type *chunk )
+{
+    sprite_type sprites[FIL_PACK_BLOCK];
+    uint8_t records[FIL_SPRITE_RECORD_SIZE * FIL_PACK_BLOCK];
+    int i, j, count, written;
+
+    written = Write_Meta_Chunk( file, &chunk[0], snapshot_no_of_sprites, snapshot_no_of_animations, snapshot_no_of_palettes );
+
+    Begin_Chunk( file, &chunk[1], FIL_CHUNK_SPRITES, 0, snapshot_no_of_sprites );
+    for( i = 0; i < snapshot_no_of_sprites; i += count )
+    {
+        count = ( snapshot_no_of_sprites - i < FIL_PACK_BLOCK ) ? snapshot_no_of_sprites - i : FIL_PACK_BLOCK;
+        Get_Snapshot_Sprites( i, count, sprites );
+
+        for( j = 0; j < count; j++ )
+        {
+            memcpy( records + FIL_SPRITE_RECORD_SIZE * j, sprites[j].definition, SPRITE_SIZE );
+            Write_U32( records + FIL_SPRITE_RECORD_SIZE * j + SPRITE_SIZE, sprites[j].palette );
+        }
+
+        written &= Write_Chunk_Data( file, &chunk[1], records, (size_t)FIL_SPRITE_RECORD_SIZE * count );
+    }
+
+    Begin_Chunk( file, &chunk[2], FIL_CHUNK_ANIMATIONS, 0, snapshot_no_of_animations );
+    for( i = 0; i < snapshot_no_of_animations; i++ )
+    {
+        written &= Write_Chunk_Data( file, &chunk[2], snapshot_animation[i], 8 + 4 * (size_t)Read_U32( snapshot_animation[i] ) );
+    }
+
+    Begin_Chunk( file, &chunk[3], FIL_CHUNK_PALETTES, 0, snapshot_no_of_palettes );
+    if( snapshot_no_of_palettes > 0 )
+    {
+        written &= Write_Chunk_Data( file, &chunk[3], snapshot_palette, sizeof( user_palette_type ) * snapshot_no_of_palettes );
+    }
+
+    return written;
+}
+
+
+// writes each run of changed records in list as a chunk of its own, returns the number of chunks
+static int Write_Runs( FILE *file, file_chunk_type *chunk, uint32_t type, const int *list, int count, int *written )
+{
+    int next = 0, first, end, n;
+
+    for( n = 0; next < count; n++ )
+    {
+        first = list[next];
+        end = Get_Run_End( list, count, &next );
+
+        Begin_Chunk( file, &chunk[n], type, first, end - first );
+
+        switch( type )
+        {
+            case FIL_CHUNK_SPRITES:
+                *written &= Write_Sprite_Records( file, &chunk[n], first, end );
+                break;
+
+            case FIL_CHUNK_ANIMATIONS:
+                *written &= Write_Animation_Records( file, &chunk[n], first, end );
+                break;
+
+            case FIL_CHUNK_PALETTES:
+                *written &= Write_Chunk_Data( file, &chunk[n], &PAL_Get_Palettes()[first], sizeof( user_palette_type ) * ( end - first ) );
+                break;
+        }
+    }
+
+    return n;
+}
+
+
+// writes the changed sprites, animations and palettes given in list, and a META chunk if the
+// counts have changed, returns the number of chunks. written is cleared on failure
+static int Write_Changed_Chunks( FILE *file, file_chunk_type *chunk, int **list, const int *count, int counts_changed, int *written )
+{
+    int n = 0;
+
+    n += Write_Runs( file, &chunk[n], FIL_CHUNK_SPRITES, list[0], count[0], written );
+    n += Write_Runs( file, &chunk[n], FIL_CHUNK_ANIMATIONS, list[1], count[1], written );
+    n += Write_Runs( file, &chunk[n], FIL_CHUNK_PALETTES, list[2], count[2], written );
+
+    if( counts_changed )
+    {
+        *written &= Write_Meta_Chunk( file, &chunk[n++], SPR_Get_Number_Of_Sprites(),
+                                      ANI_Get_Number_Of_Animations(), PAL_Get_Number_Of_Palettes() );
+    }
+
+    return n;
+}
+
+
+// returns 1 if the chunks that were written match the ones that were measured, so nothing
+// changed in between
+static int Check_Written_Chunks( const file_chunk_type *measured, const file_chunk_type *written, int count )
+{
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        if( measured[i].offset != written[i].offset || measured[i].size != written[i].size )
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// encodes the directory for the chunks, which is to go at offset, and the header pointing to it.
+// returns the directory, FIL_CHUNK_ENTRY_SIZE bytes per chunk, free with UTI_EC_Free
+static uint8_t *Build_Directory( const file_chunk_type *chunk, int no_of_chunks, uint64_t offset, uint8_t *header_data )
+{
+    size_t size = (size_t)no_of_chunks * FIL_CHUNK_ENTRY_SIZE;
+    uint8_t *directory = UTI_EC_Malloc( size + 1 );
+    int i;
+
+    for( i = 0; i < no_of_chunks; i++ )
+    {
+        Encode_Chunk_Entry( directory + (size_t)i * FIL_CHUNK_ENTRY_SIZE, &chunk[i] );
+    }
+
+    file_header_v2_type header;
+    memcpy( header.signature, SIGNATURE, 4 );
+    header.marker               = FIL_V2_MARKER;
+    header.version              = FIL_VERSION;
+    header.header_size          = FIL_HEADER_SIZE;
+    header.no_of_chunks         = no_of_chunks;
+    header.directory_offset     = offset;
+    header.directory_checksum   = UTI_CRC32( 0, directory, size );
+    header.flags                = 0;
+
+    Encode_Header( header_data, &header );
+
+    return directory;
+}
+
+
+// flushes a file all the way to the disk, return 1 on success
+static int Sync_File( FILE *file )
+{
+    return fflush( file ) == 0 && fsync( fileno( file ) ) == 0;
+}
+
+
+// makes a rename in the directory holding path survive a crash
+static void Sync_Directory( const char *path )
+{
+    char *directory = UTI_EC_Malloc( strlen( path ) + 2 );
+    strcpy( directory, path );
+
+    char *slash = strrchr( directory, '/' );
+    if( slash == NULL )
+    {
+        strcpy( directory, "." );
+    }
+    else
+    {
+        slash[ slash == directory ] = '\0';
+    }
+
+    int fd = open( directory, O_RDONLY );
+    if( fd >= 0 )
+    {
+        fsync( fd );
+        close( fd );
+    }
+
+    UTI_EC_Free( directory );
+
+    return;
+}
+
+
+// adds what has changed since the last save to the end of the working file, as chunks that
+// override the records they replace, followed by a new directory. nothing already in the file
+// is overwritten until the header is pointed at the new directory, once everything else is on
+// the disk, so a crash part way through leaves the file as it was saved last. returns 0
+// without changing the file when it has to be written in full instead, because it wasn't a v2
+// file, things have been removed, or too much of it would be out of date
+static int Save_Changes()
+{
+    if( saved_chunk == NULL || strcmp( saved_filename, filename ) != 0 )
+    {
+        return 0;
+    }
+
+    int no_of_sprites       = SPR_Get_Number_Of_Sprites();
+    int no_of_animations    = ANI_Get_Number_Of_Animations();
+    int no_of_palettes      = PAL_Get_Number_Of_Palettes();
+
+    if( no_of_sprites < saved_no_of_sprites || no_of_animations < saved_no_of_animations ||
+        no_of_palettes < saved_no_of_palettes )
+    {
+        return 0;
+    }
+
+    // packing is asked for, so a file that isn't packed yet is written again in full
+    uint64_t packed_bytes = Get_Saved_Packed_Size();
+    if( ( options & FIL_OPTION_COMPRESS ) && packed_bytes == 0 )
+    {
+        return 0;
+    }
+
+    // likewise sharing, so the definitions are only written once
+    uint64_t shared_bytes = Get_Saved_Size( FIL_CHUNK_DEFINITIONS, 0 );
+    if( SPR_Get_Number_Of_Definitions() > 0 && Get_Saved_Size( FIL_CHUNK_SPRITES, FIL_CHUNK_SHARED ) == 0 )
+    {
+        return 0;
+    }
+
+    //======= FIND CHANGES =======//
+
+    // sprites, animations then palettes
+    int             *list[3];
+    int             count[3];
+    const int       *changed;
+    int             no_of_changed, i;
+
+    changed = SPR_Get_Changed_Sprites( &no_of_changed );
+    list[0] = UTI_EC_Malloc( sizeof( int ) * ( no_of_changed + 1 ) );
+    count[0] = Get_Changed( changed, no_of_changed, no_of_sprites, list[0] );
+
+    changed = ANI_Get_Changed_Animations( &no_of_changed );
+    list[1] = UTI_EC_Malloc( sizeof( int ) * ( no_of_changed + 1 ) );
+    count[1] = Get_Changed( changed, no_of_changed, no_of_animations, list[1] );
+
+    changed = PAL_Get_Changed_Palettes( &no_of_changed );
+    list[2] = UTI_EC_Malloc( sizeof( int ) * ( no_of_changed + 1 ) );
+    count[2] = Get_Changed( changed, no_of_changed, no_of_palettes, list[2] );
+
+    int counts_changed = ( no_of_sprites != saved_no_of_sprites || no_of_animations != saved_no_of_animations ||
+                           no_of_palettes != saved_no_of_palettes );
+
+    //======= MEASURE =======//
+
+    // at worst every changed record is a chunk of its own
+    int most_chunks = count[0] + count[1] + count[2] + 1;
+    file_chunk_type *new_chunk = UTI_EC_Malloc( sizeof( file_chunk_type ) * most_chunks );
+    file_chunk_type *written_chunk = UTI_EC_Malloc( sizeof( file_chunk_type ) * most_chunks );
+    int written = 1;
+
+    write_pos = saved_file_size;
+    int no_of_new_chunks = Write_Changed_Chunks( NULL, new_chunk, list, count, counts_changed, &written );
+    int no_of_chunks = no_of_saved_chunks + no_of_new_chunks;
+    uint64_t directory_offset = write_pos;
+    uint64_t file_size = directory_offset + (uint64_t)no_of_chunks * FIL_CHUNK_ENTRY_SIZE;
+
+    // what the file would be if it were written out again from scratch
+    uint64_t needed = FIL_HEADER_SIZE + FIL_WHOLE_FILE_CHUNKS * ( FIL_CHUNK_ALIGN + FIL_CHUNK_ENTRY_SIZE ) + FIL_META_SIZE +
+                      (uint64_t)no_of_palettes * PAL_USER_SIZE;
+    if( shared_bytes > 0 )
+    {
+        needed += shared_bytes + (uint64_t)no_of_sprites * FIL_SHARED_RECORD_SIZE;
+    }
+    else
+    {
+        needed += ( packed_bytes > 0 ) ? packed_bytes : (uint64_t)no_of_sprites * FIL_SPRITE_RECORD_SIZE;
+    }
+    for( i = 0; i < no_of_animations; i++ )
+    {
+        needed += 8 + 4 * (uint64_t)ANI_Get_Number_Of_Frames( i );
+    }
+
+    FILE *file = NULL;
+
+    // once more than half the file would be out of date it is quicker to load rewritten
+    if( no_of_new_chunks > 0 && no_of_chunks <= FIL_COMPACT_CHUNKS && file_size <= 2 * needed )
+    {
+        file = fopen( filename, "r+b" );
+    }
+
+    if( no_of_new_chunks == 0 || file == NULL || fseek( file, 0, SEEK_END ) != 0 ||
+        (uint64_t)ftell( file ) != saved_file_size )
+    {
+        if( file != NULL )
+        {
+            UTI_Print_Debug( "File has changed since it was read, writing it in full" );
+            fclose( file );
+        }
+        else if( no_of_new_chunks == 0 )
+        {
+            printf( "No changes to save to %s\n", filename );
+        }
+
+        for( i = 0; i < 3; i++ )
+        {
+            UTI_EC_Free( list[i] );
+        }
+        UTI_EC_Free( new_chunk );
+        UTI_EC_Free( written_chunk );
+
+        return no_of_new_chunks == 0;
+    }
+
+    //======= APPEND =======//
+
+    saved_chunk = UTI_EC_Realloc( saved_chunk, sizeof( file_chunk_type ) * ( no_of_chunks + 1 ) );
+    memcpy( &saved_chunk[no_of_saved_chunks], new_chunk, sizeof( file_chunk_type ) * no_of_new_chunks );
+
+    uint8_t header_data[FIL_HEADER_SIZE];
+    uint8_t *directory = Build_Directory( saved_chunk, no_of_chunks, directory_offset, header_data );
+
+    write_pos = saved_file_size;
+    Write_Changed_Chunks( file, written_chunk, list, count, counts_changed, &written );
+
+    written &= Check_Written_Chunks( new_chunk, written_chunk, no_of_new_chunks );
+    written &= ( fwrite( directory, FIL_CHUNK_ENTRY_SIZE, no_of_chunks, file ) == (size_t)no_of_chunks );
+
+    // everything the new header points at has to be on the disk before it is written
+    written &= Sync_File( file );
+    if( written )
+    {
+        written &= ( fseek( file, 0, SEEK_SET ) == 0 );
+        written &= ( fwrite( header_data, FIL_HEADER_SIZE, 1, file ) == 1 );
+        written &= Sync_File( file );
+    }
+
+    if( fclose( file ) != 0 )
+    {
+        written = 0;
+    }
+
+    printf( "Saved %d changed sprites, %d animations and %d palettes to %s, %llu bytes added\n",
+            count[0], count[1], count[2], filename, (unsigned long long)( file_size - saved_file_size ) );
+
+    for( i = 0; i < 3; i++ )
+    {
+        UTI_EC_Free( list[i] );
+    }
+    UTI_EC_Free( new_chunk );
+    UTI_EC_Free( written_chunk );
+    UTI_EC_Free( directory );
+
+    if( written == 0 )
+    {
+        UTI_Print_Error( "Unable to add changes to the file, writing it in full" );
+        return 0;
+    }
+
+    no_of_saved_chunks = no_of_chunks;
+    saved_file_size = file_size;
+    Mark_All_Saved();
+
+    return 1;
+}
+
+
+// writes the no_of_chunks chunks from write_chunks as a whole file called name. it goes to a temporary
+// file next to it, which is synced to the disk and renamed over it, so the file is never left
+// part written. the chunks and the file size are set. return 1 on success, name is left as it
+// was on failure
+static int Write_Whole_File( const char *name, int (*write_chunks)( FILE *, file_chunk_type * ),
+                             file_chunk_type *chunk, int no_of_chunks, uint64_t *file_size )
+{
+    //======= MEASURE =======//
+
+    // every chunk's size and checksum are worked out first, so the header can be written first
+    // and the file goes out front to back in one pass
+    file_chunk_type     written_chunk[FIL_WHOLE_FILE_CHUNKS];
+    uint8_t             header_data[FIL_HEADER_SIZE];
+
+    write_pos = FIL_HEADER_SIZE;
+    write_chunks( NULL, chunk );
+
+    uint64_t directory_offset = write_pos;
+    uint8_t *directory = Build_Directory( chunk, no_of_chunks, directory_offset, header_data );
+
+    *file_size = directory_offset + (uint64_t)no_of_chunks * FIL_CHUNK_ENTRY_SIZE;
+
+    //======= WRITE TEMPORARY FILE =======//
+
+    char *temp_name = UTI_EC_Malloc( strlen( name ) + 8 );
+    sprintf( temp_name, "%s.XXXXXX", name );
+
+    int fd = mkstemp( temp_name );
+    if( fd < 0 )
+    {
+        UTI_Print_Error( "Unable to create file" );
+        UTI_EC_Free( temp_name );
+        UTI_EC_Free( directory );
+        return 0;
+    }
+
+    // the new file gets the permissions of the one it replaces
+    struct stat file_stat;
+    if( stat( name, &file_stat ) == 0 )
+    {
+        fchmod( fd, file_stat.st_mode & 07777 );
+    }
+    else
+    {
+        mode_t mask = umask( 0 );
+        umask( mask );
+        fchmod( fd, 0666 & ~mask );
+    }
+
+    FILE *file = fdopen( fd, "wb" );
+    int written = ( file != NULL );
+
+    if( file != NULL )
+    {
+        setvbuf( file, NULL, _IOFBF, FIL_WRITE_BUFFER );
+
+        write_pos = 0;
+        written &= ( fwrite( header_data, FIL_HEADER_SIZE, 1, file ) == 1 );
+        write_pos += FIL_HEADER_SIZE;
+
+        written &= write_chunks( file, written_chunk );
+        written &= Check_Written_Chunks( chunk, written_chunk, no_of_chunks );
+        written &= ( fwrite( directory, FIL_CHUNK_ENTRY_SIZE, no_of_chunks, file ) == (size_t)no_of_chunks );
+        written &= Sync_File( file );
+
+        if( fclose( file ) != 0 )
+        {
+            written = 0;
+        }
+    }
+    else
+    {
+        close( fd );
+    }
+
+    UTI_EC_Free( directory );
+
+    //======= REPLACE FILE =======//
+
+    // the old file stays whole until the rename, and a mapping of it stays valid after
+    if( written == 0 || rename( temp_name, name ) != 0 )
+    {
+        UTI_Print_Error( "Unable to write file, it has been left as it was" );
+        unlink( temp_name );
+        UTI_EC_Free( temp_name );
+        return 0;
+    }
+
+    Sync_Directory( name );
+    UTI_EC_Free( temp_name );
+
+    return 1;
+}
+
+
+// write data to file as version 2, filename given by user cmd line args. only what has changed
+// is added to the end of a v2 file, unless it has got too far out of date. otherwise the file is
+// written in full through Write_Whole_File(). return 1 on success
+int         FIL_Write_File()
+{
+    if( Save_Changes() == 0 )
+    {
+        file_chunk_type     chunk[FIL_WHOLE_FILE_CHUNKS];
+        int                 no_of_chunks = 4;
+        int                 no_of_sprites = SPR_Get_Number_Of_Sprites();
+        uint64_t            file_size;
+        int                 written;
+
+        // shared sprites are written as their definitions once each and a record per sprite
+        if( SPR_Get_Number_Of_Definitions() > 0 )
+        {
+            Number_Definitions();
+            no_of_chunks = FIL_WHOLE_FILE_CHUNKS;
+        }
+
+        // a packed file stays packed
+        if( ( options & FIL_OPTION_COMPRESS ) || Get_Saved_Packed_Size() > 0 )
+        {
+            if( shared_order != NULL )
+            {
+                packed_sprites = Pack_Sprites( Get_Definition_Record, no_of_shared, &packed_size );
+                printf( "Packed %d shared definitions into %zu bytes, %.1f%% of their size\n", no_of_shared, packed_size,
+                        100.0 * packed_size / ( (double)SPRITE_SIZE * ( no_of_shared > 0 ? no_of_shared : 1 ) ) );
+            }
+            else
+            {
+                packed_sprites = Pack_Sprites( Get_Sprite_Record, no_of_sprites, &packed_size );
+                printf( "Packed %d sprites into %zu bytes, %.1f%% of their size\n", no_of_sprites, packed_size,
+                        100.0 * packed_size / ( (double)FIL_SPRITE_RECORD_SIZE * ( no_of_sprites > 0 ? no_of_sprites : 1 ) ) );
+            }
+        }
+
+        written = Write_Whole_File( filename, Write_All_Chunks, chunk, no_of_chunks, &file_size );
+
+        UTI_EC_Free( packed_sprites );
+        packed_sprites = NULL;
+        Free_Numbering();
+
+        if( written == 0 )
+        {
+            return 0;
+        }
+
+        printf( "Written data for %d sprite definitions\n", chunk[1].count );
+        if( no_of_chunks > 4 )
+        {
+            printf( "Written %d shared definitions for %d sprites, %.2f sprites each\n", chunk[4].count, chunk[1].count,
+                    (double)chunk[1].count / ( chunk[4].count > 0 ? chunk[4].count : 1 ) );
+        }
+        printf( "Written data for %d animations\n", chunk[2].count );
+        printf( "Written data for %d palettes\n", chunk[3].count );
+        printf( "Successfully written data to %s\n", filename );
+
+        // the next save only has to add to this
+        Set_Saved_Layout( chunk, no_of_chunks, file_size );
+        Mark_All_Saved();
+    }
+
+    // everything in the autosave is in the working file now
+    if( autosave_filename != NULL )
+    {
+        unlink( autosave_filename );
+    }
+
+    return 1;
+}
+
+
+//======= AUTOSAVE =======//
+
+// returns a monotonic time in ms
+static double Get_Time()
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+// copies SPRITE_SIZE pixels into the snapshot the way the sprite code keeps them
+static void Put_Snapshot_Pixels( uint8_t *data, const uint8_t *pixel )
+{
+    int i;
+
+    if( ( snapshot_storage & SPR_STORAGE_PACKED ) == 0 )
+    {
+        memcpy( data, pixel, SPRITE_SIZE );
+        return;
+    }
+
+    // packed sprites have no pixel above 15
+    for( i = 0; i < SPRITE_SIZE / 2; i++ )
+    {
+        data[i] = pixel[2 * i] | pixel[2 * i + 1] << 4;
+    }
+
+    return;
+}
+
+
+// copies a sprite into its snapshot record, giving it one if it has none
+static void Put_Snapshot_Sprite( int index )
+{
+    int record_size = Snapshot_Record_Size();
+    int pixel_size = Snapshot_Pixel_Size();
+
+    if( snapshot_sprite_record[index] < 0 )
+    {
+        if( snapshot_no_of_records == snapshot_record_capacity )
+        {
+            snapshot_record_capacity = ( snapshot_record_capacity > 0 ) ? snapshot_record_capacity * 2 : FIL_PACK_BLOCK;
+            snapshot_record = UTI_EC_Realloc( snapshot_record, (size_t)record_size * snapshot_record_capacity );
+        }
+
+        snapshot_sprite_record[index] = snapshot_no_of_records++;
+    }
+
+    uint8_t *data = snapshot_record + (size_t)record_size * snapshot_sprite_record[index];
+
+    if( ( snapshot_storage & SPR_STORAGE_SHARED ) == 0 )
+    {
+        Put_Snapshot_Pixels( data, SPR_Get_Sprite( index ) );
+        Write_U32( data + pixel_size, SPR_Get_Sprite_Palette_Index( index ) );
+        return;
+    }
+
+    // a definition id is only given to different pixels once no sprite has it, and every sprite
+    // that has it after that has changed, so copying it with each changed sprite keeps it right
+    int id = SPR_Get_Definition_Id( index );
+
+    while( id >= snapshot_definition_capacity )
+    {
+        snapshot_definition_capacity = ( snapshot_definition_capacity > 0 ) ? snapshot_definition_capacity * 2 : FIL_PACK_BLOCK;
+        snapshot_definition = UTI_EC_Realloc( snapshot_definition, (size_t)pixel_size * snapshot_definition_capacity );
+    }
+
+    Put_Snapshot_Pixels( snapshot_definition + (size_t)pixel_size * id, SPR_Get_Definition( id ) );
+    Write_U32( data, id );
+    Write_U32( data + 4, SPR_Get_Sprite_Palette_Index( index ) );
+
+    return;
+}
+
+
+// maps the working file again for the autosave thread and starts the snapshot off with every
+// sprite left in it, so only sprites that change are ever copied. returns 1 on success
+static int Leave_Sprites_In_File()
+{
+    int no_of_sprites = SPR_Get_Number_Of_Sprites();
+    int i;
+
+    // version 1 sprites can't be read again through Read_Sprite_Range()
+    if( file_map == NULL || sprite_chunk == NULL )
+    {
+        return 0;
+    }
+
+    int fd = open( filename, O_RDONLY );
+    if( fd < 0 )
+    {
+        return 0;
+    }
+
+    // the file has to be the one that was opened
+    struct stat file_stat;
+    if( fstat( fd, &file_stat ) != 0 || (uint64_t)file_stat.st_size != file_map_size )
+    {
+        close( fd );
+        return 0;
+    }
+
+    uint8_t *map = mmap( NULL, file_map_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if( map == MAP_FAILED )
+    {
+        return 0;
+    }
+
+    autosave_map = map;
+    autosave_map_size = file_map_size;
+
+    snapshot_sprite_generation = UTI_EC_Malloc( sizeof( uint32_t ) * ( no_of_sprites + 1 ) );
+    snapshot_sprite_record = UTI_EC_Malloc( sizeof( int ) * ( no_of_sprites + 1 ) );
+
+    // reading a generation doesn't load the sprite
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        snapshot_sprite_generation[i] = SPR_Get_Sprite_Generation( i );
+        snapshot_sprite_record[i] = -1;
+    }
+
+    snapshot_no_of_sprites = no_of_sprites;
+    snapshot_sprite_capacity = no_of_sprites;
+    snapshot_storage = SPR_Get_Storage();
+
+    return 1;
+}
+
+
+// brings the snapshot up to date, copying records that have been added or changed since it was
+// last taken. returns 1 if anything has changed
+static int Update_Snapshot()
+{
+    int no_of_sprites       = SPR_Get_Number_Of_Sprites();
+    int no_of_animations    = ANI_Get_Number_Of_Animations();
+    int no_of_palettes      = PAL_Get_Number_Of_Palettes();
+    int changed = ( no_of_sprites != snapshot_no_of_sprites || no_of_animations != snapshot_no_of_animations ||
+                    no_of_palettes != snapshot_no_of_palettes );
+    uint32_t generation;
+    int i;
+
+    //======= SPRITES =======//
+
+    // sprites are kept another way now, those with records are copied again. generations start
+    // at 1 so none match
+    if( SPR_Get_Storage() != snapshot_storage )
+    {
+        for( i = 0; i < snapshot_sprite_capacity; i++ )
+        {
+            if( snapshot_sprite_record[i] >= 0 )
+            {
+                snapshot_sprite_record[i] = -1;
+                snapshot_sprite_generation[i] = 0;
+            }
+        }
+
+        UTI_EC_Free( snapshot_record );
+        UTI_EC_Free( snapshot_definition );
+
+        snapshot_record = NULL;
+        snapshot_no_of_records = 0;
+        snapshot_record_capacity = 0;
+        snapshot_definition = NULL;
+        snapshot_definition_capacity = 0;
+        snapshot_storage = SPR_Get_Storage();
+    }
+
+    if( no_of_sprites > snapshot_sprite_capacity )
+    {
+        snapshot_sprite_generation = UTI_EC_Realloc( snapshot_sprite_generation, sizeof( uint32_t ) * no_of_sprites );
+        snapshot_sprite_record = UTI_EC_Realloc( snapshot_sprite_record, sizeof( int ) * no_of_sprites );
+        for( i = snapshot_sprite_capacity; i < no_of_sprites; i++ )
+        {
+            snapshot_sprite_record[i] = -1;
+        }
+        snapshot_sprite_capacity = no_of_sprites;
+    }
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        generation = SPR_Get_Sprite_Generation( i );
+        if( i < snapshot_no_of_sprites && generation == snapshot_sprite_generation[i] )
+        {
+            continue;
+        }
+
+        Put_Snapshot_Sprite( i );
+
+        snapshot_sprite_generation[i] = generation;
+        changed = 1;
+    }
+
+    snapshot_no_of_sprites = no_of_sprites;
+
+    //======= ANIMATIONS =======//
+
+    for( i = no_of_animations; i < snapshot_no_of_animations; i++ )
+    {
+        UTI_EC_Free( snapshot_animation[i] );
+        snapshot_animation[i] = NULL;
+    }
+
+    if( no_of_animations > snapshot_animation_capacity )
+    {
+        snapshot_animation = UTI_EC_Realloc( snapshot_animation, sizeof( uint8_t * ) * no_of_animations );
+        snapshot_animation_generation = UTI_EC_Realloc( snapshot_animation_generation, sizeof( uint32_t ) * no_of_animations );
+        for( i = snapshot_animation_capacity; i < no_of_animations; i++ )
+        {
+            snapshot_animation[i] = NULL;
+        }
+        snapshot_animation_capacity = no_of_animations;
+    }
+
+    int32_t *frame_buffer = UTI_EC_Malloc( sizeof( int32_t ) * MAX_ANIMATION_FRAMES );
+    uint8_t *record = UTI_EC_Malloc( 8 + 4 * MAX_ANIMATION_FRAMES );
+    size_t size;
+
+    for( i = 0; i < no_of_animations; i++ )
+    {
+        generation = ANI_Get_Animation_Generation( i );
+        if( i < snapshot_no_of_animations && generation == snapshot_animation_generation[i] )
+        {
+            continue;
+        }
+
+        size = Encode_Animation( record, i, frame_buffer );
+        snapshot_animation[i] = UTI_EC_Realloc( snapshot_animation[i], size );
+        memcpy( snapshot_animation[i], record, size );
+
+        snapshot_animation_generation[i] = generation;
+        changed = 1;
+    }
+
+    UTI_EC_Free( record );
+    UTI_EC_Free( frame_buffer );
+
+    snapshot_no_of_animations = no_of_animations;
+
+    //======= PALETTES =======//
+
+    if( no_of_palettes > snapshot_palette_capacity )
+    {
+        snapshot_palette = UTI_EC_Realloc( snapshot_palette, sizeof( user_palette_type ) * no_of_palettes );
+        snapshot_palette_generation = UTI_EC_Realloc( snapshot_palette_generation, sizeof( uint32_t ) * no_of_palettes );
+        snapshot_palette_capacity = no_of_palettes;
+    }
+
+    const user_palette_type *palette = PAL_Get_Palettes();
+    for( i = 0; i < no_of_palettes; i++ )
+    {
+        generation = PAL_Get_Palette_Generation( i );
+        if( i < snapshot_no_of_palettes && generation == snapshot_palette_generation[i] )
+        {
+            continue;
+        }
+
+        snapshot_palette[i] = palette[i];
+
+        snapshot_palette_generation[i] = generation;
+        changed = 1;
+    }
+
+    snapshot_no_of_palettes = no_of_palettes;
+
+    return changed;
+}
+
+
+// frees the snapshot
+static void Free_Snapshot()
+{
+    int i;
+    for( i = 0; i < snapshot_no_of_animations; i++ )
+    {
+        UTI_EC_Free( snapshot_animation[i] );
+    }
+
+    UTI_EC_Free( snapshot_sprite_generation );
+    UTI_EC_Free( snapshot_sprite_record );
+    UTI_EC_Free( snapshot_record );
+    UTI_EC_Free( snapshot_definition );
+    UTI_EC_Free( snapshot_animation );
+    UTI_EC_Free( snapshot_animation_generation );
+    UTI_EC_Free( snapshot_palette );
+    UTI_EC_Free( snapshot_palette_generation );
+
+    snapshot_sprite_generation = NULL;
+    snapshot_sprite_record = NULL;
+    snapshot_no_of_sprites = 0;
+    snapshot_sprite_capacity = 0;
+    snapshot_record = NULL;
+    snapshot_no_of_records = 0;
+    snapshot_record_capacity = 0;
+    snapshot_storage = 0;
+    snapshot_definition = NULL;
+    snapshot_definition_capacity = 0;
+    snapshot_animation = NULL;
+    snapshot_animation_generation = NULL;
+    snapshot_no_of_animations = 0;
+    snapshot_animation_capacity = 0;
+    snapshot_palette = NULL;
+    snapshot_palette_generation = NULL;
+    snapshot_no_of_palettes = 0;
+    snapshot_palette_capacity = 0;
+
+    if( autosave_map != NULL )
+    {
+        munmap( autosave_map, autosave_map_size );
+    }
+
+    autosave_map = NULL;
+    autosave_map_size = 0;
+
+    return;
+}
+
+
+// writes out each snapshot it is given until told to quit. only this thread writes files while
+// autosave is running
+static void *Autosave_Thread( void *unused )
+{
+    file_chunk_type     chunk[4];
+    uint64_t            file_size;
+    double              latency;
+
+    (void)unused;
+
+    pthread_mutex_lock( &autosave_lock );
+
+    while( 1 )
+    {
+        while( autosave_pending == 0 && autosave_quit == 0 )
+        {
+            pthread_cond_wait( &autosave_wake, &autosave_lock );
+        }
+
+        if( autosave_pending == 0 )
+        {
+            break;
+        }
+
+        pthread_mutex_unlock( &autosave_lock );
+
+        int written = Write_Whole_File( autosave_filename, Write_Snapshot_Chunks, chunk, 4, &file_size );
+
+        pthread_mutex_lock( &autosave_lock );
+
+        if( written )
+        {
+            latency = Get_Time() - autosave_start;
+
+            no_of_autosaves++;
+            autosave_total_latency += latency;
+            if( autosave_pause > autosave_max_pause )
+            {
+                autosave_max_pause = autosave_pause;
+            }
+
+            if( options & FIL_OPTION_VERBOSE )
+            {
+                printf( "Autosaved %d sprites to %s, main thread paused %.2fms, saved after %.1fms\n",
+                        chunk[1].count, autosave_filename, autosave_pause, latency );
+            }
+        }
+
+        autosave_pending = 0;
+    }
+
+    pthread_mutex_unlock( &autosave_lock );
+
+    return NULL;
+}
+
+
+// starts saving what has changed to a file next to the working file every FIL_AUTOSAVE_INTERVAL
+// ms, call after FIL_Open_File(). an autosave left by a session that didn't exit is not written
+// over, autosave stays off until it has been dealt with
+void        FIL_Start_Autosave()
+{
+    char *name = UTI_EC_Malloc( strlen( filename ) + strlen( FIL_AUTOSAVE_SUFFIX ) + 1 );
+    sprintf( name, "%s%s", filename, FIL_AUTOSAVE_SUFFIX );
+
+    struct stat file_stat;
+    if( stat( name, &file_stat ) == 0 )
+    {
+        printf( "Found %s from a session that didn't exit, open it to get its work back. Autosave is off until it is removed\n", name );
+        UTI_EC_Free( name );
+        return;
+    }
+
+    autosave_filename = name;
+    autosave_pending = 0;
+    autosave_quit = 0;
+
+    // copying everything takes a while with a lot of sprites, better here than part way through
+    // editing. lazily loaded sprites are left in the file, only those that change are copied
+    if( ( options & FIL_OPTION_LAZY ) == 0 || Leave_Sprites_In_File() == 0 )
+    {
+        Update_Snapshot();
+    }
+
+    // the autosave thread unpacks with it
+    Make_Nibble_Pixels();
+
+    next_autosave = Get_Time() + FIL_AUTOSAVE_INTERVAL;
+
+    if( pthread_create( &autosave_thread, NULL, Autosave_Thread, NULL ) != 0 )
+    {
+        UTI_Print_Error( "Unable to start autosave" );
+        UTI_EC_Free( autosave_filename );
+        autosave_filename = NULL;
+    }
+
+    return;
+}
+
+
+// autosaves if it is due and there are unsaved changes, call from the main loop. the snapshot
+// is brought up to date here and written out by the autosave thread. returns the ms until the
+// next one is due, -1 if autosave is off
+int         FIL_Autosave()
+{
+    if( autosave_filename == NULL )
+    {
+        return -1;
+    }
+
+    double now = Get_Time();
+    if( now < next_autosave )
+    {
+        return (int)( next_autosave - now ) + 1;
+    }
+
+    pthread_mutex_lock( &autosave_lock );
+    int pending = autosave_pending;
+    pthread_mutex_unlock( &autosave_lock );
+
+    if( pending )
+    {
+        next_autosave = now + FIL_AUTOSAVE_RETRY;
+        return FIL_AUTOSAVE_RETRY;
+    }
+
+    next_autosave = now + FIL_AUTOSAVE_INTERVAL;
+
+    // nothing to do if the working file is up to date
+    int no_of_sprites, no_of_animations, no_of_palettes;
+    SPR_Get_Changed_Sprites( &no_of_sprites );
+    ANI_Get_Changed_Animations( &no_of_animations );
+    PAL_Get_Changed_Palettes( &no_of_palettes );
+
+    if( no_of_sprites == 0 && no_of_animations == 0 && no_of_palettes == 0 &&
+        SPR_Get_Number_Of_Sprites() == saved_no_of_sprites &&
+        ANI_Get_Number_Of_Animations() == saved_no_of_animations &&
+        PAL_Get_Number_Of_Palettes() == saved_no_of_palettes )
+    {
+        return FIL_AUTOSAVE_INTERVAL;
+    }
+
+    if( Update_Snapshot() )
+    {
+        pthread_mutex_lock( &autosave_lock );
+        autosave_start = now;
+        autosave_pause = Get_Time() - now;
+        autosave_pending = 1;
+        pthread_cond_signal( &autosave_wake );
+        pthread_mutex_unlock( &autosave_lock );
+    }
+
+    return FIL_AUTOSAVE_INTERVAL;
+}
+
+
+// waits for the autosave being written to finish and stops autosaving, call before
+// FIL_Write_File(). prints how long autosaves took
+void        FIL_Stop_Autosave()
+{
+    if( autosave_filename == NULL )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &autosave_lock );
+    autosave_quit = 1;
+    pthread_cond_signal( &autosave_wake );
+    pthread_mutex_unlock( &autosave_lock );
+
+    pthread_join( autosave_thread, NULL );
+
+    if( no_of_autosaves > 0 && ( options & FIL_OPTION_VERBOSE ) )
+    {
+        printf( "Autosaved %d times, longest main thread pause %.2fms, average %.1fms to save\n",
+                no_of_autosaves, autosave_max_pause, autosave_total_latency / no_of_autosaves );
+    }
+
+    Free_Snapshot();
+
+    return;
+}
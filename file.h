@@ -18,6 +18,70 @@
 
 #define     SIGNATURE               "SPRT"
 
+// version 2 files are little endian throughout and laid out as
+//
+//      header          FIL_HEADER_SIZE bytes, see file_header_v2_type
+//      chunks          anywhere after the header, each one FIL_CHUNK_ALIGN aligned
+//      directory       no_of_chunks entries of FIL_CHUNK_ENTRY_SIZE bytes, see file_chunk_type
+//
+// a v1 file keeps its sprite count straight after the signature, a v2 file puts FIL_V2_MARKER
+// there, which no v1 count can be. chunks of the same type hold ranges of items starting at
+// first_index, when ranges overlap the later chunk in the directory wins
+#define     FIL_VERSION             2
+#define     FIL_V2_MARKER           0xffffffff
+#define     FIL_HEADER_SIZE         32
+#define     FIL_CHUNK_ENTRY_SIZE    40
+#define     FIL_CHUNK_ALIGN         64          // chunk data starts on a multiple of this
+
+// chunk types, four characters read as a little endian uint32
+#define     FIL_FOURCC( a, b, c, d )    ( (uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24 )
+
+#define     FIL_CHUNK_META          FIL_FOURCC( 'M', 'E', 'T', 'A' )    // item counts and sprite size
+#define     FIL_CHUNK_SPRITES       FIL_FOURCC( 'S', 'P', 'R', 'S' )    // FIL_SPRITE_RECORD_SIZE per sprite
+#define     FIL_CHUNK_ANIMATIONS    FIL_FOURCC( 'A', 'N', 'I', 'M' )    // frame count, wait, frames per animation
+#define     FIL_CHUNK_PALETTES      FIL_FOURCC( 'P', 'A', 'L', 'S' )    // PAL_USER_SIZE bytes per palette
+#define     FIL_CHUNK_DEFINITIONS   FIL_FOURCC( 'D', 'E', 'F', 'S' )    // SPRITE_SIZE per shared definition
+
+// a sprite record is its definition followed by a uint32 palette index, the same as sprite_type
+#define     FIL_SPRITE_RECORD_SIZE  ( SPRITE_SIZE + 4 )
+#define     FIL_META_SIZE           24
+
+// a shared sprite record is the index of its definition in the DEFS chunks then its palette
+// index, both uint32
+#define     FIL_SHARED_RECORD_SIZE  8
+
+// chunk flags
+#define     FIL_CHUNK_PACKED        0x01        // SPRS or DEFS records are packed, see below
+#define     FIL_CHUNK_SHARED        0x02        // SPRS records are FIL_SHARED_RECORD_SIZE
+
+// a packed sprite chunk starts with a table of uint32 offsets from the start of the chunk, one
+// for each block of FIL_PACK_BLOCK sprites and one for the end, followed by the blocks. each
+// sprite in a block is a mode byte, its palette index 7 bits a byte low first with the top bit
+// set on all but the last, then
+//
+//      FIL_PACK_RAW        SPRITE_SIZE bytes as they are
+//      FIL_PACK_NIBBLES    pixels two to a byte, first in the low nibble, run length coded. a
+//                          control byte below 128 is followed by that many plus one bytes, from
+//                          128 up the one byte after it repeats control - 125 times
+//
+// a packed DEFS chunk is laid out the same, with each definition's palette index 0
+#define     FIL_PACK_BLOCK          64
+#define     FIL_PACK_RAW            0
+#define     FIL_PACK_NIBBLES        1
+
+// command line options
+#define     FIL_OPTION_BENCHMARK    0x01        // time the drawing code and quit
+#define     FIL_OPTION_LAZY         0x02        // fill in sprites from the file as they are used
+#define     FIL_OPTION_COMPRESS     0x04        // write sprites packed
+#define     FIL_OPTION_NIBBLES      0x08        // hold sprites packed in memory, see SPR_Pack_Storage()
+#define     FIL_OPTION_SHARE        0x10        // share identical sprites, see SPR_Share_Storage()
+#define     FIL_OPTION_VERBOSE      0x20        // print timings as the editor runs
+
+// what FIL_Open_File() found
+#define     FIL_OPEN_FAILED         -1          // the file is there but couldn't be loaded
+#define     FIL_OPEN_MISSING        0           // there is no file yet
+#define     FIL_OPEN_OK             1
+
 //===================================================================
 //  TYPES
 //===================================================================
@@ -32,6 +96,32 @@ struct      file_header_s { char           signature[4];
 
 typedef     struct file_header_s file_header_type;
 
+// version 2 header, each field is stored little endian at the offset given
+struct      file_header_v2_s {  char           signature[4];           //  0 "SPRT"
+                                uint32_t       marker;                 //  4 FIL_V2_MARKER
+                                uint16_t       version;                //  8 FIL_VERSION
+                                uint16_t       header_size;            // 10 FIL_HEADER_SIZE
+                                uint32_t       no_of_chunks;           // 12
+                                uint64_t       directory_offset;       // 16
+                                uint32_t       directory_checksum;     // 24 CRC-32 of the directory
+                                uint32_t       flags;                  // 28 unused, 0
+                             };
+
+typedef     struct file_header_v2_s file_header_v2_type;
+
+// one chunk directory entry, each field is stored little endian at the offset given
+struct      file_chunk_s {  uint32_t       type;                   //  0 FIL_CHUNK_
+                            uint32_t       flags;                  //  4 FIL_CHUNK_ flags, see above
+                            uint64_t       offset;                 //  8 from the start of the file
+                            uint64_t       size;                   // 16 bytes of data
+                            uint32_t       count;                  // 24 items in the chunk
+                            uint32_t       first_index;            // 28 index of the first item
+                            uint32_t       checksum;               // 32 CRC-32 of the data
+                            uint32_t       reserved;               // 36 0
+                         };
+
+typedef     struct file_chunk_s file_chunk_type;
+
 
 //===================================================================
 //  PROTOTYPES
@@ -40,12 +130,42 @@ typedef     struct file_header_s file_header_type;
 // check user args
 void        FIL_Parse_Arguments( int argc, char *argv[] );
 
-// attempt to open a file, name given through FIL_Parse_Arguments, return 1 on success
+// sets the FIL_OPTION_ flag for one command line option, returns 0 if it isn't one
+int         FIL_Parse_Option( const char *option );
+
+// returns the FIL_OPTION_ flags given on the command line
+int         FIL_Get_Options();
+
+// makes name the working file, for opening and saving more than one file in a run. name must
+// stay valid until FIL_Free()
+void        FIL_Set_Filename( char *name );
+
+// attempt to open a file, name given through FIL_Parse_Arguments, returns FIL_OPEN_OK on success,
+// FIL_OPEN_MISSING if there is no such file and FIL_OPEN_FAILED if it couldn't be loaded. a file
+// that failed must not be written over, it may still be recoverable. version 1 and 2 files are read, the file stays mapped in memory until FIL_Free(). with FIL_OPTION_LAZY
+// sprites are filled in from it as they are first used. a file with shared sprites sets
+// FIL_OPTION_SHARE so it stays shared
 int         FIL_Open_File();
 
-// write data to file, filename given by user cmd line args. return 1 on success
+// releases the memory mapped file, call after SPR_Free()
+void        FIL_Free();
+
+// write data to file as version 2, filename given by user cmd line args. only what has changed
+// is added to the end of a v2 file, unless it has got too far out of date. otherwise it is written
+// to a temporary file and renamed over the working file. return 1 on success
 int         FIL_Write_File();
 
+// starts autosaving to a file next to the working file on a thread of its own, call after
+// FIL_Open_File()
+void        FIL_Start_Autosave();
+
+// autosaves if it is due, call from the main loop. returns the ms until the next one is due,
+// or -1 if autosave is off
+int         FIL_Autosave();
+
+// waits for any autosave being written and stops autosaving, call before FIL_Write_File()
+void        FIL_Stop_Autosave();
+
 
 
 #endif // __file_h__
@@ -1,15 +1,15 @@
 /*
-    graphics.h
-    a software graphics library using 2 banks of screen memory for double buffering.
-    all drawing is done to raw memory which are then transferred to a SDL_Surface of the same
-    res, which is then upscaled to another SDL_Surface to allow any window size to show any
-    lower resolution - ie a 320x200 resolution in a 1024x640 window.
+    graphics.c
+    a software graphics library. all drawing is done straight into the pixel memory of an
+    SDL_Surface of the render resolution, which is then upscaled to the window surface to allow
+    any window size to show any lower resolution - ie a 320x200 resolution in a 1024x640 window.
 
     made for use with my texture and palette definitions to give an old fashioned look
 */
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <SDL2/SDL.h>
 
@@ -33,8 +33,10 @@ static SDL_Surface          *scr_render         = NULL;         // render surfac
 
 static SDL_Rect             scr_rect           = { 0, 0, 0, 0 };
 
-static uint32_t             *w_buffer           = NULL;         // buffer to write to
-static uint32_t             *r_buffer           = NULL;         // buffer to display (read from)
+static int                  quit_requested      = 0;            // set by window close or escape
+static int                  function_key        = 0;            // last watched F key pressed, 0 once read
+
+static uint32_t             *w_buffer           = NULL;         // buffer to write to (scr_render pixels)
 
 static int                  scr_width           = 0;            // window dimensions
 static int                  scr_height          = 0;            
@@ -47,8 +49,51 @@ static int                  res_height          = 0;
 static float                pixel_ratio_x       = 0.0f;         // scr_width  / res_width (for mouse position)
 static float                pixel_ratio_y       = 0.0f;         // scr_height / res_height
 
-// double buffer to write to
-static scr_buffer_type      scr_buffer          = { 0, 0, NULL, NULL };
+// write buffer, points at the pixel memory of scr_render
+static scr_buffer_type      scr_buffer          = { 0, 0, 0, NULL };
+
+// frame timing, measured with the SDL performance counter
+static uint64_t             frame_last_refresh  = 0;            // counter value at last refresh
+static float                frame_time          = 0.0f;         // ms between the last two refreshes
+static float                present_time        = 0.0f;         // ms spent presenting the last frame
+
+//====================
+//  DAMAGE TRACKING
+//====================
+
+// the render surface is split into tiles, drawing marks the tiles it touches and only those
+// tiles are scaled to the window and updated when the window is refreshed
+#define DIRTY_TILE_SIZE         32              // width and height of a tile in pixels
+
+static uint8_t              *dirty_tiles        = NULL;         // 1 for every tile drawn to
+static int                  dirty_cols          = 0;            // tiles per row
+static int                  dirty_rows          = 0;
+static int                  dirty_tile_count    = 0;            // number of tiles marked
+
+static SDL_Rect             *dirty_src          = NULL;         // merged rects, render resolution
+static SDL_Rect             *dirty_dst          = NULL;         // merged rects, window resolution
+
+//====================
+//  PIXEL KERNELS
+//====================
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#   define GRA_X86_KERNELS
+#   include <immintrin.h>
+#endif
+
+// a set of span functions, dst and src need no particular alignment
+struct gra_kernels_s    {
+                            const char      *name;
+
+                            void            (*fill)( uint32_t *dst, int count, uint32_t color );
+                            void            (*copy)( uint32_t *dst, const uint32_t *src, int count );
+                            void            (*copy_keyed)( uint32_t *dst, const uint32_t *src, int count, uint32_t key );
+                            void            (*expand)( uint32_t *dst, const uint8_t *src, const uint32_t *table, int count );
+                        };
+typedef struct gra_kernels_s gra_kernels_type;
+
+static gra_kernels_type     *kernels            = NULL;         // set by Init_Kernels()
 
 static uint32_t             *palette            = NULL;
 
@@ -66,25 +111,443 @@ int                 NO_OF_TEXTURES = 0;
 // font data is loaded here
 static uint8_t             *font_buffer        = NULL;
 
+//===========================
+//  BUTTONS AND SWITCHES
+//===========================
+
+// each is only drawn again when it changes or something else is drawn over it
+static scr_button_type         *buttons[MAX_BUTTONS];
+static int                      button_p = 0;
+
+static scr_switch_type         *switches[MAX_SWITCHES];
+static int                      switch_p = 0;
+
 //===============================================================
 //  PRIVATE FUNCTIONS
 //===============================================================
 
 // All int returning functions return 1 on success or 0 on failure unless otherwise stated
 
-// draws the w_buffer to the render surface
-void Draw_Buffer()
+// marks the buttons and switches that overlap x1, y1 to x2, y2 inclusive to be drawn again, for
+// when that area is drawn over
+static void Undraw_Controls( int x1, int y1, int x2, int y2 )
+{
+    int i;
+
+    for( i = 0; i < button_p; i++ )
+    {
+        if( x1 <= buttons[i]->x + buttons[i]->width && x2 >= buttons[i]->x &&
+            y1 <= buttons[i]->y + buttons[i]->height && y2 >= buttons[i]->y )
+        {
+            buttons[i]->drawn = 0;
+        }
+    }
+
+    for( i = 0; i < switch_p; i++ )
+    {
+        if( x1 <= switches[i]->x + switches[i]->width && x2 >= switches[i]->x &&
+            y1 <= switches[i]->y + switches[i]->height && y2 >= switches[i]->y )
+        {
+            switches[i]->drawn = 0;
+        }
+    }
+
+    return;
+}
+
+
+// locks the render surface if SDL requires it and points the write buffer at its pixels,
+// SDL may move the pixel data while the surface is unlocked so this is redone after every blit
+static int Lock_Render_Surface()
+{
+    if( SDL_MUSTLOCK( scr_render ) && SDL_LockSurface( scr_render ) != 0 )
+    {
+        UTI_Print_Error( "Unable to lock render surface" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    scr_buffer.pixels = scr_render->pixels;
+    w_buffer = scr_buffer.pixels;
+
+    return 1;
+}
+
+
+// releases the render surface so it can be blitted to the window
+static void Unlock_Render_Surface()
+{
+    if( SDL_MUSTLOCK( scr_render ) )
+    {
+        SDL_UnlockSurface( scr_render );
+    }
+
+    return;
+}
+
+
+// marks the tiles covered by the given area as needing to be presented, the area is clipped
+// to the render surface
+static void Mark_Dirty( int x, int y, int w, int h )
+{
+    if( x < 0 )
+    {
+        w += x;
+        x = 0;
+    }
+
+    if( y < 0 )
+    {
+        h += y;
+        y = 0;
+    }
+
+    if( x + w > res_width )     w = res_width - x;
+    if( y + h > res_height )    h = res_height - y;
+
+    if( w <= 0 || h <= 0 )
+    {
+        return;
+    }
+
+    int tx, ty;
+    int tx1 = ( x + w - 1 ) / DIRTY_TILE_SIZE;
+    int ty1 = ( y + h - 1 ) / DIRTY_TILE_SIZE;
+
+    for( ty = y / DIRTY_TILE_SIZE; ty <= ty1; ty++ )
+    {
+        uint8_t *tile = &dirty_tiles[ty * dirty_cols];
+
+        for( tx = x / DIRTY_TILE_SIZE; tx <= tx1; tx++ )
+        {
+            if( tile[tx] == 0 )
+            {
+                tile[tx] = 1;
+                dirty_tile_count++;
+            }
+        }
+    }
+
+    return;
+}
+
+
+// turns the marked tiles into a list of rects, runs of tiles on a row are joined and then
+// joined to a rect of the same width directly above. clears the marks, returns no of rects
+static int Build_Dirty_Rects()
+{
+    int n = 0;
+    int tx, ty, start, k;
+
+    for( ty = 0; ty < dirty_rows; ty++ )
+    {
+        uint8_t *tile = &dirty_tiles[ty * dirty_cols];
+
+        tx = 0;
+        while( tx < dirty_cols )
+        {
+            if( tile[tx] == 0 )
+            {
+                tx++;
+                continue;
+            }
+
+            start = tx;
+            while( tx < dirty_cols && tile[tx] )
+            {
+                tile[tx++] = 0;
+            }
+
+            SDL_Rect run = { start * DIRTY_TILE_SIZE, ty * DIRTY_TILE_SIZE,
+                             ( tx - start ) * DIRTY_TILE_SIZE, DIRTY_TILE_SIZE };
+
+            // try to extend a rect from the row above
+            for( k = 0; k < n; k++ )
+            {
+                if( dirty_src[k].x == run.x && dirty_src[k].w == run.w &&
+                    dirty_src[k].y + dirty_src[k].h == run.y )
+                {
+                    dirty_src[k].h += run.h;
+                    break;
+                }
+            }
+
+            if( k == n )
+            {
+                dirty_src[n++] = run;
+            }
+        }
+    }
+
+    // clip to the render surface and scale to the window
+    for( k = 0; k < n; k++ )
+    {
+        if( dirty_src[k].x + dirty_src[k].w > res_width )   dirty_src[k].w = res_width - dirty_src[k].x;
+        if( dirty_src[k].y + dirty_src[k].h > res_height )  dirty_src[k].h = res_height - dirty_src[k].y;
+
+        dirty_dst[k].x = dirty_src[k].x * scr_width  / res_width;
+        dirty_dst[k].y = dirty_src[k].y * scr_height / res_height;
+        dirty_dst[k].w = ( dirty_src[k].x + dirty_src[k].w ) * scr_width  / res_width  - dirty_dst[k].x;
+        dirty_dst[k].h = ( dirty_src[k].y + dirty_src[k].h ) * scr_height / res_height - dirty_dst[k].y;
+    }
+
+    dirty_tile_count = 0;
+
+    return n;
+}
+
+
+// writes a pixel without marking it as dirty, callers mark the whole area they draw to
+static void Put_Pixel( int x, int y, uint32_t color )
+{
+    if( x < 0 || x >= res_width || y < 0 || y >= res_height )
+    {
+        return;
+    }
+
+    w_buffer[y*res_width + x] = color;
+
+    return;
+}
+
+
+//====================
+//  PIXEL KERNELS
+//====================
+
+// the inner loops of all drawing, fill/copy/colour keyed copy of a run of pixels and expanding
+// indexed pixels through a 256 colour table. there are scalar, SSE2 and AVX2 versions, the best
+// one the cpu supports is chosen by Init_Kernels()
+
+static void Fill_Scalar( uint32_t *dst, int count, uint32_t color )
+{
+    // colours with all 4 bytes the same (black, white) can be set bytewise
+    if( ( color & 0xff ) * 0x01010101 == color )
+    {
+        memset( dst, color & 0xff, count * sizeof( uint32_t ) );
+        return;
+    }
+
+    while( count >= 4 )
+    {
+        dst[0] = color;
+        dst[1] = color;
+        dst[2] = color;
+        dst[3] = color;
+
+        dst += 4;
+        count -= 4;
+    }
+
+    while( count-- > 0 )
+    {
+        *dst++ = color;
+    }
+
+    return;
+}
+
+static void Copy_Scalar( uint32_t *dst, const uint32_t *src, int count )
+{
+    while( count-- > 0 )
+    {
+        *dst++ = *src++;
+    }
+
+    return;
+}
+
+static void Copy_Keyed_Scalar( uint32_t *dst, const uint32_t *src, int count, uint32_t key )
+{
+    for( ; count > 0; count--, dst++, src++ )
+    {
+        if( *src != key )
+        {
+            *dst = *src;
+        }
+    }
+
+    return;
+}
+
+// table must have an entry for every possible byte value
+static void Expand_Scalar( uint32_t *dst, const uint8_t *src, const uint32_t *table, int count )
+{
+    while( count >= 4 )
+    {
+        dst[0] = table[src[0]];
+        dst[1] = table[src[1]];
+        dst[2] = table[src[2]];
+        dst[3] = table[src[3]];
+
+        dst += 4;
+        src += 4;
+        count -= 4;
+    }
+
+    while( count-- > 0 )
+    {
+        *dst++ = table[*src++];
+    }
+
+    return;
+}
+
+#ifdef GRA_X86_KERNELS
+
+__attribute__(( target( "sse2" ) ))
+static void Fill_SSE2( uint32_t *dst, int count, uint32_t color )
+{
+    __m128i c = _mm_set1_epi32( color );
+
+    for( ; count >= 4; count -= 4, dst += 4 )
+    {
+        _mm_storeu_si128( (__m128i *)dst, c );
+    }
+
+    Fill_Scalar( dst, count, color );
+
+    return;
+}
+
+__attribute__(( target( "sse2" ) ))
+static void Copy_SSE2( uint32_t *dst, const uint32_t *src, int count )
+{
+    for( ; count >= 4; count -= 4, dst += 4, src += 4 )
+    {
+        _mm_storeu_si128( (__m128i *)dst, _mm_loadu_si128( (const __m128i *)src ) );
+    }
+
+    Copy_Scalar( dst, src, count );
+
+    return;
+}
+
+__attribute__(( target( "sse2" ) ))
+static void Copy_Keyed_SSE2( uint32_t *dst, const uint32_t *src, int count, uint32_t key )
+{
+    __m128i k = _mm_set1_epi32( key );
+
+    for( ; count >= 4; count -= 4, dst += 4, src += 4 )
+    {
+        __m128i s = _mm_loadu_si128( (const __m128i *)src );
+        __m128i d = _mm_loadu_si128( (const __m128i *)dst );
+        __m128i m = _mm_cmpeq_epi32( s, k );        // set where the destination is kept
+
+        _mm_storeu_si128( (__m128i *)dst, _mm_or_si128( _mm_and_si128( m, d ), _mm_andnot_si128( m, s ) ) );
+    }
+
+    Copy_Keyed_Scalar( dst, src, count, key );
+
+    return;
+}
+
+__attribute__(( target( "avx2" ) ))
+static void Fill_AVX2( uint32_t *dst, int count, uint32_t color )
+{
+    __m256i c = _mm256_set1_epi32( color );
+
+    for( ; count >= 8; count -= 8, dst += 8 )
+    {
+        _mm256_storeu_si256( (__m256i *)dst, c );
+    }
+
+    Fill_Scalar( dst, count, color );
+
+    return;
+}
+
+__attribute__(( target( "avx2" ) ))
+static void Copy_AVX2( uint32_t *dst, const uint32_t *src, int count )
+{
+    for( ; count >= 8; count -= 8, dst += 8, src += 8 )
+    {
+        _mm256_storeu_si256( (__m256i *)dst, _mm256_loadu_si256( (const __m256i *)src ) );
+    }
+
+    Copy_Scalar( dst, src, count );
+
+    return;
+}
+
+__attribute__(( target( "avx2" ) ))
+static void Copy_Keyed_AVX2( uint32_t *dst, const uint32_t *src, int count, uint32_t key )
 {
-    uint32_t *bufp;
-    bufp = scr_render->pixels;              // get pointer to surface pixel data
-    int x, y;
+    __m256i k = _mm256_set1_epi32( key );
+
+    for( ; count >= 8; count -= 8, dst += 8, src += 8 )
+    {
+        __m256i s = _mm256_loadu_si256( (const __m256i *)src );
+        __m256i d = _mm256_loadu_si256( (const __m256i *)dst );
+
+        _mm256_storeu_si256( (__m256i *)dst, _mm256_blendv_epi8( s, d, _mm256_cmpeq_epi32( s, k ) ) );
+    }
+
+    Copy_Keyed_Scalar( dst, src, count, key );
+
+    return;
+}
+
+__attribute__(( target( "avx2" ) ))
+static void Expand_AVX2( uint32_t *dst, const uint8_t *src, const uint32_t *table, int count )
+{
+    for( ; count >= 8; count -= 8, dst += 8, src += 8 )
+    {
+        // widen 8 indices to 32 bits and look them all up at once
+        __m256i index = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i *)src ) );
+
+        _mm256_storeu_si256( (__m256i *)dst, _mm256_i32gather_epi32( (const int *)table, index, 4 ) );
+    }
+
+    Expand_Scalar( dst, src, table, count );
+
+    return;
+}
+
+#endif  // GRA_X86_KERNELS
+
+static gra_kernels_type     kernel_list[]       = {
+#ifdef GRA_X86_KERNELS
+                                                    { "avx2",   Fill_AVX2,   Copy_AVX2,   Copy_Keyed_AVX2,   Expand_AVX2   },
+                                                    { "sse2",   Fill_SSE2,   Copy_SSE2,   Copy_Keyed_SSE2,   Expand_Scalar },
+#endif
+                                                    { "scalar", Fill_Scalar, Copy_Scalar, Copy_Keyed_Scalar, Expand_Scalar }
+                                                  };
+
+#define NO_OF_KERNELS           ( (int)( sizeof( kernel_list ) / sizeof( kernel_list[0] ) ) )
+
+
+// returns 1 if the cpu can run the given set of kernels
+static int Kernels_Supported( gra_kernels_type *k )
+{
+#ifdef GRA_X86_KERNELS
+    __builtin_cpu_init();
+
+    if( strcmp( k->name, "avx2" ) == 0 )
+    {
+        return __builtin_cpu_supports( "avx2" );
+    }
+
+    if( strcmp( k->name, "sse2" ) == 0 )
+    {
+        return __builtin_cpu_supports( "sse2" );
+    }
+#endif
+
+    return 1;
+}
+
 
-    for( y = 0; y < scr_render->h; y++ )
+// picks the fastest kernels the cpu supports, the list is in order of preference
+static void Init_Kernels()
+{
+    int i;
+    for( i = 0; i < NO_OF_KERNELS; i++ )
     {
-        for( x = 0; x < scr_render->w; x++ )
+        if( Kernels_Supported( &kernel_list[i] ) )
         {
-            *bufp = w_buffer[y * scr_render->w + x];
-            bufp++;
+            kernels = &kernel_list[i];
+            break;
         }
     }
 
@@ -92,18 +555,50 @@ void Draw_Buffer()
 }
 
 
-// swaps the pointers to w_buffer and r_buffer
-void Swap_Buffer()
+// writes count pixels of color starting at dst, no bounds checking
+static void Fill_Span( uint32_t *dst, int count, uint32_t color )
+{
+    kernels->fill( dst, count, color );
+
+    return;
+}
+
+
+// fills the area from (x1, y1) to (x2, y2) inclusive one row at a time, clipped to the screen
+static void Fill_Area( int x1, int y1, int x2, int y2, uint32_t color )
 {
-    uint32_t *temp;
-    temp = w_buffer;
-    w_buffer = r_buffer;
-    r_buffer = temp;
+    if( x1 < 0 )                x1 = 0;
+    if( y1 < 0 )                y1 = 0;
+    if( x2 > res_width-1 )      x2 = res_width-1;
+    if( y2 > res_height-1 )     y2 = res_height-1;
+
+    if( x1 > x2 || y1 > y2 )
+    {
+        return;
+    }
+
+    Mark_Dirty( x1, y1, x2 - x1 + 1, y2 - y1 + 1 );
+
+    uint32_t *row = &w_buffer[y1*res_width + x1];
+    int w = x2 - x1 + 1;
+
+    for( ; y1 <= y2; y1++ )
+    {
+        Fill_Span( row, w, color );
+        row += res_width;
+    }
 
     return;
 }
 
 
+// returns the time in milliseconds between two performance counter values
+static float Counter_To_Ms( uint64_t start, uint64_t end )
+{
+    return (float)( (double)( end - start ) * 1000.0 / (double)SDL_GetPerformanceFrequency() );
+}
+
+
 
 //===============================================================
 //  FUNCTION BODIES
@@ -115,12 +610,14 @@ void Swap_Buffer()
 //  INITIALIZATION
 //=======================
 
-// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
-// writing to and initializes 2 SDL_Surfaces - one w_res x h_res which is stretched onto the
-// second which is width x height, which is rendered to the window.
+// starts SDL Video and opens a window. Also initializes 2 SDL_Surfaces - one w_res x h_res which
+// is drawn to directly and stretched onto the second which is width x height, which is rendered
+// to the window.
 int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res )
 {
  
+    Init_Kernels();
+
     // initialize SDL
     if( SDL_Init( SDL_INIT_VIDEO ) != 0 )
     {
@@ -177,15 +674,37 @@ int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res
     scr_rect.w = width;
     scr_rect.h = height;
 
-    // create double buffer
+    // drawing code addresses the buffer as y * res_width + x, so rows must not be padded
+    if( scr_render->pitch != (int)sizeof( uint32_t ) * w_res )
+    {
+        UTI_Print_Error( "Render surface pitch does not match render width" );
+        return 0;
+    }
+
+    // draw straight into the render surface, there is no separate buffer to copy from
     scr_buffer.w = w_res;
     scr_buffer.h = h_res;
-    scr_buffer.buffer1 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
-    scr_buffer.buffer2 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
+    scr_buffer.pitch = scr_render->pitch / sizeof( uint32_t );
 
-    // set write and read buffer pointers
-    w_buffer = scr_buffer.buffer1;
-    r_buffer = scr_buffer.buffer2;
+    if( Lock_Render_Surface() == 0 )
+    {
+        return 0;
+    }
+
+    // set up damage tracking, the whole window needs to be shown on the first refresh
+    dirty_cols = ( w_res + DIRTY_TILE_SIZE - 1 ) / DIRTY_TILE_SIZE;
+    dirty_rows = ( h_res + DIRTY_TILE_SIZE - 1 ) / DIRTY_TILE_SIZE;
+
+    dirty_tiles = UTI_EC_Malloc( dirty_cols * dirty_rows );
+    dirty_src   = UTI_EC_Malloc( sizeof( SDL_Rect ) * dirty_cols * dirty_rows );
+    dirty_dst   = UTI_EC_Malloc( sizeof( SDL_Rect ) * dirty_cols * dirty_rows );
+
+    memset( dirty_tiles, 0, dirty_cols * dirty_rows );
+    dirty_tile_count = 0;
+
+    Mark_Dirty( 0, 0, res_width, res_height );
+
+    frame_last_refresh = SDL_GetPerformanceCounter();
 
 
     return 1;
@@ -199,15 +718,23 @@ void GRA_Close()
     SDL_DestroyWindow( scr_window );
     scr_window = NULL;
 
+    // write buffer belongs to the render surface
+    Unlock_Render_Surface();
+    scr_buffer.pixels = NULL;
+    w_buffer = NULL;
+
     SDL_FreeSurface( scr_render );
     scr_render = NULL;
 
-    // free screen buffers
-    UTI_EC_Free( scr_buffer.buffer1 );
-    scr_buffer.buffer1 = NULL;
+    // free damage tracking
+    UTI_EC_Free( dirty_tiles );
+    dirty_tiles = NULL;
 
-    UTI_EC_Free( scr_buffer.buffer2 );
-    scr_buffer.buffer2 = NULL;
+    UTI_EC_Free( dirty_src );
+    dirty_src = NULL;
+
+    UTI_EC_Free( dirty_dst );
+    dirty_dst = NULL;
 
     // free font data
     UTI_EC_Free( font_buffer );
@@ -230,6 +757,44 @@ void GRA_Delay( int milli )
     return;
 }
 
+// handles a single event from the SDL queue
+static void Handle_Event( SDL_Event *e )
+{
+    // check for user closing window
+    if( e->type == SDL_QUIT )
+    {
+        quit_requested = 1;
+    }
+    else if( e->type == SDL_KEYDOWN )
+    {
+        // check for user pressing escape or a watched function key
+        switch( e->key.keysym.sym )
+        {
+            case SDLK_ESCAPE:
+                quit_requested = 1;
+                break;
+
+            case SDLK_F3:
+                function_key = 3;
+                break;
+
+            case SDLK_F4:
+                function_key = 4;
+                break;
+
+            default:
+                break;
+        }
+    }
+    else if( e->type == SDL_WINDOWEVENT )
+    {
+        // window may have been covered or restored, show all of it again
+        GRA_Invalidate_Window();
+    }
+
+    return;
+}
+
 // check if user quits, by clicking window 'x' or pressed escape
 int GRA_Check_Quit()
 {
@@ -237,24 +802,48 @@ int GRA_Check_Quit()
 
     while( SDL_PollEvent( &e ) != 0 )
     {
-        // check for user closing window
-        if( e.type == SDL_QUIT )
-        {
-            return 0;
-        }
-        else if( e.type == SDL_KEYDOWN )
-        {
-            // check for user pressing escape
-            switch( e.key.keysym.sym )
-            {
-                case SDLK_ESCAPE:
-                    return 0;
-                    break;
+        Handle_Event( &e );
+    }
 
-                default:
-                    break;
-            }
-        }
+    return ( quit_requested ) ? 0 : 1;
+}
+
+// returns the number of the function key pressed since the last call, only F3 and F4 are
+// watched, 0 if neither was
+int GRA_Get_Function_Key()
+{
+    int key = function_key;
+    function_key = 0;
+
+    return key;
+}
+
+// sleeps until an event arrives or timeout milliseconds pass, a negative timeout waits forever.
+// handles everything in the queue, returns 1 if there were any events
+int GRA_Wait_For_Event( int timeout )
+{
+    SDL_Event e;
+    int got_event;
+
+    if( timeout < 0 )
+    {
+        got_event = SDL_WaitEvent( &e );
+    }
+    else
+    {
+        got_event = SDL_WaitEventTimeout( &e, timeout );
+    }
+
+    if( got_event == 0 )
+    {
+        return 0;
+    }
+
+    Handle_Event( &e );
+
+    while( SDL_PollEvent( &e ) != 0 )
+    {
+        Handle_Event( &e );
     }
 
     return 1;
@@ -275,13 +864,10 @@ int GRA_GetTicks()
 // clears the current buffer for writing
 void GRA_Clear_Screen()
 {
-    int i;
-    for( i = 0; i < res_width * res_height; i++ )
-    {
-        w_buffer[i] = 0;        // black
-    }
+    Fill_Span( w_buffer, res_width * res_height, 0 );      // black
 
-    SDL_FillRect( scr_surface, NULL, 0x00000000 );
+    Mark_Dirty( 0, 0, res_width, res_height );
+    Undraw_Controls( 0, 0, res_width, res_height );
     
     return;
 }
@@ -289,32 +875,82 @@ void GRA_Clear_Screen()
 // fill screen with color
 void GRA_Fill_Screen( uint32_t color )
 {
-    int i;
-    for( i = 0; i < res_width * res_height; i++ )
-    {
-        w_buffer[i] = color;
-    }
+    Fill_Span( w_buffer, res_width * res_height, color );
+
+    Mark_Dirty( 0, 0, res_width, res_height );
+    Undraw_Controls( 0, 0, res_width, res_height );
 
     return;
 }
 
 
+// clears a w x h area of the current buffer to black
+void GRA_Clear_Rectangle( int x, int y, int w, int h )
+{
+    Fill_Area( x, y, x + w - 1, y + h - 1, 0 );
+    Undraw_Controls( x, y, x + w - 1, y + h - 1 );
 
-// writes the current active buffer to the render_surface and displays it, then
-// switches buffers for the next write
+    return;
+}
+
+
+// marks the whole screen to be shown on the next refresh, for when the window contents are lost
+void GRA_Invalidate_Window()
+{
+    Mark_Dirty( 0, 0, res_width, res_height );
+
+    return;
+}
+
+
+
+// scales the parts of the render surface drawn to since the last refresh onto the window surface
+// and displays them, the write buffer is the render surface itself so nothing is copied beforehand
 void GRA_Refresh_Window()
 {
-    Draw_Buffer();
-    Swap_Buffer();
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    if( dirty_tile_count > 0 )
+    {
+        int i, no_of_rects = Build_Dirty_Rects();
 
-    SDL_BlitScaled( scr_render, NULL, scr_surface, &scr_rect );
+        Unlock_Render_Surface();
 
-    SDL_UpdateWindowSurface( scr_window );
+        for( i = 0; i < no_of_rects; i++ )
+        {
+            SDL_BlitScaled( scr_render, &dirty_src[i], scr_surface, &dirty_dst[i] );
+        }
+
+        SDL_UpdateWindowSurfaceRects( scr_window, dirty_dst, no_of_rects );
+
+        Lock_Render_Surface();
+    }
+
+    // update frame timing
+    uint64_t end = SDL_GetPerformanceCounter();
+
+    present_time = Counter_To_Ms( start, end );
+    frame_time = Counter_To_Ms( frame_last_refresh, end );
+    frame_last_refresh = end;
 
     return;
 }
 
 
+// time in milliseconds between the last two calls to GRA_Refresh_Window
+float GRA_Get_Frame_Time()
+{
+    return frame_time;
+}
+
+
+// time in milliseconds spent presenting the last frame in GRA_Refresh_Window
+float GRA_Get_Present_Time()
+{
+    return present_time;
+}
+
+
 
 // generates a 256 colour palette
 int GRA_Generate_Palette()
@@ -390,13 +1026,15 @@ void GRA_Set_Palette_Pixel( int x, int y, int color )
 void GRA_Set_RGBA_Pixel( int x, int y, uint32_t color )
 {
     // check if pixel is within screen bounds
-    if( x < 0 || x > res_width || y < 0 || y > res_height )
+    if( x < 0 || x >= res_width || y < 0 || y >= res_height )
     {
         return;
     }
 
     w_buffer[y*res_width + x] = color;
 
+    Mark_Dirty( x, y, 1, 1 );
+
     return;
 }
 
@@ -428,10 +1066,14 @@ void GRA_Draw_Vertical_Line( int x, int y1, int y2, uint32_t color )
     if( y1 < 0 )            y1 = 0;
     if( y2 > res_height-1)  y2 = res_height-1;
 
-    // draw the line
+    Mark_Dirty( x, y1, 1, y2 - y1 + 1 );
+
+    // draw the line, already clipped so write straight to the buffer
+    uint32_t *pixel = &w_buffer[y1*res_width + x];
     for( ; y1 <= y2; y1++ )
     {
-        GRA_Set_RGBA_Pixel( x, y1, color );
+        *pixel = color;
+        pixel += res_width;
     }
 
     return;
@@ -526,15 +1168,8 @@ void GRA_Draw_Horizontal_Line( int x1, int x2, int y, uint32_t color )
         return;
     }
 
-    // if line extremes are off-screen, adjust them
-    if( x1 < 0 )                x1 = 0;
-    if( x2 > res_width-1 )      x2 = res_width-1;
-
-    // draw the line
-    for( ; x1 <= x2; x1++ )
-    {
-        GRA_Set_RGBA_Pixel( x1, y, color );
-    }
+    // draw the line, clipped to the screen
+    Fill_Area( x1, y, x2, y, color );
 
     return;
 }
@@ -553,15 +1188,102 @@ void GRA_Draw_Hollow_Rectangle( int x, int y, int w, int h, uint32_t color )
 }
 
 
-// draws a filled rectangle to the screen - TODO - cant use until palette implemented
+// draws a filled rectangle to the screen, like the vertical lines it used to be drawn with it
+// covers rows y to y+h inclusive
 void GRA_Draw_Filled_Rectangle( int x, int y, int w, int h, uint32_t color )
 {
-    int i;
-    for( i = 0; i < w; i++ )
+    if( w <= 0 )
+    {
+        return;
+    }
+
+    if( h < 0 )
     {
-        GRA_Draw_Vertical_Line( x+i, y, y+h, color );
+        y += h;
+        h = -h;
     }
 
+    Fill_Area( x, y, x + w - 1, y + h, color );
+    Undraw_Controls( x, y, x + w - 1, y + h );
+
+    return;
+}
+
+// copies w x h pixels to the screen at (x, y), pixels equal to key are skipped if use_key is set
+static void Draw_Block( int x, int y, int w, int h, uint32_t *pixels, uint32_t key, int use_key )
+{
+    int pitch = w;      // row length of the source
+
+    // clip to the screen, moving the start of the source to match
+    if( x < 0 )
+    {
+        pixels -= x;
+        w += x;
+        x = 0;
+    }
+
+    if( y < 0 )
+    {
+        pixels -= y * pitch;
+        h += y;
+        y = 0;
+    }
+
+    if( x + w > res_width )     w = res_width - x;
+    if( y + h > res_height )    h = res_height - y;
+
+    if( w <= 0 || h <= 0 )
+    {
+        return;
+    }
+
+    Mark_Dirty( x, y, w, h );
+    Undraw_Controls( x, y, x + w - 1, y + h - 1 );
+
+    uint32_t *row = &w_buffer[y*res_width + x];
+
+    for( ; h > 0; h-- )
+    {
+        if( use_key )
+        {
+            kernels->copy_keyed( row, pixels, w, key );
+        }
+        else
+        {
+            kernels->copy( row, pixels, w );
+        }
+
+        row += res_width;
+        pixels += pitch;
+    }
+
+    return;
+}
+
+
+// copies a w x h block of RGBA pixels to the screen at (x, y)
+void GRA_Draw_Buffer( int x, int y, int w, int h, uint32_t *pixels )
+{
+    Draw_Block( x, y, w, h, pixels, 0, 0 );
+
+    return;
+}
+
+
+// copies a w x h block of RGBA pixels to the screen at (x, y), pixels equal to key are not drawn
+void GRA_Draw_Buffer_Keyed( int x, int y, int w, int h, uint32_t *pixels, uint32_t key )
+{
+    Draw_Block( x, y, w, h, pixels, key, 1 );
+
+    return;
+}
+
+
+// converts count indexed pixels from src into RGBA in dst using a 256 entry colour table
+void GRA_Expand_Indexed( uint32_t *dst, const uint8_t *src, const uint32_t *table, int count )
+{
+    kernels->expand( dst, src, table, count );
+
     return;
 }
 
@@ -696,6 +1418,8 @@ void GRA_Place_Char( int letter, int x, int y, int forecolor, int bgcolor, int d
     int offset = letter * CHAR_WIDTH * CHAR_HEIGHT; // this can be changed for non-ascii sets
     int i, j, pixel;
 
+    Mark_Dirty( x, y, CHAR_WIDTH, CHAR_HEIGHT );
+
     for( i = 0; i < CHAR_HEIGHT; i++ )
     {
         for( j = 0; j < CHAR_WIDTH; j++ )
@@ -708,7 +1432,7 @@ void GRA_Place_Char( int letter, int x, int y, int forecolor, int bgcolor, int d
             }
             else
             {
-                GRA_Set_RGBA_Pixel( x+j, y+i, (pixel) ? forecolor : bgcolor );
+                Put_Pixel( x+j, y+i, (pixel) ? forecolor : bgcolor );
             }
         }
     }
@@ -769,12 +1493,6 @@ int         mouse_x = 0;
 int         mouse_y = 0;
 int         mouse_b = 0;
 
-static scr_button_type         *buttons[MAX_BUTTONS];
-static int                      button_p = 0;
-
-static scr_switch_type         *switches[MAX_SWITCHES];
-static int                      switch_p = 0;
-
 // create a button for use on the screen, returns index of the button
 int GRA_Make_Button( int x, int y, int w, int h, char *label, void (*function)(void) )
 {
@@ -817,6 +1535,8 @@ int GRA_Make_Button( int x, int y, int w, int h, char *label, void (*function)(v
     buttons[button_p]->disabled_color        = GUI_DISABLED_COLOR;
     buttons[button_p]->current_color         = GUI_ACTIVE_COLOR;
 
+    buttons[button_p]->drawn                 = 0;
+
     return button_p++;
 
 }
@@ -857,19 +1577,23 @@ int GRA_Make_Switch( int x, int y, char c, int *value )
     switches[switch_p]->disabled_color  = GUI_DISABLED_COLOR;
     switches[switch_p]->current_color   = GUI_ACTIVE_COLOR;
 
+    switches[switch_p]->drawn           = 0;
+
     return switch_p++;
 
 }
 
 
-// draw the button to the screen
+// draw the buttons to the screen, only those that have changed or been drawn over since they
+// were last drawn
 void GRA_Draw_Buttons()
 {
     int i;
 
     for( i = 0; i < button_p; i++ )
     {
-        if( buttons[i]->visible == 0 )
+        if( buttons[i]->visible == 0 ||
+            ( buttons[i]->drawn && buttons[i]->drawn_color == buttons[i]->current_color ) )
         {
             continue;
         }
@@ -882,6 +1606,9 @@ void GRA_Draw_Buttons()
             // draw text
             GRA_Simple_Text( buttons[i]->label, buttons[i]->label_x, buttons[i]->label_y, 
                              buttons[i]->current_color, 0, 0 );
+
+            buttons[i]->drawn = 1;
+            buttons[i]->drawn_color = buttons[i]->current_color;
         }
     }
 
@@ -889,19 +1616,26 @@ void GRA_Draw_Buttons()
 }
 
 
-// draw a switch to the screen
+// draw the switches to the screen, only those that have changed or been drawn over since they
+// were last drawn
 void GRA_Draw_Switches()
 {
     int i;
 
     for( i = 0; i < switch_p; i++ )
     {
-        if( buttons[i]->visible == 0 )
+        if( buttons[i]->visible == 0 ||
+            ( switches[i]->drawn && switches[i]->drawn_color == switches[i]->current_color &&
+              switches[i]->drawn_state == *(switches[i]->state) ) )
         {
             continue;
         }
         else
         {
+            // the buffer is not cleared between frames, so remove the old state first
+            GRA_Clear_Rectangle( switches[i]->x + 1, switches[i]->y + 1,
+                                 switches[i]->width - 1, switches[i]->height - 1 );
+
             // draw the switch
             GRA_Draw_Hollow_Rectangle(  switches[i]->x, switches[i]->y, switches[i]->width, 
                                         switches[i]->height, switches[i]->current_color );
@@ -911,6 +1645,11 @@ void GRA_Draw_Switches()
                 GRA_Place_Char( switches[i]->true_char, switches[i]->char_x, switches[i]->char_y,
                                 switches[i]->current_color, 0, 0 );
             }
+
+            // set after the clear above, which marks the switch as drawn over
+            switches[i]->drawn = 1;
+            switches[i]->drawn_color = switches[i]->current_color;
+            switches[i]->drawn_state = *(switches[i]->state);
         }
     }
 
@@ -1002,6 +1741,37 @@ void GRA_Press_Switch( int index )
 }
 
 
+// returns 1 while the mouse is held or a button/switch is waiting out its press delay, both of
+// which depend on GRA_Check_User_Input being called every frame
+int GRA_Check_User_Input_Busy()
+{
+    int i;
+
+    if( mouse_b != 0 )
+    {
+        return 1;
+    }
+
+    for( i = 0; i < button_p; i++ )
+    {
+        if( buttons[i]->active == 0 )
+        {
+            return 1;
+        }
+    }
+
+    for( i = 0; i < switch_p; i++ )
+    {
+        if( switches[i]->active == 0 )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 // go through all buttons to see if the user has clicked on one
 void GRA_Check_User_Input()
 {
@@ -1123,3 +1893,92 @@ void GRA_Free_Switches()
 //===========================
 
 
+// times each set of drawing kernels the cpu supports over a w x h buffer and prints the results
+void GRA_Benchmark_Kernels( int w, int h, int iterations )
+{
+    int i, k, n = w * h;
+    uint64_t start;
+    float fill_ms, copy_ms, keyed_ms, expand_ms;
+    gra_kernels_type *preferred = NULL;
+
+    uint32_t *dst = UTI_EC_Malloc( sizeof( uint32_t ) * n );
+    uint32_t *src = UTI_EC_Malloc( sizeof( uint32_t ) * n );
+    uint8_t *indexed = UTI_EC_Malloc( n );
+    uint32_t table[256];
+
+    // a quarter of the source is the colour key
+    for( i = 0; i < n; i++ )
+    {
+        src[i] = ( i % 4 == 0 ) ? 0 : 0xff000000 + i;
+        dst[i] = 0;
+        indexed[i] = i * 7;
+    }
+
+    for( i = 0; i < 256; i++ )
+    {
+        table[i] = 0xff000000 + i * 0x010101;
+    }
+
+    // megabytes written per run
+    float mb = (float)n * sizeof( uint32_t ) / ( 1024.0f * 1024.0f );
+
+    printf( "Drawing kernels, %dx%d buffer, %d iterations\n", w, h, iterations );
+    printf( "%-8s %20s %20s %20s %20s\n", "kernels", "fill", "copy", "keyed copy", "expand" );
+
+    for( k = 0; k < NO_OF_KERNELS; k++ )
+    {
+        gra_kernels_type *kern = &kernel_list[k];
+
+        if( Kernels_Supported( kern ) == 0 )
+        {
+            printf( "%-8s not supported\n", kern->name );
+            continue;
+        }
+
+        // the first supported set is the one Init_Kernels() picks
+        if( preferred == NULL )
+        {
+            preferred = kern;
+        }
+
+        start = SDL_GetPerformanceCounter();
+        for( i = 0; i < iterations; i++ )
+        {
+            kern->fill( dst, n, 0xff102030 + i );
+        }
+        fill_ms = Counter_To_Ms( start, SDL_GetPerformanceCounter() ) / iterations;
+
+        start = SDL_GetPerformanceCounter();
+        for( i = 0; i < iterations; i++ )
+        {
+            kern->copy( dst, src, n );
+        }
+        copy_ms = Counter_To_Ms( start, SDL_GetPerformanceCounter() ) / iterations;
+
+        start = SDL_GetPerformanceCounter();
+        for( i = 0; i < iterations; i++ )
+        {
+            kern->copy_keyed( dst, src, n, 0 );
+        }
+        keyed_ms = Counter_To_Ms( start, SDL_GetPerformanceCounter() ) / iterations;
+
+        start = SDL_GetPerformanceCounter();
+        for( i = 0; i < iterations; i++ )
+        {
+            kern->expand( dst, indexed, table, n );
+        }
+        expand_ms = Counter_To_Ms( start, SDL_GetPerformanceCounter() ) / iterations;
+
+        printf( "%-8s %7.3fms %6.0fMB/s %7.3fms %6.0fMB/s %7.3fms %6.0fMB/s %7.3fms %6.0fMB/s\n",
+                kern->name, fill_ms, mb * 1000.0f / fill_ms, copy_ms, mb * 1000.0f / copy_ms,
+                keyed_ms, mb * 1000.0f / keyed_ms, expand_ms, mb * 1000.0f / expand_ms );
+    }
+
+    printf( "The editor draws with the %s kernels\n", preferred->name );
+
+    UTI_EC_Free( dst );
+    UTI_EC_Free( src );
+    UTI_EC_Free( indexed );
+
+    return;
+}
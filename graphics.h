@@ -1,9 +1,8 @@
 /*
     graphics.h
-    a software graphics library using 2 banks of screen memory for double buffering.
-    all drawing is done to raw memory which are then transferred to a SDL_Surface of the same
-    res, which is then upscaled to another SDL_Surface to allow any window size to show any
-    lower resolution - ie a 320x200 resolution in a 1024x640 window.
+    a software graphics library. all drawing is done straight into the pixel memory of an
+    SDL_Surface of the render resolution, which is then upscaled to the window surface to allow
+    any window size to show any lower resolution - ie a 320x200 resolution in a 1024x640 window.
 
     made for use with my texture and palette definitions to give an old fashioned look
 */
@@ -57,9 +56,9 @@
 struct scr_buffer_s             {
                                     int         w;
                                     int         h;
+                                    int         pitch;      // row length in pixels
 
-                                    uint32_t    *buffer1;
-                                    uint32_t    *buffer2;
+                                    uint32_t    *pixels;    // render surface memory
                                 };
 typedef struct scr_buffer_s scr_buffer_type;
 
@@ -77,9 +76,9 @@ typedef struct scr_buffer_s scr_buffer_type;
 //  INITIALIZATION
 //=======================
 
-// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
-// writing to and initializes 2 SDL_Surfaces - one w_res x h_res which is stretched onto the
-// second which is width x height, which is rendered to the window.
+// starts SDL Video and opens a window. Also initializes 2 SDL_Surfaces - one w_res x h_res which
+// is drawn to directly and stretched onto the second which is width x height, which is rendered
+// to the window.
 int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res );
 
 
@@ -97,6 +96,14 @@ void GRA_Delay( int milli );
 // check if user quits, by clicking window 'x' or pressed escape
 int GRA_Check_Quit();
 
+// returns the number of the function key pressed since the last call, only F3 and F4 are
+// watched, 0 if neither was
+int GRA_Get_Function_Key();
+
+// sleeps until an event arrives or timeout milliseconds pass, a negative timeout waits forever.
+// handles everything in the queue, returns 1 if there were any events
+int GRA_Wait_For_Event( int timeout );
+
 // wrapper
 int GRA_GetTicks();
 
@@ -112,11 +119,27 @@ void GRA_Clear_Screen();
 void GRA_Fill_Screen( uint32_t color );
 
 
-// writes the current active buffer to the render_surface and displays it, then
-// switches buffers for the next write
+// clears a w x h area of the current buffer to black
+void GRA_Clear_Rectangle( int x, int y, int w, int h );
+
+
+// marks the whole screen to be shown on the next refresh, for when the window contents are lost
+void GRA_Invalidate_Window();
+
+
+// scales the render surface (the buffer all drawing goes to) onto the window and displays it,
+// only the areas drawn to since the last refresh are updated
 void GRA_Refresh_Window();
 
 
+// time in milliseconds between the last two calls to GRA_Refresh_Window
+float GRA_Get_Frame_Time();
+
+
+// time in milliseconds spent presenting the last frame in GRA_Refresh_Window
+float GRA_Get_Present_Time();
+
+
 // generates a 256 colour palette
 int GRA_Generate_Palette();
 
@@ -165,6 +188,18 @@ void GRA_Draw_Hollow_Rectangle( int x, int y, int w, int h, uint32_t color_rgba
 void GRA_Draw_Filled_Rectangle( int x, int y, int w, int h, uint32_t color_rgba );
 
 
+// copies a w x h block of RGBA pixels to the screen at (x, y)
+void GRA_Draw_Buffer( int x, int y, int w, int h, uint32_t *pixels );
+
+
+// copies a w x h block of RGBA pixels to the screen at (x, y), pixels equal to key are not drawn
+void GRA_Draw_Buffer_Keyed( int x, int y, int w, int h, uint32_t *pixels, uint32_t key );
+
+
+// converts count indexed pixels from src into RGBA in dst using a 256 entry colour table
+void GRA_Expand_Indexed( uint32_t *dst, const uint8_t *src, const uint32_t *table, int count );
+
+
 
 //==========================
 //  TEXTURES
@@ -229,6 +264,9 @@ struct scr_button_s     {
                             int             label_y;
 
                             void            (*function)(void);  // code run when button pressed
+
+                            int             drawn;              // 0 until drawn, and after drawn over
+                            uint32_t        drawn_color;        // current_color when it was drawn
                         };
 
 struct scr_switch_s     {
@@ -254,6 +292,10 @@ struct scr_switch_s     {
                             int             char_y;
 
                             int             *state;             // will switch between 0 and 1
+
+                            int             drawn;              // 0 until drawn, and after drawn over
+                            uint32_t        drawn_color;        // current_color when it was drawn
+                            int             drawn_state;        // *state when it was drawn
                         };
 
 typedef struct scr_button_s     scr_button_type;
@@ -268,10 +310,12 @@ int GRA_Make_Button( int x, int y, int w, int h, char *label, void (*function)(v
 // create a binary switch button
 int GRA_Make_Switch( int x, int y, char c, int *value );
 
-// draw the button to the screen
+// draw the buttons to the screen, only those that have changed or been drawn over since they
+// were last drawn
 void GRA_Draw_Buttons();
 
-// draw a switch to the screen
+// draw the switches to the screen, only those that have changed or been drawn over since they
+// were last drawn
 void GRA_Draw_Switches();
 
 // activate a disabled button
@@ -295,6 +339,10 @@ void GRA_Press_Switch( int index );
 // go through all buttons to see if the user has clicked on one
 void GRA_Check_User_Input();
 
+// returns 1 while the mouse is held or a button/switch is waiting out its press delay, both of
+// which depend on GRA_Check_User_Input being called every frame
+int GRA_Check_User_Input_Busy();
+
 // free memory
 void GRA_Free_Buttons();
 
@@ -304,6 +352,9 @@ void GRA_Free_Switches();
 //  TESTING
 //===========================
 
+// times each set of drawing kernels the cpu supports over a w x h buffer and prints the results
+void GRA_Benchmark_Kernels( int w, int h, int iterations );
+
 
 //===============================================================
 //  FUNCTION BODIES
@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "defs.h"
 
@@ -37,6 +38,58 @@ static int                  anim_frame_index        = 0;    // selected frame
 static int                  anim_frame_base         = 0;    // index of first frame slot
 static int                  anim_total              = 0;    // for displaying text
 
+//=======================
+//  REDRAW CONTROL
+//=======================
+
+// the screen is not cleared between frames, parts of the interface that never change are only
+// drawn when this is set, everything else redraws over its own area
+static int                  redraw_static           = 1;
+
+// the other parts are drawn again only when what they show has changed. each keeps the values
+// that decide what it shows from when it was last drawn, see Part_Changed()
+enum    part_list   {   PART_USER_PALETTE,
+                        PART_SPRITE_GRID,
+                        PART_GRID_SCROLL_BAR,
+                        PART_ANIM_EDIT,
+                        PART_ANIM_PLAYER,
+                        PART_LABELS,
+                        PART_EDIT_SPRITE,
+                        PART_MOUSE_AREA,
+
+                        NO_OF_PARTS
+                    };
+
+// the most values a part keeps, the grid keeps 3 for each sprite shown and 3 more
+#define PART_MAX_STATE          ( 3 * GUI_AREA_SPRITE_NUMBER + 3 )
+
+static uint32_t             part_state[NO_OF_PARTS][PART_MAX_STATE];
+static int                  part_drawn[NO_OF_PARTS];            // 0 until drawn, and after GUI_Redraw_All()
+
+//=======================
+//  THUMBNAIL CACHE
+//=======================
+
+// scaled up previews of sprites as drawn in the grid and animation areas, an entry is only valid
+// while the generations of its sprite and palette match what they were when it was built
+#define THUMB_CACHE_SIZE        64      // more than the previews on screen at once
+
+struct thumb_s              {
+                                int         sprite_index;
+                                int         palette_index;
+
+                                uint32_t    sprite_generation;
+                                uint32_t    palette_generation;
+
+                                uint32_t    last_used;      // for picking an entry to replace
+
+                                uint32_t    pixels[GUI_SPRITE_W*GUI_SPRITE_H];
+                            };
+typedef struct thumb_s thumb_type;
+
+static thumb_type           thumb_cache[THUMB_CACHE_SIZE];
+static uint32_t             thumb_clock             = 0;
+
 //=======================
 //  BASIC COLOURS
 //=======================
@@ -264,6 +317,8 @@ static void Convert_Int_To_String( char str[], int x, int limit )
 
 void Set_Palette_Index_Text()
 {
+    GRA_Clear_Rectangle( PALETTE_INDEX_TEXT_X+80, PALETTE_INDEX_TEXT_Y, MAX_INT_STRING*8, 8 );
+
     GRA_Simple_Text( "PALETTE = ", PALETTE_INDEX_TEXT_X, PALETTE_INDEX_TEXT_Y, WHITE, 0, 0 );
     GRA_Simple_Text( palette_index_text, PALETTE_INDEX_TEXT_X+80, PALETTE_INDEX_TEXT_Y, WHITE, 0, 0 );
 
@@ -272,6 +327,8 @@ void Set_Palette_Index_Text()
 
 void Set_Animation_Label_Text()
 {
+    GRA_Clear_Rectangle( GUI_AREA_ANIM_EDIT_X, GUI_AREA_ANIM_EDIT_Y-16, 152 + MAX_INT_STRING*8, 8 );
+
     GRA_Simple_Text(    "ANIMATION - ", GUI_AREA_ANIM_EDIT_X, 
                         GUI_AREA_ANIM_EDIT_Y-16, WHITE, 0, 0 );
     
@@ -287,10 +344,98 @@ void Set_Animation_Label_Text()
     return;
 }
 
+// scale a sprite into a thumbnail, each sprite pixel becomes a 4x4 block
+static void Build_Thumbnail( thumb_type *thumb )
+{
+    static const uint8_t blank_sprite[SPRITE_SIZE];
+    uint32_t colors[SPRITE_SIZE];
+    uint32_t *dest = thumb->pixels;
+    int dx, dy, row;
+    int scale_x = GUI_SPRITE_W / SPRITE_W;
+    int scale_y = GUI_SPRITE_H / SPRITE_H;
+
+    // a missing sprite shows as colour 0, as SPR_Get_Pixel would return
+    uint8_t *definition = SPR_Get_Sprite( thumb->sprite_index );
+    if( definition == NULL )
+    {
+        definition = (uint8_t *)blank_sprite;
+    }
+
+    GRA_Expand_Indexed( colors, definition, PAL_Get_Color_Table( thumb->palette_index ), SPRITE_SIZE );
+
+    for( row = 0; row < SPRITE_H; row++ )
+    {
+        // widen one row of the sprite then repeat it scale_y times
+        uint32_t *first = dest;
+        for( dx = 0; dx < GUI_SPRITE_W; dx++ )
+        {
+            first[dx] = colors[row * SPRITE_W + dx / scale_x];
+        }
+        dest += GUI_SPRITE_W;
+
+        for( dy = 1; dy < scale_y; dy++ )
+        {
+            memcpy( dest, first, GUI_SPRITE_W * sizeof( uint32_t ) );
+            dest += GUI_SPRITE_W;
+        }
+    }
+
+    return;
+}
+
+
+// find the thumbnail for a sprite drawn with a palette, rebuilding it if either has changed,
+// otherwise the least recently used entry is replaced
+static thumb_type *Get_Thumbnail( int sprite_index, int palette_index )
+{
+    uint32_t sprite_generation = SPR_Get_Sprite_Generation( sprite_index );
+    uint32_t palette_generation = PAL_Get_Palette_Generation( palette_index );
+    thumb_type *thumb = NULL;
+    thumb_type *oldest = &thumb_cache[0];
+    int i;
+
+    thumb_clock++;
+
+    for( i = 0; i < THUMB_CACHE_SIZE; i++ )
+    {
+        if( thumb_cache[i].last_used != 0 &&
+            thumb_cache[i].sprite_index == sprite_index &&
+            thumb_cache[i].palette_index == palette_index )
+        {
+            thumb = &thumb_cache[i];
+            break;
+        }
+
+        if( thumb_cache[i].last_used < oldest->last_used )
+        {
+            oldest = &thumb_cache[i];
+        }
+    }
+
+    if( thumb == NULL )
+    {
+        thumb = oldest;
+        thumb->sprite_index = sprite_index;
+        thumb->palette_index = palette_index;
+        Build_Thumbnail( thumb );
+    }
+    else if(    thumb->sprite_generation != sprite_generation ||
+                thumb->palette_generation != palette_generation )
+    {
+        Build_Thumbnail( thumb );
+    }
+
+    thumb->sprite_generation = sprite_generation;
+    thumb->palette_generation = palette_generation;
+    thumb->last_used = thumb_clock;
+
+    return thumb;
+}
+
+
 // drawing a sprite preview (64x64 pixels) for the grid and animation preview areas
 static void Draw_Sprite_Preview( int x, int y, int sprite_index, int use_palette )
 {
-    int i, dx, dy;
     int palette_index;
     
     // check whether to use the sprites individual palette or current selected
@@ -304,21 +449,9 @@ static void Draw_Sprite_Preview( int x, int y, int sprite_index, int use_palette
         palette_index = selected_palette_index;
     }
 
-    for( i = 0; i < SPRITE_SIZE; i++ )
-    {
-        dx = i % SPRITE_W;
-        dy = i / SPRITE_W;
+    thumb_type *thumb = Get_Thumbnail( sprite_index, palette_index );
 
-        int color_index = SPR_Get_Pixel( sprite_index, i );
-        int main_palette_index = PAL_Get_User_Palette_Index( palette_index, color_index );
-        uint32_t color = PAL_Get_Main_Palette_Color( main_palette_index );
-
-        GRA_Draw_Filled_Rectangle(  x+dx*4,
-                                    y+dy*4,
-                                    4, 4,
-                                    color
-                                 );
-    }
+    GRA_Draw_Buffer( x, y, GUI_SPRITE_W, GUI_SPRITE_H, thumb->pixels );
 
     return;
 }
@@ -328,6 +461,22 @@ static void Draw_Sprite_Preview( int x, int y, int sprite_index, int use_palette
 //  DRAW FUNCTIONS
 //========================
 
+// returns 1 if a part has to be drawn, because it hasn't been yet or the count values in state
+// that decide what it shows differ from when it was. they are kept to check against next time
+static int Part_Changed( int part, const uint32_t *state, int count )
+{
+    if( part_drawn[part] && memcmp( part_state[part], state, count * sizeof( uint32_t ) ) == 0 )
+    {
+        return 0;
+    }
+
+    memcpy( part_state[part], state, count * sizeof( uint32_t ) );
+    part_drawn[part] = 1;
+
+    return 1;
+}
+
+
 // draw the border for each of the main screen areas
 static void Draw_Area_Outlines()
 {
@@ -349,6 +498,22 @@ static void Draw_Area_Outlines()
 // draw the controls for the sprite editor
 static void Draw_User_Palette_Controls()
 {
+    uint32_t state[] = {    selected_palette_index,
+                            PAL_Get_Palette_Generation( selected_palette_index ),
+                            selected_palette_option };
+
+    if( Part_Changed( PART_USER_PALETTE, state, 3 ) == 0 )
+    {
+        return;
+    }
+
+    // remove the old selection highlight, the highlight sits 2 pixels outside the area
+    GRA_Clear_Rectangle(    GUI_AREA_USER_PALETTE_X-2,
+                            GUI_AREA_USER_PALETTE_Y-2,
+                            GUI_AREA_USER_PALETTE_W+4,
+                            GUI_AREA_USER_PALETTE_H+4
+                       );
+
     int i;
     for( i = 0; i < 16; i++ )
     {
@@ -414,10 +579,83 @@ static void Draw_Main_Palette()
     return;
 }
 
+// the part of the grid scroll area between the up and down buttons
+#define GRID_TRACK_X        GUI_AREA_SPRITE_GRID_SCROLL_X
+#define GRID_TRACK_Y        ( GUI_AREA_SPRITE_GRID_SCROLL_Y + GUI_AREA_SPRITE_GRID_SCROLL_W )
+#define GRID_TRACK_W        GUI_AREA_SPRITE_GRID_SCROLL_W
+#define GRID_TRACK_H        ( GUI_AREA_SPRITE_GRID_SCROLL_H - 2*GUI_AREA_SPRITE_GRID_SCROLL_W )
+#define GRID_THUMB_MIN_H    8
+
+// the last row of sprites that can be at the top of the grid
+static int Get_Last_Grid_Row()
+{
+    int rows = ( SPR_Get_Number_Of_Sprites() + GUI_AREA_SPRITE_GRID_COLUMNS - 1 ) / GUI_AREA_SPRITE_GRID_COLUMNS;
+
+    return ( rows > GUI_AREA_SPRITE_GRID_ROWS ) ? rows - GUI_AREA_SPRITE_GRID_ROWS : 0;
+}
+
+
+// draws the scroll bar thumb, its size and position show which part of the sprite list is shown
+static void Draw_Grid_Scroll_Bar()
+{
+    int last_row = Get_Last_Grid_Row();
+    int rows = last_row + GUI_AREA_SPRITE_GRID_ROWS;
+
+    uint32_t state[] = { sprite_grid_base, last_row };
+
+    if( Part_Changed( PART_GRID_SCROLL_BAR, state, 2 ) == 0 )
+    {
+        return;
+    }
+
+    // 64 bit, the sprite count can be large enough to overflow the multiplication
+    int thumb_h = (int)( (int64_t)GRID_TRACK_H * GUI_AREA_SPRITE_GRID_ROWS / rows );
+    if( thumb_h < GRID_THUMB_MIN_H )
+    {
+        thumb_h = GRID_THUMB_MIN_H;
+    }
+
+    int thumb_y = 0;
+    if( last_row > 0 )
+    {
+        thumb_y = (int)( (int64_t)( GRID_TRACK_H - thumb_h ) * ( sprite_grid_base / GUI_AREA_SPRITE_GRID_COLUMNS ) / last_row );
+    }
+
+    GRA_Clear_Rectangle( GRID_TRACK_X, GRID_TRACK_Y, GRID_TRACK_W, GRID_TRACK_H );
+
+    // filled rectangles are drawn one row taller than asked
+    GRA_Draw_Filled_Rectangle( GRID_TRACK_X + 4, GRID_TRACK_Y + thumb_y, GRID_TRACK_W - 8, thumb_h - 1, DARK_GREY );
+
+    return;
+}
+
+
 // draws the sprite grid border and sprite definitions
 static void Draw_Sprite_Grid()
 {
-    
+    uint32_t state[PART_MAX_STATE];
+    int no_of_sprites = SPR_Get_Number_Of_Sprites();
+    int cur_sprite, cur_x, cur_y, n = 0;
+
+    // the grid changes with what is shown in it and which sprite is selected
+    state[n++] = sprite_grid_base;
+    state[n++] = sprite_grid_index;
+    state[n++] = no_of_sprites;
+
+    for( cur_sprite = sprite_grid_base; cur_sprite < no_of_sprites && (cur_sprite - sprite_grid_base) < GUI_AREA_SPRITE_NUMBER; cur_sprite++ )
+    {
+        int palette_index = SPR_Get_Sprite_Palette_Index( cur_sprite );
+
+        state[n++] = SPR_Get_Sprite_Generation( cur_sprite );
+        state[n++] = palette_index;
+        state[n++] = PAL_Get_Palette_Generation( palette_index );
+    }
+
+    if( Part_Changed( PART_SPRITE_GRID, state, n ) == 0 )
+    {
+        return;
+    }
+
     // this will show which sprite definitions are not yet active
     GRA_Draw_Filled_Rectangle(  GUI_AREA_SPRITE_GRID_X,
                                 GUI_AREA_SPRITE_GRID_Y,
@@ -425,10 +663,7 @@ static void Draw_Sprite_Grid()
                                 GUI_AREA_SPRITE_GRID_H,
                                 V_DARK_GREY
                              );
-    
-    int no_of_sprites = SPR_Get_Number_Of_Sprites();
 
-    int cur_sprite, cur_x, cur_y;
     for( cur_sprite = sprite_grid_base; cur_sprite < no_of_sprites && (cur_sprite - sprite_grid_base) < GUI_AREA_SPRITE_NUMBER; cur_sprite++ )
     {
         cur_x = (cur_sprite - sprite_grid_base) % GUI_AREA_SPRITE_GRID_COLUMNS;
@@ -440,6 +675,9 @@ static void Draw_Sprite_Grid()
                             );
     }
 
+    // the pages either side are loaded ahead of scrolling, when sprites are loaded lazily
+    SPR_Prefetch_Sprites( sprite_grid_base - GUI_AREA_SPRITE_NUMBER, 3 * GUI_AREA_SPRITE_NUMBER );
+
 
     int r, c;
 
@@ -477,6 +715,14 @@ static void Draw_Sprite_Grid()
                                 CYAN
                              );
 
+    // the bottom row of sprites overwrites the bottom line of the border
+    GRA_Draw_Hollow_Rectangle(  area_pos_x[AREA_SPRITE_GRID]-1,
+                                area_pos_y[AREA_SPRITE_GRID]-1,
+                                area_w[AREA_SPRITE_GRID]+1,
+                                area_h[AREA_SPRITE_GRID]+2,
+                                area_color[AREA_SPRITE_GRID]
+                             );
+
     return;
 }
 
@@ -484,6 +730,32 @@ static void Draw_Sprite_Grid()
 // Draw the animation definition area
 void Draw_Animation_Editor()
 {
+    uint32_t state[5 + 2 * GUI_AREA_ANIM_FRAMES];
+    int i, frame = 0, n = 0;
+
+    // the frames shown are drawn with the selected palette
+    state[n++] = anim_index;
+    state[n++] = anim_frame_base;
+    state[n++] = anim_frame_index;
+    state[n++] = selected_palette_index;
+    state[n++] = PAL_Get_Palette_Generation( selected_palette_index );
+
+    for( i = 0; i < GUI_AREA_ANIM_FRAMES; i++ )
+    {
+        if( frame >= 0 )
+        {
+            frame = ANI_Get_Frame( anim_index, i+anim_frame_base );
+        }
+
+        state[n++] = frame;
+        state[n++] = ( frame >= 0 ) ? SPR_Get_Sprite_Generation( frame ) : 0;
+    }
+
+    if( Part_Changed( PART_ANIM_EDIT, state, n ) == 0 )
+    {
+        return;
+    }
+
     // draw a dark grey background to highlight unselected frame slots
     GRA_Draw_Filled_Rectangle(  GUI_AREA_ANIM_EDIT_X,
                                 GUI_AREA_ANIM_EDIT_Y,
@@ -493,7 +765,7 @@ void Draw_Animation_Editor()
                              );
 
     // TODO add 'base' value for scrolled (see grid scroller code)
-    int i, frame = 0;
+    frame = 0;
     for( i = 0; i < GUI_AREA_ANIM_FRAMES && 
                 ( ( frame =  ANI_Get_Frame( anim_index, i+anim_frame_base ) ) >= 0 ); i++ )
     {
@@ -532,6 +804,16 @@ void Draw_Animation_Player()
 {
     int frame = ANI_Get_Current_Frame();
 
+    uint32_t state[] = {    frame,
+                            SPR_Get_Sprite_Generation( frame ),
+                            selected_palette_index,
+                            PAL_Get_Palette_Generation( selected_palette_index ) };
+
+    if( Part_Changed( PART_ANIM_PLAYER, state, 4 ) == 0 )
+    {
+        return;
+    }
+
     Draw_Sprite_Preview (   GUI_AREA_ANIM_PLAYER_X,
                             GUI_AREA_ANIM_PLAYER_Y,
                             frame,
@@ -653,12 +935,10 @@ void BTN_Scroll_Grid_Up()
 
 void BTN_Scroll_Grid_Down()
 {
-    sprite_grid_base += GUI_AREA_SPRITE_GRID_COLUMNS;
-
-    // protect against signed int wrap-around, however unlikely
-    if( sprite_grid_base < 0 )
+    // stop once the last row of sprites is on screen
+    if( sprite_grid_base / GUI_AREA_SPRITE_GRID_COLUMNS < Get_Last_Grid_Row() )
     {
-        sprite_grid_base = 0;
+        sprite_grid_base += GUI_AREA_SPRITE_GRID_COLUMNS;
     }
 
     return;
@@ -1000,6 +1280,28 @@ static void Input_Sprite_Grid( int button, int x, int y )
 }
 
 
+// clicking or dragging in the scroll track jumps the grid straight to that part of the list
+static void Input_Sprite_Grid_Scroll( int button, int x, int y )
+{
+    (void)x;
+
+    if( button == 1 && y >= GRID_TRACK_Y && y < GRID_TRACK_Y + GRID_TRACK_H )
+    {
+        int last_row = Get_Last_Grid_Row();
+        int row = (int)( (int64_t)( y - GRID_TRACK_Y ) * ( last_row + 1 ) / GRID_TRACK_H );
+
+        if( row > last_row )
+        {
+            row = last_row;
+        }
+
+        sprite_grid_base = row * GUI_AREA_SPRITE_GRID_COLUMNS;
+    }
+
+    return;
+}
+
+
 static void Input_Anim_Edit( int button, int x, int y )
 {
     if( button == 1 )
@@ -1254,33 +1556,50 @@ int GUI_Init()
 // draws the gui to the screen
 void GUI_Draw_Interface()
 {
-    Draw_Area_Outlines();
-    Draw_Main_Palette();
+    // the outlines and main palette never change, only draw them when the screen is reset
+    if( redraw_static )
+    {
+        Draw_Area_Outlines();
+        Draw_Main_Palette();
+
+        redraw_static = 0;
+    }
+
     Draw_User_Palette_Controls();
 
     Draw_Sprite_Grid();
+    Draw_Grid_Scroll_Bar();
 
     Draw_Animation_Editor();
     Draw_Animation_Player();
 
     anim_total = ANI_Get_Number_Of_Animations();
-    Convert_Int_To_String( anim_total_text, anim_total, MAX_INT_STRING );
 
-    Set_Palette_Index_Text();
-    Set_Animation_Label_Text();
+    uint32_t labels[] = { selected_palette_index, anim_index, anim_total };
+
+    if( Part_Changed( PART_LABELS, labels, 3 ) )
+    {
+        Convert_Int_To_String( anim_total_text, anim_total, MAX_INT_STRING );
+
+        Set_Palette_Index_Text();
+        Set_Animation_Label_Text();
+    }
 
+    // buttons and switches are only drawn when they change or an area above is drawn over them
     GRA_Draw_Buttons();
     GRA_Draw_Switches();
-    
 
-    // the bottom row of sprites overwrites the bottom line of the border
-    GRA_Draw_Hollow_Rectangle(  area_pos_x[AREA_SPRITE_GRID]-1,
-                                area_pos_y[AREA_SPRITE_GRID]-1,
-                                area_w[AREA_SPRITE_GRID]+1,
-                                area_h[AREA_SPRITE_GRID]+2,
-                                area_color[AREA_SPRITE_GRID]
-                             );
- 
+    return;
+}
+
+
+// clears the screen and draws every part of the interface again on the next GUI_Draw_Interface()
+void GUI_Redraw_All()
+{
+    GRA_Clear_Screen();
+    redraw_static = 1;
+    memset( part_drawn, 0, sizeof( part_drawn ) );
+
     return;
 }
 
@@ -1288,15 +1607,24 @@ void GUI_Draw_Interface()
 void GUI_Draw_Edit_Sprite()
 {
     int i, x, y;
+    const uint32_t *colors = PAL_Get_Color_Table( selected_palette_index );
+
+    uint32_t state[] = {    sprite_grid_index,
+                            SPR_Get_Sprite_Generation( sprite_grid_index ),
+                            selected_palette_index,
+                            PAL_Get_Palette_Generation( selected_palette_index ) };
+
+    if( Part_Changed( PART_EDIT_SPRITE, state, 4 ) == 0 )
+    {
+        return;
+    }
 
     for( i = 0; i < SPRITE_SIZE; i++ )
     {
         x = i % SPRITE_W;
         y = i / SPRITE_W;
 
-        int color_index = SPR_Get_Pixel( sprite_grid_index, i );
-        int main_palette_index = PAL_Get_User_Palette_Index( selected_palette_index, color_index );
-        uint32_t color  = PAL_Get_Main_Palette_Color( main_palette_index );
+        uint32_t color = colors[SPR_Get_Pixel( sprite_grid_index, i )];
 
         GRA_Draw_Filled_Rectangle(  GUI_AREA_SPRITE_EDIT_X+x*SPRITE_W,
                                     GUI_AREA_SPRITE_EDIT_Y+y*SPRITE_H,
@@ -1350,7 +1678,14 @@ void GUI_Get_Mouse_Input()
         mouse_area = area_label[current_area];
     }
 
-    GRA_Simple_Text( mouse_area, 32, 8, WHITE, 0, 0 );
+    // the label only changes when the mouse moves to another area
+    uint32_t state[] = { current_area };
+
+    if( Part_Changed( PART_MOUSE_AREA, state, 1 ) )
+    {
+        GRA_Clear_Rectangle( 32, 8, GUI_AREA_SPRITE_EDIT_W, 8 );
+        GRA_Simple_Text( mouse_area, 32, 8, WHITE, 0, 0 );
+    }
     
     
     // call function that handles user input for the specified area
@@ -1373,6 +1708,10 @@ void GUI_Get_Mouse_Input()
             Input_Sprite_Grid ( m_button, mouse_x, mouse_y );
             break;
 
+        case AREA_SPRITE_GRID_SCROLL:
+            Input_Sprite_Grid_Scroll( m_button, mouse_x, mouse_y );
+            break;
+
         case AREA_ANIM_EDIT:
             Input_Anim_Edit   ( m_button, mouse_x, mouse_y );
             break;
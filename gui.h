@@ -22,11 +22,16 @@
 int GUI_Init();
 
 
-// draw the user interface
+// draw the user interface, parts that never change are only drawn after GUI_Redraw_All() and
+// the others only when what they show has changed
 void GUI_Draw_Interface();
 
 
-// draw current sprite to the edit window
+// clear the screen and draw the whole interface on the next GUI_Draw_Interface()
+void GUI_Redraw_All();
+
+
+// draw current sprite to the edit window, if it or its palette has changed since it was drawn
 void GUI_Draw_Edit_Sprite();
 
 
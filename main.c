@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "defs.h"
 
@@ -11,6 +12,10 @@
 #include "sprite.h"
 #include "anim.h"
 #include "file.h"
+#include "batch.h"
+#include "png.h"
+#include "profile.h"
+#include "thread.h"
 
 //====================================================================
 //  CONSTANTS
@@ -57,9 +62,25 @@ int main( int argc, char *argv[] )
  
     Print_Program_Info( argv[0] );
 
+    // process a batch of files without opening a window
+    if( argc > 1 && strcmp( argv[1], "--batch" ) == 0 )
+    {
+        return BAT_Run( argc, argv );
+    }
+
     // parse arguments
     FIL_Parse_Arguments( argc, argv );
 
+    // run the benchmarks without opening a window
+    if( FIL_Get_Options() & FIL_OPTION_BENCHMARK )
+    {
+        GRA_Benchmark_Kernels( WINDOW_WIDTH, WINDOW_HEIGHT, 200 );
+        SPR_Benchmark_Kernels( 100000, 20 );
+        PNG_Benchmark( 2048, 2048, 5 );
+        THR_Stop_Threads();
+        return 0;
+    }
+
     // CREATE DISPLAY
     if( GRA_Create_Display( "SmallSprite",  WINDOW_WIDTH, WINDOW_HEIGHT, 
                                             WINDOW_WIDTH, WINDOW_HEIGHT ) == 0 )
@@ -84,7 +105,15 @@ int main( int argc, char *argv[] )
     SPR_Init();
 
     // OPEN OR CREATE DATA
-    if(  FIL_Open_File() == 0 )
+    int opened = FIL_Open_File();
+
+    // a blank file would be saved over it on the way out
+    if( opened == FIL_OPEN_FAILED )
+    {
+        UTI_Fatal_Error( "Unable to load file, it has been left as it is" );
+    }
+
+    if( opened == FIL_OPEN_MISSING )
     {
         // file not found, need to create a 'blank' file
         SPR_Add_Sprite();
@@ -92,47 +121,145 @@ int main( int argc, char *argv[] )
         PAL_Add_User_Palette();
     }
 
+    // keep one copy of each distinct sprite
+    if( FIL_Get_Options() & FIL_OPTION_SHARE )
+    {
+        SPR_Share_Storage();
+    }
+
+    // halve the memory sprites take while they only use the user palette
+    if( FIL_Get_Options() & FIL_OPTION_NIBBLES )
+    {
+        SPR_Pack_Storage();
+    }
+
     ANI_Init_Animation();
 
+    // save what changes to a file of its own every so often, in case we don't get to the end
+    FIL_Start_Autosave();
+
+    // clear the screen and draw the whole interface on the first frame, after that each
+    // area redraws over itself and only changed parts of the screen are presented
+    GUI_Redraw_All();
+
     int running = 1;            // loop control
-    unsigned int start_time;
-    unsigned int end_time;
+    int redraw = 1;             // set when the screen needs to be drawn again
+    int timeout;
+    unsigned int next_frame = GRA_GetTicks();
+    unsigned int now;
+    int autosave_timeout;
     while( running )
     {
-        start_time = GRA_GetTicks();
+        // sleep until there is input, only wake for the next frame if something is moving or
+        // waiting to be drawn
+        timeout = -1;
+        if( redraw || ANI_Is_Playing() || GRA_Check_User_Input_Busy() || PRF_Overlay_Shown() )
+        {
+            now = GRA_GetTicks();
+            timeout = ( now < next_frame ) ? next_frame - now : 0;
+        }
+
+        // autosave if it is due, and wake up for the next one
+        autosave_timeout = FIL_Autosave();
+        if( autosave_timeout >= 0 && ( timeout < 0 || autosave_timeout < timeout ) )
+        {
+            timeout = autosave_timeout;
+        }
+
+        if( GRA_Wait_For_Event( timeout ) )
+        {
+            redraw = 1;
+        }
+
+        // check for user quit
+        running = GRA_Check_Quit();
+
+        // F3 shows or hides the frame timings, F4 saves them
+        switch( GRA_Get_Function_Key() )
+        {
+            case 3:
+                if( PRF_Toggle_Overlay() == 0 )
+                {
+                    // put back what the overlay covered
+                    GUI_Redraw_All();
+                }
+                break;
+
+            case 4:
+                if( PRF_Write_CSV( "profile.csv" ) )
+                {
+                    printf( "Frame timings written to profile.csv\n" );
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        // draw at most once every FRAME_TIME ms, button delays and animation speeds are
+        // counted in frames
+        now = GRA_GetTicks();
+        if( running == 0 || now < next_frame )
+        {
+            continue;
+        }
+
+        if( redraw == 0 && ANI_Is_Playing() == 0 && GRA_Check_User_Input_Busy() == 0 &&
+            PRF_Overlay_Shown() == 0 )
+        {
+            continue;
+        }
+
+        next_frame = now + FRAME_TIME;
+
+        if( ANI_Update_Animation() || GRA_Check_User_Input_Busy() || PRF_Overlay_Shown() )
+        {
+            redraw = 1;
+        }
 
-        // clear screen for next render
-        GRA_Clear_Screen();
+        if( redraw == 0 )
+        {
+            continue;
+        }
 
-        ANI_Update_Animation();
+        redraw = 0;
+
+        // each stage is timed, the overlay shows the frames before this one
+        PRF_Begin_Frame();
 
         // draw the user interface
+        PRF_Start( PRF_DRAW_INTERFACE );
         GUI_Draw_Interface();
+        PRF_Stop( PRF_DRAW_INTERFACE );
+
+        PRF_Start( PRF_DRAW_EDIT_SPRITE );
         GUI_Draw_Edit_Sprite();
+        PRF_Stop( PRF_DRAW_EDIT_SPRITE );
 
         // check buttons
+        PRF_Start( PRF_CHECK_INPUT );
         GRA_Check_User_Input();
+        PRF_Stop( PRF_CHECK_INPUT );
 
         // check mouse use
+        PRF_Start( PRF_MOUSE_INPUT );
         GUI_Get_Mouse_Input();
+        PRF_Stop( PRF_MOUSE_INPUT );
 
-        // update display and swap buffers
-        GRA_Refresh_Window();
-
-        // check for user quit
-        running = GRA_Check_Quit();
+        PRF_Draw_Overlay();
 
+        // update display
+        PRF_Start( PRF_REFRESH_WINDOW );
+        GRA_Refresh_Window();
+        PRF_Stop( PRF_REFRESH_WINDOW );
 
-        end_time = GRA_GetTicks() - start_time;
-    
-        if( end_time < FRAME_TIME )
-        {
-            GRA_Delay( FRAME_TIME - end_time );
-        }
+        PRF_End_Frame();
     }
 
     // SPR_DEBUG_Show_Sprite( 0 );
 
+    FIL_Stop_Autosave();
+
     // write the file
     if( FIL_Write_File() == 0 )
     {
@@ -148,6 +275,12 @@ int main( int argc, char *argv[] )
     // free animation data
     ANI_Free();
 
+    // release the loaded file, sprites may have been using it
+    FIL_Free();
+
+    // end the threads bulk sprite changes were shared between
+    THR_Stop_Threads();
+
     // free graphics memory and shut down SDL
     GRA_Close(); 
 
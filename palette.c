@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 
 #include "defs.h"
 #include "palette.h"
@@ -17,66 +18,133 @@
 #include "graphics.h"
 
 
+//========================================================================
+//  CONSTANTS
+//========================================================================
+
+#define PAL_LIST_START              16          // palettes room is made for at first
 
 //========================================================================
 //  FILE WIDE VARIABLES
 //========================================================================
 
 static uint32_t                 main_palette[PAL_MAIN_SIZE];
-static user_palette_type        *user_palette[PAL_MAX_USER_PALETTES];
+
+// user palettes are kept in one block in index order, it moves when it has to grow
+static user_palette_type        *user_palette = NULL;
+static int                      palette_capacity = 0;
 
 static int                      no_of_palettes = 0;
 static int                      current_palette = 0;
 
+// resolved RGBA colours of each user palette so drawing doesn't go through the main palette,
+// only made for palettes that are drawn with (see PAL_Get_Color_Table()). palette_capacity long
+static uint32_t                 **color_table = NULL;
+static const uint32_t           blank_color_table[PAL_COLOR_TABLE_SIZE];
+
+// bumped whenever a user palette changes, see SPR_Get_Sprite_Generation(). palette_capacity long
+static uint32_t                 *palette_generation = NULL;
+static uint32_t                 generation_counter = 0;
+
+// palettes changed since the last save, see PAL_Get_Changed_Palettes(). generations above
+// saved_generation are changes, so a palette is listed once however often it changes
+static int                      *changed_palette = NULL;
+static int                      no_of_changed = 0;
+static int                      changed_capacity = 0;
+static uint32_t                 saved_generation = 0;
+
 //========================================================================
 //  PRIVATE FUNCTIONS
 //========================================================================
 
-// creates space for a new user palette and initializes all values to 0 (transparency)
-// returns 1 on success
-static int Create_User_Palette( int palette_index )
+// makes sure there is room for count palettes, returns 1 on success. the capacity doubles so 
+// adding palettes one at a time stays cheap
+static int Reserve_Palettes( int count )
 {
-    // check pointer has been initialized and is not being used
-    if( palette_index < 0 || palette_index > PAL_MAX_USER_PALETTES )
+    if( count <= palette_capacity )
     {
-        return 0;
+        return 1;
     }
 
-    if( user_palette[palette_index] != NULL )
+    int capacity = ( palette_capacity > 0 ) ? palette_capacity : PAL_LIST_START;
+    while( capacity < count )
     {
-        UTI_Print_Debug( "Pointer is not null!" );
-        return 0;
+        capacity = ( capacity > INT_MAX / 2 ) ? count : capacity * 2;
     }
 
-    printf( "Requesting %d bytes for palette...\n", PAL_USER_SIZE );
+    if( (size_t)capacity > SIZE_MAX / sizeof( user_palette_type ) )
+    {
+        return 0;
+    }
 
-    // get space for the palette
-    user_palette[palette_index] = UTI_EC_Malloc( PAL_USER_SIZE );
+    user_palette = UTI_EC_Realloc( user_palette, sizeof( user_palette_type ) * capacity );
+    color_table = UTI_EC_Realloc( color_table, sizeof( uint32_t * ) * capacity );
+    palette_generation = UTI_EC_Realloc( palette_generation, sizeof( uint32_t ) * capacity );
 
-    // initialize palette values
     int i;
-    for( i = 0; i < PAL_USER_SIZE; i++ )
+    for( i = palette_capacity; i < capacity; i++ )
     {
-        //TODO change this to 0 instead of i
-        user_palette[palette_index]->palette[i] = 0;
+        color_table[i] = NULL;
+        palette_generation[i] = 0;
     }
-    
+
+    palette_capacity = capacity;
+
     return 1;
 }
 
+
+// mark a palette as changed
+static void Touch_Palette( int index )
+{
+    if( palette_generation[index] <= saved_generation )
+    {
+        if( no_of_changed == changed_capacity )
+        {
+            changed_capacity = ( changed_capacity > 0 ) ? changed_capacity * 2 : PAL_LIST_START;
+            changed_palette = UTI_EC_Realloc( changed_palette, sizeof( int ) * changed_capacity );
+        }
+
+        changed_palette[no_of_changed++] = index;
+    }
+
+    palette_generation[index] = ++generation_counter;
+
+    return;
+}
+
+
+// fills in the colour table of a palette from the main palette, allocating it if needed
+static void Build_Color_Table( int palette_index )
+{
+    if( color_table[palette_index] == NULL )
+    {
+        color_table[palette_index] = UTI_EC_Malloc( sizeof( uint32_t ) * PAL_COLOR_TABLE_SIZE );
+    }
+
+    int i;
+    for( i = 0; i < PAL_COLOR_TABLE_SIZE; i++ )
+    {
+        if( i < PAL_USER_SIZE )
+        {
+            color_table[palette_index][i] = PAL_Get_Main_Palette_Color( user_palette[palette_index].palette[i] );
+        }
+        else
+        {
+            color_table[palette_index][i] = 0x00000000;
+        }
+    }
+
+    return;
+}
+
 //========================================================================
 //  PUBLIC FUNCTION BODIES
 //========================================================================
 
-// initialize all pointers to zero
+// nothing to set up, palettes are allocated as they are added
 void PAL_Init()
 {
-    int i = 0;
-    for( i = 0; i < PAL_MAX_USER_PALETTES; i++ )
-    {
-        user_palette[i] = NULL;
-    }
-
     return;
 }
 
@@ -97,13 +165,25 @@ void PAL_Generate_Main_Palette()
         }
     }
 
+    // every user palette's colours have changed
+    int i;
+    for( i = 0; i < no_of_palettes; i++ )
+    {
+        if( color_table[i] != NULL )
+        {
+            Build_Color_Table( i );
+        }
+
+        Touch_Palette( i );
+    }
+
     return;
 }
 
 // returns the requested RGBA value of the main palette, or 0 if an unreasonable index is given
 uint32_t PAL_Get_Main_Palette_Color( int index )
 {
-    if( index < 0 || index > PAL_MAIN_SIZE )
+    if( index < 0 || index >= PAL_MAIN_SIZE )
     {
         return 0x00000000;
     }
@@ -120,7 +200,7 @@ uint32_t PAL_Get_User_Palette_Color( int pal_index, int col_index )
     {
         if( col_index < PAL_USER_SIZE && col_index >= 0 )
         {
-            return PAL_Get_Main_Palette_Color( user_palette[pal_index]->palette[col_index] );
+            return PAL_Get_Main_Palette_Color( user_palette[pal_index].palette[col_index] );
         }
     }
 
@@ -134,7 +214,7 @@ int PAL_Get_User_Palette_Index( int pal_index, int col_index )
     {
         if( col_index < PAL_USER_SIZE && col_index >= 0 )
         {
-            return user_palette[pal_index]->palette[col_index];
+            return user_palette[pal_index].palette[col_index];
         }
     }
 
@@ -151,7 +231,12 @@ void PAL_Set_User_Palette_Index( int pal_index, int col_index, int new_val )
         {
             if( new_val < PAL_MAIN_SIZE && new_val >= 0 )
             {
-                user_palette[pal_index]->palette[col_index] = new_val;
+                user_palette[pal_index].palette[col_index] = new_val;
+                if( color_table[pal_index] != NULL )
+                {
+                    color_table[pal_index][col_index] = PAL_Get_Main_Palette_Color( new_val );
+                }
+                Touch_Palette( pal_index );
             }
         }
     }
@@ -160,18 +245,23 @@ void PAL_Set_User_Palette_Index( int pal_index, int col_index, int new_val )
 }
 
 
-// add another user palette, returns index of new palette on success, -1 on failure
+// add another user palette, all colours 0 (transparency), returns index of new palette on 
+// success, -1 on failure
 int PAL_Add_User_Palette()
 {
-    // check there is room for another palette
-    if( no_of_palettes >= PAL_MAX_USER_PALETTES-1 )
+    if( Reserve_Palettes( no_of_palettes + 1 ) == 0 )
     {
-        UTI_Print_Debug( "Unable to add another palette, limit reached" );
+        UTI_Print_Error( "Unable to add another palette, out of memory" );
         return -1;
     }
 
-    // create data for a new palette
-    Create_User_Palette( no_of_palettes );
+    int i;
+    for( i = 0; i < PAL_USER_SIZE; i++ )
+    {
+        user_palette[no_of_palettes].palette[i] = 0;
+    }
+
+    Touch_Palette( no_of_palettes );
 
     return no_of_palettes++;
 }
@@ -187,9 +277,10 @@ int PAL_Next_Palette()
     }
 
     // create a new palette if possible
-    if( current_palette >= no_of_palettes-1 && no_of_palettes < PAL_MAX_USER_PALETTES-1  )
+    int index = PAL_Add_User_Palette();
+    if( index >= 0 )
     {
-        current_palette = PAL_Add_User_Palette();   
+        current_palette = index;
         return current_palette;
     }
 
@@ -223,6 +314,35 @@ int PAL_Set_Palette( int index )
 }
 
 
+// returns a value that changes every time the user palette is edited, 0 for an invalid index
+uint32_t PAL_Get_Palette_Generation( int index )
+{
+    if( index < 0 || index >= no_of_palettes )
+    {
+        return 0;
+    }
+
+    return palette_generation[index];
+}
+
+
+// returns the RGBA colour table of the palette, all transparent for an invalid index
+const uint32_t *PAL_Get_Color_Table( int pal_index )
+{
+    if( pal_index < 0 || pal_index >= no_of_palettes )
+    {
+        return blank_color_table;
+    }
+
+    if( color_table[pal_index] == NULL )
+    {
+        Build_Color_Table( pal_index );
+    }
+
+    return color_table[pal_index];
+}
+
+
 int  PAL_Get_Number_Of_Palettes()
 {
     return no_of_palettes;
@@ -238,24 +358,57 @@ user_palette_type *PAL_Get_Palette( int index )
         return NULL;
     }
 
-    return user_palette[index];
+    return &user_palette[index];
+}
+
+
+// returns every user palette in index order, PAL_Get_Number_Of_Palettes() long
+const user_palette_type *PAL_Get_Palettes()
+{
+    return user_palette;
 }
 
 //=======================================
 //  FILE I/O
 //=======================================
 
-int     PAL_Load_Palette( user_palette_type *palette )
+// adds count palettes to the end of the list and returns them to be filled in, so a whole 
+// file's worth can be read in one go. returns NULL if there is no room
+user_palette_type *PAL_Load_Palettes( int count )
 {
-    if( no_of_palettes >= PAL_MAX_USER_PALETTES-1 )
+    if( count < 0 || Reserve_Palettes( no_of_palettes + count ) == 0 )
     {
-        UTI_Print_Debug( "Unable to load palette, limit reached" );
-        return 0;
+        UTI_Print_Error( "Unable to load palettes, out of memory" );
+        return NULL;
     }
 
-    user_palette[no_of_palettes++] = palette;
+    user_palette_type *first = &user_palette[no_of_palettes];
 
-    return 1;
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        Touch_Palette( no_of_palettes++ );
+    }
+
+    return first;
+}
+
+// returns the indices of palettes added or changed since PAL_Mark_Palettes_Saved(), in the order
+// they first changed. count is set to how many
+const int *PAL_Get_Changed_Palettes( int *count )
+{
+    *count = no_of_changed;
+
+    return changed_palette;
+}
+
+// clears the list of changed palettes, call once they have been saved
+void PAL_Mark_Palettes_Saved()
+{
+    no_of_changed = 0;
+    saved_generation = generation_counter;
+
+    return;
 }
 
 // clean up mallocd memory
@@ -264,9 +417,23 @@ void PAL_Free()
     int i;
     for( i = 0; i < no_of_palettes; i++ )
     {
-        UTI_EC_Free( user_palette[i] );
+        UTI_EC_Free( color_table[i] );
     }
 
+    UTI_EC_Free( user_palette );
+    UTI_EC_Free( color_table );
+    UTI_EC_Free( palette_generation );
+    UTI_EC_Free( changed_palette );
+
+    user_palette = NULL;
+    color_table = NULL;
+    palette_generation = NULL;
+    palette_capacity = 0;
+    no_of_palettes = 0;
+
+    changed_palette = NULL;
+    no_of_changed = 0;
+    changed_capacity = 0;
+
     return;
 }
-
@@ -22,6 +22,8 @@
 //  PRIVATE CONSTANTS
 //========================================================================
 
+// entries in a palette's colour table, one for every value a sprite pixel can hold
+#define PAL_COLOR_TABLE_SIZE        256
 
 
 
@@ -38,7 +40,7 @@ typedef struct user_palette_s       user_palette_type;
 //  FUNCTION PROTOTYPES
 //========================================================================
 
-// initialize palette data, sets all pointers to NULL
+// initialize palette data
 void            PAL_Init();
 
 // create a 64 colour RGBA palette
@@ -56,7 +58,8 @@ int             PAL_Get_User_Palette_Index( int pal_index, int col_index );
 // sets the color of the user palette to the desired index of the main palette
 void            PAL_Set_User_Palette_Index( int pal_index, int col_index, int new_val );
 
-// add another user palette, returns index of new palette on success, -1 on failure
+// add another user palette, all colours 0 (transparency), returns index of new palette on 
+// success, -1 on failure
 int             PAL_Add_User_Palette();
 
 
@@ -73,15 +76,36 @@ int             PAL_Set_Palette( int index );
 
 int             PAL_Get_Number_Of_Palettes();
 
-// returns a pointer to the given palette index
+// returns a value that changes every time the user palette is edited, 0 for an invalid index
+uint32_t        PAL_Get_Palette_Generation( int index );
+
+// returns the RGBA colour of every pixel value (PAL_COLOR_TABLE_SIZE entries) for the palette, 
+// values outside the user palette are transparent. an invalid index gives an all transparent 
+// table, never NULL. the table is kept up to date as the palette changes
+const uint32_t  *PAL_Get_Color_Table( int pal_index );
+
+// returns a pointer to the given palette index, palettes are stored together so this is only 
+// valid until the next palette is added
 user_palette_type *PAL_Get_Palette( int index );
 
 //======================================
 //  FILE I/O
 //======================================
 
-// add a palette to the list
-int     PAL_Load_Palette( user_palette_type *palette );
+// adds count palettes to the end of the list and returns them to be filled in, so a whole 
+// file's worth can be read in one go. returns NULL if there is no room
+user_palette_type *PAL_Load_Palettes( int count );
+
+// returns every user palette in index order, PAL_Get_Number_Of_Palettes() long, for writing in
+// one go. only valid until the next palette is added
+const user_palette_type *PAL_Get_Palettes();
+
+// returns the indices of palettes added or changed since PAL_Mark_Palettes_Saved(), in the order
+// they first changed. count is set to how many
+const int       *PAL_Get_Changed_Palettes( int *count );
+
+// clears the list of changed palettes, call once they have been saved
+void            PAL_Mark_Palettes_Saved();
 
 // clean up mallocd memory
 void            PAL_Free();
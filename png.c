@@ -0,0 +1,1045 @@
+//====================================================================
+//
+//  png.c
+//
+//  writes indexed colour PNG images a few rows at a time, with its
+//  own deflate so nothing else is needed
+//
+//====================================================================
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utility.h"
+#include "png.h"
+
+
+//====================================================================
+//  CONSTANTS
+//====================================================================
+
+#define PNG_CHUNK_SIZE              65536       // most bytes of compressed data in one IDAT chunk
+
+// deflate
+#define PNG_WINDOW                  32768       // furthest back a match can be
+#define PNG_MIN_MATCH               3
+#define PNG_MAX_MATCH               258
+#define PNG_LOOKAHEAD               ( PNG_MAX_MATCH + PNG_MIN_MATCH + 1 )
+#define PNG_HASH_BITS               15
+#define PNG_HASH_SIZE               ( 1 << PNG_HASH_BITS )
+#define PNG_MAX_CHAIN               32          // earlier matches looked at for each position
+#define PNG_GOOD_MATCH              128         // stops looking once a match is this long
+#define PNG_BLOCK_SYMBOLS           16384       // literals and matches in each block
+
+#define PNG_LITERALS                286         // literal and length codes
+#define PNG_DISTANCES               30
+#define PNG_CODE_LENGTHS            19
+#define PNG_MAX_SYMBOLS             PNG_LITERALS
+#define PNG_MAX_BITS                15
+#define PNG_MAX_LENGTH_BITS         7           // longest code for the code lengths
+#define PNG_END_OF_BLOCK            256
+
+
+//====================================================================
+//  TYPES
+//====================================================================
+
+struct png_s {  FILE        *file;
+                int         w;
+                int         h;
+                int         bit_depth;
+                int         rows_written;
+                int         failed;                 // set on the first write that fails
+                size_t      file_size;
+
+                uint8_t     *row;                   // filter type then the packed pixels
+                int         row_size;
+
+                // what hasn't been compressed yet and the PNG_WINDOW bytes before it
+                uint8_t     window[2 * PNG_WINDOW];
+                int         window_size;
+                int         position;               // next byte to compress
+                uint32_t    adler;
+
+                // the last position each hash was seen at, and the one before each position,
+                // -1 for none
+                int32_t     head[PNG_HASH_SIZE];
+                int32_t     prev[PNG_WINDOW];
+
+                // the current block, a distance of 0 is a literal
+                uint16_t    symbol_length[PNG_BLOCK_SYMBOLS];
+                uint16_t    symbol_distance[PNG_BLOCK_SYMBOLS];
+                int         no_of_symbols;
+
+                uint64_t    bits;                   // bits not yet in chunk, lowest first
+                int         no_of_bits;
+
+                uint8_t     chunk[PNG_CHUNK_SIZE];  // IDAT data not yet written
+                int         chunk_size;
+             };
+
+
+//====================================================================
+//  FILE VARIABLES
+//====================================================================
+
+// the order code length code lengths are sent in
+static const uint8_t        length_order[PNG_CODE_LENGTHS] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+
+//====================================================================
+//  PRIVATE FUNCTIONS
+//====================================================================
+
+static void Put_U32( uint8_t *data, uint32_t value )
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+
+    return;
+}
+
+
+static void Write_Bytes( png_type *png, const void *data, size_t size )
+{
+    if( png->failed == 0 && size > 0 && fwrite( data, 1, size, png->file ) != size )
+    {
+        png->failed = 1;
+    }
+
+    png->file_size += size;
+
+    return;
+}
+
+
+// writes a chunk of size bytes of data, type is the four letter name
+static void Write_Chunk( png_type *png, const char *type, const uint8_t *data, int size )
+{
+    uint8_t header[8], crc[4];
+
+    Put_U32( header, size );
+    memcpy( header + 4, type, 4 );
+    Put_U32( crc, UTI_CRC32( UTI_CRC32( 0, type, 4 ), data, size ) );
+
+    Write_Bytes( png, header, 8 );
+    Write_Bytes( png, data, size );
+    Write_Bytes( png, crc, 4 );
+
+    return;
+}
+
+
+//==========================
+//  BITS
+//==========================
+
+static void Flush_Chunk( png_type *png )
+{
+    if( png->chunk_size > 0 )
+    {
+        Write_Chunk( png, "IDAT", png->chunk, png->chunk_size );
+        png->chunk_size = 0;
+    }
+
+    return;
+}
+
+
+static void Put_Byte( png_type *png, uint8_t byte )
+{
+    if( png->chunk_size == PNG_CHUNK_SIZE )
+    {
+        Flush_Chunk( png );
+    }
+
+    png->chunk[png->chunk_size++] = byte;
+
+    return;
+}
+
+
+// adds count (up to 32) bits of value, lowest first
+static void Put_Bits( png_type *png, uint32_t value, int count )
+{
+    png->bits |= (uint64_t)value << png->no_of_bits;
+    png->no_of_bits += count;
+
+    while( png->no_of_bits >= 8 )
+    {
+        Put_Byte( png, png->bits & 0xff );
+        png->bits >>= 8;
+        png->no_of_bits -= 8;
+    }
+
+    return;
+}
+
+
+// pads the bits to a whole byte
+static void Align_Bits( png_type *png )
+{
+    if( png->no_of_bits > 0 )
+    {
+        Put_Bits( png, 0, 8 - png->no_of_bits );
+    }
+
+    return;
+}
+
+
+//==========================
+//  HUFFMAN CODES
+//==========================
+
+static int Compare_Keys( const void *a, const void *b )
+{
+    uint64_t ka = *(const uint64_t *)a, kb = *(const uint64_t *)b;
+
+    return ( ka > kb ) - ( ka < kb );
+}
+
+
+// works out the code length of each of n symbols from how often they are used, none longer than
+// max_bits. unused symbols get 0 but at least two are always given a code
+static void Build_Lengths( const uint32_t *freq, int n, int max_bits, uint8_t *length )
+{
+    uint32_t weight[2 * PNG_MAX_SYMBOLS];
+    uint64_t key[PNG_MAX_SYMBOLS];
+    int symbol[PNG_MAX_SYMBOLS];
+    int parent[2 * PNG_MAX_SYMBOLS];
+    int depth[2 * PNG_MAX_SYMBOLS];
+    uint32_t scale = 0;
+    int no_of_leaves, next_leaf, next_node, no_of_nodes;
+    int i, a, b, longest;
+
+    memset( length, 0, n );
+
+    for( ;; )
+    {
+        // the leaves lightest first, scaled down each time the codes come out too long
+        no_of_leaves = 0;
+        for( i = 0; i < n; i++ )
+        {
+            if( freq[i] > 0 )
+            {
+                key[no_of_leaves++] = (uint64_t)( ( ( freq[i] - 1 ) >> scale ) + 1 ) << 16 | i;
+            }
+        }
+
+        // a code needs two symbols to be complete
+        if( no_of_leaves < 2 )
+        {
+            i = ( no_of_leaves == 1 ) ? (int)( key[0] & 0xffff ) : 1;
+            length[i] = 1;
+            length[( i == 0 ) ? 1 : 0] = 1;
+            return;
+        }
+
+        qsort( key, no_of_leaves, sizeof( uint64_t ), Compare_Keys );
+
+        for( i = 0; i < no_of_leaves; i++ )
+        {
+            weight[i] = key[i] >> 16;
+            symbol[i] = key[i] & 0xffff;
+        }
+
+        // the leaves and the nodes made from them both come out lightest first, so the two
+        // lightest are always at the front of one or the other
+        next_leaf = 0;
+        next_node = no_of_leaves;
+        for( no_of_nodes = no_of_leaves; no_of_nodes < 2 * no_of_leaves - 1; no_of_nodes++ )
+        {
+            if( next_leaf < no_of_leaves && ( next_node >= no_of_nodes || weight[next_leaf] <= weight[next_node] ) )
+            {
+                a = next_leaf++;
+            }
+            else
+            {
+                a = next_node++;
+            }
+
+            if( next_leaf < no_of_leaves && ( next_node >= no_of_nodes || weight[next_leaf] <= weight[next_node] ) )
+            {
+                b = next_leaf++;
+            }
+            else
+            {
+                b = next_node++;
+            }
+
+            weight[no_of_nodes] = weight[a] + weight[b];
+            parent[a] = no_of_nodes;
+            parent[b] = no_of_nodes;
+        }
+
+        // parents always come after their children
+        longest = 0;
+        depth[no_of_nodes - 1] = 0;
+        for( i = no_of_nodes - 2; i >= 0; i-- )
+        {
+            depth[i] = depth[parent[i]] + 1;
+            longest = ( i < no_of_leaves && depth[i] > longest ) ? depth[i] : longest;
+        }
+
+        if( longest <= max_bits )
+        {
+            for( i = 0; i < no_of_leaves; i++ )
+            {
+                length[symbol[i]] = depth[i];
+            }
+            return;
+        }
+
+        scale++;
+    }
+}
+
+
+// makes the canonical code for each symbol from the code lengths, bit reversed as deflate sends
+// codes highest bit first
+static void Build_Codes( const uint8_t *length, int n, uint16_t *code )
+{
+    int count[PNG_MAX_BITS + 1] = { 0 };
+    int next[PNG_MAX_BITS + 1];
+    int i, bits, value, reversed;
+
+    for( i = 0; i < n; i++ )
+    {
+        count[length[i]]++;
+    }
+    count[0] = 0;
+
+    value = 0;
+    for( bits = 1; bits <= PNG_MAX_BITS; bits++ )
+    {
+        value = ( value + count[bits - 1] ) << 1;
+        next[bits] = value;
+    }
+
+    for( i = 0; i < n; i++ )
+    {
+        if( length[i] == 0 )
+        {
+            code[i] = 0;
+            continue;
+        }
+
+        value = next[length[i]]++;
+        reversed = 0;
+        for( bits = 0; bits < length[i]; bits++ )
+        {
+            reversed = reversed << 1 | ( ( value >> bits ) & 1 );
+        }
+        code[i] = reversed;
+    }
+
+    return;
+}
+
+
+// the length code of a match 3 to 258 long, sets how many extra bits follow and their value
+static int Length_Code( int length, int *extra_bits, int *extra )
+{
+    int l = length - PNG_MIN_MATCH;
+    int top;
+
+    if( length == PNG_MAX_MATCH )
+    {
+        *extra_bits = 0;
+        *extra = 0;
+        return 285;
+    }
+
+    if( l < 8 )
+    {
+        *extra_bits = 0;
+        *extra = 0;
+        return 257 + l;
+    }
+
+    top = 31 - __builtin_clz( l );
+    *extra_bits = top - 2;
+    *extra = l & ( ( 1 << *extra_bits ) - 1 );
+
+    return 257 + 4 * ( top - 1 ) + ( ( l >> ( top - 2 ) ) & 3 );
+}
+
+
+// the distance code of a match 1 to PNG_WINDOW back, sets how many extra bits follow and their
+// value
+static int Distance_Code( int distance, int *extra_bits, int *extra )
+{
+    int d = distance - 1;
+    int top;
+
+    if( d < 4 )
+    {
+        *extra_bits = 0;
+        *extra = 0;
+        return d;
+    }
+
+    top = 31 - __builtin_clz( d );
+    *extra_bits = top - 1;
+    *extra = d & ( ( 1 << *extra_bits ) - 1 );
+
+    return 2 * top + ( ( d >> ( top - 1 ) ) & 1 );
+}
+
+
+//==========================
+//  DEFLATE
+//==========================
+
+// writes the symbols gathered so far as a block with its own Huffman codes
+static void Write_Block( png_type *png, int last )
+{
+    uint32_t literal_freq[PNG_LITERALS] = { 0 };
+    uint32_t distance_freq[PNG_DISTANCES] = { 0 };
+    uint32_t length_freq[PNG_CODE_LENGTHS] = { 0 };
+    uint8_t literal_length[PNG_LITERALS], distance_length[PNG_DISTANCES], length_length[PNG_CODE_LENGTHS];
+    uint16_t literal_code[PNG_LITERALS], distance_code[PNG_DISTANCES], length_code[PNG_CODE_LENGTHS];
+    uint8_t lengths[PNG_LITERALS + PNG_DISTANCES];
+    uint8_t run_symbol[PNG_LITERALS + PNG_DISTANCES];
+    uint8_t run_extra[PNG_LITERALS + PNG_DISTANCES];
+    int no_of_literals, no_of_distances, no_of_code_lengths, no_of_runs;
+    int i, j, run, code, extra_bits, extra;
+
+    for( i = 0; i < png->no_of_symbols; i++ )
+    {
+        if( png->symbol_distance[i] == 0 )
+        {
+            literal_freq[png->symbol_length[i]]++;
+        }
+        else
+        {
+            literal_freq[Length_Code( png->symbol_length[i], &extra_bits, &extra )]++;
+            distance_freq[Distance_Code( png->symbol_distance[i], &extra_bits, &extra )]++;
+        }
+    }
+    literal_freq[PNG_END_OF_BLOCK] = 1;
+
+    Build_Lengths( literal_freq, PNG_LITERALS, PNG_MAX_BITS, literal_length );
+    Build_Lengths( distance_freq, PNG_DISTANCES, PNG_MAX_BITS, distance_length );
+    Build_Codes( literal_length, PNG_LITERALS, literal_code );
+    Build_Codes( distance_length, PNG_DISTANCES, distance_code );
+
+    //======= CODE LENGTHS =======//
+
+    no_of_literals = PNG_LITERALS;
+    while( literal_length[no_of_literals - 1] == 0 )
+    {
+        no_of_literals--;
+    }
+
+    no_of_distances = PNG_DISTANCES;
+    while( no_of_distances > 1 && distance_length[no_of_distances - 1] == 0 )
+    {
+        no_of_distances--;
+    }
+
+    memcpy( lengths, literal_length, no_of_literals );
+    memcpy( lengths + no_of_literals, distance_length, no_of_distances );
+
+    // runs of zeros and repeats of the last length are sent as one code
+    no_of_runs = 0;
+    for( i = 0; i < no_of_literals + no_of_distances; i += run )
+    {
+        for( run = 1; i + run < no_of_literals + no_of_distances && lengths[i + run] == lengths[i]; run++ );
+
+        if( lengths[i] == 0 && run >= 11 )
+        {
+            run = ( run > 138 ) ? 138 : run;
+            run_symbol[no_of_runs] = 18;
+            run_extra[no_of_runs++] = run - 11;
+        }
+        else if( lengths[i] == 0 && run >= 3 )
+        {
+            run_symbol[no_of_runs] = 17;
+            run_extra[no_of_runs++] = run - 3;
+        }
+        else if( run >= 4 )
+        {
+            run = ( run > 7 ) ? 7 : run;
+            run_symbol[no_of_runs] = lengths[i];
+            run_extra[no_of_runs++] = 0;
+            run_symbol[no_of_runs] = 16;
+            run_extra[no_of_runs++] = run - 4;
+        }
+        else
+        {
+            run = 1;
+            run_symbol[no_of_runs] = lengths[i];
+            run_extra[no_of_runs++] = 0;
+        }
+    }
+
+    for( i = 0; i < no_of_runs; i++ )
+    {
+        length_freq[run_symbol[i]]++;
+    }
+
+    Build_Lengths( length_freq, PNG_CODE_LENGTHS, PNG_MAX_LENGTH_BITS, length_length );
+    Build_Codes( length_length, PNG_CODE_LENGTHS, length_code );
+
+    no_of_code_lengths = PNG_CODE_LENGTHS;
+    while( no_of_code_lengths > 4 && length_length[length_order[no_of_code_lengths - 1]] == 0 )
+    {
+        no_of_code_lengths--;
+    }
+
+    //======= HEADER =======//
+
+    Put_Bits( png, last, 1 );
+    Put_Bits( png, 2, 2 );
+    Put_Bits( png, no_of_literals - 257, 5 );
+    Put_Bits( png, no_of_distances - 1, 5 );
+    Put_Bits( png, no_of_code_lengths - 4, 4 );
+
+    for( i = 0; i < no_of_code_lengths; i++ )
+    {
+        Put_Bits( png, length_length[length_order[i]], 3 );
+    }
+
+    for( i = 0; i < no_of_runs; i++ )
+    {
+        Put_Bits( png, length_code[run_symbol[i]], length_length[run_symbol[i]] );
+
+        if( run_symbol[i] >= 16 )
+        {
+            Put_Bits( png, run_extra[i], ( run_symbol[i] == 16 ) ? 2 : ( run_symbol[i] == 17 ) ? 3 : 7 );
+        }
+    }
+
+    //======= DATA =======//
+
+    for( i = 0; i < png->no_of_symbols; i++ )
+    {
+        j = png->symbol_length[i];
+
+        if( png->symbol_distance[i] == 0 )
+        {
+            Put_Bits( png, literal_code[j], literal_length[j] );
+            continue;
+        }
+
+        code = Length_Code( j, &extra_bits, &extra );
+        Put_Bits( png, literal_code[code], literal_length[code] );
+        Put_Bits( png, extra, extra_bits );
+
+        code = Distance_Code( png->symbol_distance[i], &extra_bits, &extra );
+        Put_Bits( png, distance_code[code], distance_length[code] );
+        Put_Bits( png, extra, extra_bits );
+    }
+
+    Put_Bits( png, literal_code[PNG_END_OF_BLOCK], literal_length[PNG_END_OF_BLOCK] );
+
+    png->no_of_symbols = 0;
+
+    return;
+}
+
+
+static void Add_Symbol( png_type *png, int length, int distance )
+{
+    png->symbol_length[png->no_of_symbols] = length;
+    png->symbol_distance[png->no_of_symbols] = distance;
+
+    if( ++png->no_of_symbols == PNG_BLOCK_SYMBOLS )
+    {
+        Write_Block( png, 0 );
+    }
+
+    return;
+}
+
+
+static int Hash( const uint8_t *data )
+{
+    return ( ( data[0] << 10 ) ^ ( data[1] << 5 ) ^ data[2] ) & ( PNG_HASH_SIZE - 1 );
+}
+
+
+// how many bytes at a and b are the same, up to longest. compared a word at a time
+static int Match_Length( const uint8_t *a, const uint8_t *b, int longest )
+{
+    uint64_t wa, wb;
+    int length = 0;
+
+    while( length + 8 <= longest )
+    {
+        memcpy( &wa, a + length, 8 );
+        memcpy( &wb, b + length, 8 );
+
+        if( wa != wb )
+        {
+            // the first byte that differs, the lowest one on little endian machines
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return length + __builtin_ctzll( wa ^ wb ) / 8;
+#else
+            return length + __builtin_clzll( wa ^ wb ) / 8;
+#endif
+        }
+
+        length += 8;
+    }
+
+    while( length < longest && a[length] == b[length] )
+    {
+        length++;
+    }
+
+    return length;
+}
+
+
+// remembers position as the latest with its hash, returns the one before it
+static int Insert_Position( png_type *png, int position )
+{
+    int h = Hash( &png->window[position] );
+    int previous = png->head[h];
+
+    png->prev[position & ( PNG_WINDOW - 1 )] = previous;
+    png->head[h] = position;
+
+    return previous;
+}
+
+
+// compresses the window up to where there are still PNG_LOOKAHEAD bytes after, or to the end if
+// there is nothing more to come
+static void Compress( png_type *png, int finish )
+{
+    const uint8_t *window = png->window;
+    int end = finish ? png->window_size : png->window_size - PNG_LOOKAHEAD;
+    int position = png->position;
+    int candidate, chain, length, best_length, best_distance, longest;
+
+    while( position < end )
+    {
+        best_length = 0;
+        best_distance = 0;
+        longest = png->window_size - position;
+        longest = ( longest > PNG_MAX_MATCH ) ? PNG_MAX_MATCH : longest;
+
+        if( longest >= PNG_MIN_MATCH )
+        {
+            candidate = Insert_Position( png, position );
+
+            for( chain = 0; chain < PNG_MAX_CHAIN && candidate >= 0 && position - candidate <= PNG_WINDOW; chain++ )
+            {
+                // a longer match has to get past the end of the best so far
+                if( window[candidate + best_length] == window[position + best_length] )
+                {
+                    length = Match_Length( window + candidate, window + position, longest );
+
+                    if( length > best_length )
+                    {
+                        best_length = length;
+                        best_distance = position - candidate;
+
+                        if( length >= PNG_GOOD_MATCH || length == longest )
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                candidate = png->prev[candidate & ( PNG_WINDOW - 1 )];
+            }
+        }
+
+        if( best_length < PNG_MIN_MATCH )
+        {
+            Add_Symbol( png, window[position], 0 );
+            position++;
+            continue;
+        }
+
+        Add_Symbol( png, best_length, best_distance );
+
+        // the positions inside the match can still start later matches
+        for( length = 1; length < best_length; length++ )
+        {
+            if( position + length + PNG_MIN_MATCH <= png->window_size )
+            {
+                Insert_Position( png, position + length );
+            }
+        }
+
+        position += best_length;
+    }
+
+    png->position = position;
+
+    return;
+}
+
+
+// drops the oldest half of the full window, which nothing can match any more
+static void Slide_Window( png_type *png )
+{
+    int i;
+
+    memmove( png->window, png->window + PNG_WINDOW, PNG_WINDOW );
+    png->window_size -= PNG_WINDOW;
+    png->position -= PNG_WINDOW;
+
+    for( i = 0; i < PNG_HASH_SIZE; i++ )
+    {
+        png->head[i] = ( png->head[i] >= PNG_WINDOW ) ? png->head[i] - PNG_WINDOW : -1;
+    }
+
+    for( i = 0; i < PNG_WINDOW; i++ )
+    {
+        png->prev[i] = ( png->prev[i] >= PNG_WINDOW ) ? png->prev[i] - PNG_WINDOW : -1;
+    }
+
+    return;
+}
+
+
+static uint32_t Adler32( uint32_t adler, const uint8_t *data, int size )
+{
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    int n;
+
+    while( size > 0 )
+    {
+        // the most bytes before b can overflow
+        n = ( size > 5552 ) ? 5552 : size;
+        size -= n;
+
+        while( n-- > 0 )
+        {
+            a += *data++;
+            b += a;
+        }
+
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return b << 16 | a;
+}
+
+
+// adds size more bytes of image data, compressing what it can
+static void Deflate( png_type *png, const uint8_t *data, int size )
+{
+    int n;
+
+    png->adler = Adler32( png->adler, data, size );
+
+    while( size > 0 )
+    {
+        if( png->window_size == 2 * PNG_WINDOW )
+        {
+            Slide_Window( png );
+        }
+
+        n = 2 * PNG_WINDOW - png->window_size;
+        n = ( n > size ) ? size : n;
+
+        memcpy( png->window + png->window_size, data, n );
+        png->window_size += n;
+        data += n;
+        size -= n;
+
+        Compress( png, 0 );
+    }
+
+    return;
+}
+
+
+//==========================
+//  IMAGES
+//==========================
+
+// starts an image in a file that is open for writing, see PNG_Open()
+static png_type *Start( FILE *file, int w, int h, int bit_depth, const uint32_t *palette, int no_of_colors )
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    uint8_t header[13], colors[3 * 256], alpha[256];
+    uint8_t rgba[4];
+    int i, no_of_alphas;
+
+    png_type *png = UTI_EC_Malloc( sizeof( png_type ) );
+    memset( png, 0, offsetof( png_type, window ) );
+
+    png->file = file;
+    png->w = w;
+    png->h = h;
+    png->bit_depth = bit_depth;
+    png->row_size = 1 + ( w * bit_depth + 7 ) / 8;
+    png->row = UTI_EC_Malloc( png->row_size );
+    png->window_size = 0;
+    png->position = 0;
+    png->adler = 1;
+    png->no_of_symbols = 0;
+    png->bits = 0;
+    png->no_of_bits = 0;
+    png->chunk_size = 0;
+
+    for( i = 0; i < PNG_HASH_SIZE; i++ )
+    {
+        png->head[i] = -1;
+    }
+
+    //======= HEADER =======//
+
+    Put_U32( header, w );
+    Put_U32( header + 4, h );
+    header[8] = bit_depth;
+    header[9] = 3;                      // indexed colour
+    header[10] = 0;                     // deflate
+    header[11] = 0;                     // filtered a row at a time
+    header[12] = 0;                     // not interlaced
+
+    // the alpha of each colour, only up to the last that isn't opaque
+    no_of_alphas = 0;
+    for( i = 0; i < no_of_colors; i++ )
+    {
+        memcpy( rgba, &palette[i], 4 );
+        colors[3 * i + 0] = rgba[0];
+        colors[3 * i + 1] = rgba[1];
+        colors[3 * i + 2] = rgba[2];
+        alpha[i] = rgba[3];
+        no_of_alphas = ( rgba[3] != 0xff ) ? i + 1 : no_of_alphas;
+    }
+
+    Write_Bytes( png, signature, 8 );
+    Write_Chunk( png, "IHDR", header, 13 );
+    Write_Chunk( png, "PLTE", colors, 3 * no_of_colors );
+    if( no_of_alphas > 0 )
+    {
+        Write_Chunk( png, "tRNS", alpha, no_of_alphas );
+    }
+
+    // zlib header, a 32K window and no dictionary
+    Put_Byte( png, 0x78 );
+    Put_Byte( png, 0x9c );
+
+    return png;
+}
+
+
+// finishes the image, closes its file and frees it. sets the size of the file if file_size isn't
+// NULL, returns 1 if it was all written
+static int Finish( png_type *png, size_t *file_size )
+{
+    uint8_t adler[4];
+    int i;
+
+    if( png->rows_written < png->h )
+    {
+        UTI_Print_Error( "Image closed before all its rows were written" );
+        png->failed = 1;
+    }
+
+    Compress( png, 1 );
+    Write_Block( png, 1 );
+    Align_Bits( png );
+
+    Put_U32( adler, png->adler );
+    for( i = 0; i < 4; i++ )
+    {
+        Put_Byte( png, adler[i] );
+    }
+
+    Flush_Chunk( png );
+    Write_Chunk( png, "IEND", NULL, 0 );
+
+    if( fclose( png->file ) != 0 )
+    {
+        png->failed = 1;
+    }
+
+    if( png->failed )
+    {
+        UTI_Print_Error( "Unable to write image" );
+    }
+
+    int written = ( png->failed == 0 );
+    if( file_size != NULL )
+    {
+        *file_size = png->file_size;
+    }
+
+    UTI_EC_Free( png->row );
+    UTI_EC_Free( png );
+
+    return written;
+}
+
+
+//==========================
+//  BENCHMARK
+//==========================
+
+// fills a w by h image with 16 by 16 tiles that look a bit like sprites, a few used more than
+// once and some gaps between them
+static void Make_Test_Image( uint8_t *pixels, int w, int h )
+{
+    uint32_t seed = 12345, tile_seed;
+    int x, y, tx, ty;
+
+    memset( pixels, 0, (size_t)w * h );
+
+    for( ty = 0; ty + 16 <= h; ty += 17 )
+    {
+        for( tx = 0; tx + 16 <= w; tx += 17 )
+        {
+            seed = seed * 1103515245 + 12345;
+            tile_seed = ( seed >> 16 ) % 700;
+
+            for( y = 0; y < 16; y++ )
+            {
+                for( x = 0; x < 16; x++ )
+                {
+                    // a blob of a few colours in the middle of the tile
+                    int dx = x - 8, dy = y - 8;
+                    if( dx * dx + dy * dy < 30 + (int)( tile_seed % 30 ) )
+                    {
+                        pixels[(size_t)( ty + y ) * w + tx + x] = 1 + ( ( tile_seed + x / 3 + y / 4 ) % 64 );
+                    }
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+
+//====================================================================
+//  PUBLIC FUNCTIONS
+//====================================================================
+
+// creates filename and starts a w by h image of bit_depth (4 or 8) bits per pixel, returns NULL
+// on failure
+png_type    *PNG_Open( const char *filename, int w, int h, int bit_depth, const uint32_t *palette,
+                       int no_of_colors )
+{
+    if( w <= 0 || h <= 0 || ( bit_depth != 4 && bit_depth != 8 ) || no_of_colors <= 0 ||
+        no_of_colors > ( 1 << bit_depth ) )
+    {
+        UTI_Print_Error( "Invalid image" );
+        return NULL;
+    }
+
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create image" );
+        return NULL;
+    }
+
+    return Start( file, w, h, bit_depth, palette, no_of_colors );
+}
+
+
+// compresses the next no_of_rows rows of the image, returns 1 on success
+int         PNG_Write_Rows( png_type *png, const uint8_t *pixels, int no_of_rows )
+{
+    int i, x;
+
+    if( png->rows_written + no_of_rows > png->h )
+    {
+        UTI_Print_Error( "More rows than the image has" );
+        png->failed = 1;
+        return 0;
+    }
+
+    for( i = 0; i < no_of_rows; i++, pixels += png->w )
+    {
+        // indexed images compress best unfiltered
+        png->row[0] = 0;
+
+        if( png->bit_depth == 8 )
+        {
+            memcpy( png->row + 1, pixels, png->w );
+        }
+        else
+        {
+            memset( png->row + 1, 0, png->row_size - 1 );
+            for( x = 0; x < png->w; x++ )
+            {
+                png->row[1 + x / 2] |= ( pixels[x] & 0x0f ) << ( ( x & 1 ) ? 0 : 4 );
+            }
+        }
+
+        Deflate( png, png->row, png->row_size );
+    }
+
+    png->rows_written += no_of_rows;
+
+    return png->failed == 0;
+}
+
+
+// finishes the image and closes it, returns 1 if the whole file was written
+int         PNG_Close( png_type *png )
+{
+    return Finish( png, NULL );
+}
+
+
+// times writing a w by h 8 bit image like a sprite sheet and prints MB/s of pixels compressed
+void        PNG_Benchmark( int w, int h, int iterations )
+{
+    uint8_t *pixels = UTI_EC_Malloc( (size_t)w * h );
+    uint32_t palette[65];
+    struct timespec start, end;
+    size_t size = 0;
+    double ms;
+    int i;
+
+    Make_Test_Image( pixels, w, h );
+
+    // a grey ramp after transparent, as the main palette is only made with a window
+    palette[0] = 0;
+    for( i = 1; i < 65; i++ )
+    {
+        uint8_t rgba[4] = { i * 4, i * 4, i * 4, 0xff };
+        memcpy( &palette[i], rgba, 4 );
+    }
+
+    printf( "PNG encoder, %dx%d 8 bit sheet, %d iterations\n", w, h, iterations );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for( i = 0; i < iterations; i++ )
+    {
+        // a temporary file so the disk isn't what is timed
+        FILE *file = tmpfile();
+        if( file == NULL )
+        {
+            UTI_Print_Error( "Unable to create temporary file" );
+            break;
+        }
+
+        png_type *png = Start( file, w, h, 8, palette, 65 );
+        PNG_Write_Rows( png, pixels, h );
+        Finish( png, &size );
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    ms = ( ( end.tv_sec - start.tv_sec ) * 1000.0 + ( end.tv_nsec - start.tv_nsec ) / 1000000.0 ) / iterations;
+
+    printf( "%-8s %7.3fms %6.1fMB/s %9zu bytes, %.1f%% of the pixels\n", "deflate", ms,
+            (double)w * h / ( 1024.0 * 1024.0 ) * 1000.0 / ms, size, 100.0 * size / ( (double)w * h ) );
+
+    UTI_EC_Free( pixels );
+
+    return;
+}
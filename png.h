@@ -0,0 +1,47 @@
+//===================================================================
+//
+//  png.h
+//
+//  writes indexed colour PNG images a few rows at a time
+//
+//===================================================================
+
+#ifndef __png_h__
+#define __png_h__
+
+#include <stdint.h>
+
+
+//===================================================================
+//  TYPES
+//===================================================================
+
+// an image being written, see PNG_Open()
+typedef struct png_s png_type;
+
+
+//===================================================================
+//  PROTOTYPES
+//===================================================================
+
+// creates filename and starts a w by h image of bit_depth (4 or 8) bits per pixel. palette has
+// no_of_colors colours, R, G, B, A in memory as GRA_Create_Color() makes them, up to 16 for 4 bit
+// images and 256 for 8 bit. returns NULL on failure
+png_type    *PNG_Open( const char *filename, int w, int h, int bit_depth, const uint32_t *palette,
+                       int no_of_colors );
+
+// compresses the next no_of_rows rows of the image, w pixels of one byte each to a row, and
+// writes out what is ready. only a window of the image is held however big it is. returns 1 on
+// success
+int         PNG_Write_Rows( png_type *png, const uint8_t *pixels, int no_of_rows );
+
+// finishes the image and closes it, png is freed whatever happens. returns 1 if every row was
+// given and the whole file was written
+int         PNG_Close( png_type *png );
+
+// times writing a w by h 8 bit image like a sprite sheet and prints MB/s of pixels compressed
+void        PNG_Benchmark( int w, int h, int iterations );
+
+
+
+#endif // __png_h__
@@ -0,0 +1,241 @@
+//====================================================================
+//
+//  profile.c
+//
+//  times each stage of a frame and shows where the time goes
+//
+//====================================================================
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "profile.h"
+
+
+//====================================================================
+//  CONSTANTS
+//====================================================================
+
+#define PRF_TOTAL               PRF_NO_OF_STAGES        // where the whole frame's time is kept
+#define PRF_NO_OF_TIMES         ( PRF_NO_OF_STAGES + 1 )
+
+#define PRF_OVERLAY_X           4           // where the overlay's text starts
+#define PRF_OVERLAY_Y           4
+#define PRF_OVERLAY_W           296         // big enough for the longest line and a border
+#define PRF_LINE_HEIGHT         10
+
+
+//====================================================================
+//  GLOBALS
+//====================================================================
+
+// what each time is called on the overlay and in the CSV header
+static const char           *time_name[PRF_NO_OF_TIMES] = { "interface", "edit_sprite", "buttons", "mouse",
+                                                            "refresh", "total" };
+
+static float                frame_times[PRF_MAX_FRAMES][PRF_NO_OF_TIMES];  // ms, a ring of the last frames
+static int                  next_frame          = 0;            // where the next frame is stored
+static int                  no_of_frames        = 0;            // frames stored, up to PRF_MAX_FRAMES
+
+static float                current[PRF_NO_OF_TIMES];           // the frame being timed
+static struct timespec      frame_start;
+static struct timespec      stage_start[PRF_NO_OF_STAGES];
+
+static int                  overlay_shown       = 0;
+
+
+//====================================================================
+//  PRIVATE FUNCTIONS
+//====================================================================
+
+static float Ms_Since( const struct timespec *start )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( now.tv_sec - start->tv_sec ) * 1000.0f + ( now.tv_nsec - start->tv_nsec ) / 1000000.0f;
+}
+
+
+static int Compare_Floats( const void *a, const void *b )
+{
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+
+    return ( fa > fb ) - ( fa < fb );
+}
+
+
+// the stored frame n frames after the oldest one
+static float *Stored_Frame( int n )
+{
+    return frame_times[( next_frame - no_of_frames + n + PRF_MAX_FRAMES ) % PRF_MAX_FRAMES];
+}
+
+
+// finds the least, mean and 99th percentile of time t over the stored frames
+static void Time_Stats( int t, float *sorted, float *min, float *avg, float *p99 )
+{
+    int i;
+    float total = 0.0f;
+
+    for( i = 0; i < no_of_frames; i++ )
+    {
+        sorted[i] = Stored_Frame( i )[t];
+        total += sorted[i];
+    }
+
+    qsort( sorted, no_of_frames, sizeof( float ), Compare_Floats );
+
+    // the time 99 in 100 frames are at or under, rounding up
+    *min = sorted[0];
+    *avg = total / no_of_frames;
+    *p99 = sorted[( no_of_frames * 99 + 99 ) / 100 - 1];
+
+    return;
+}
+
+
+//====================================================================
+//  PUBLIC FUNCTIONS
+//====================================================================
+
+void PRF_Begin_Frame()
+{
+    memset( current, 0, sizeof( current ) );
+    clock_gettime( CLOCK_MONOTONIC, &frame_start );
+
+    return;
+}
+
+
+void PRF_Start( int stage )
+{
+    clock_gettime( CLOCK_MONOTONIC, &stage_start[stage] );
+
+    return;
+}
+
+
+void PRF_Stop( int stage )
+{
+    current[stage] += Ms_Since( &stage_start[stage] );
+
+    return;
+}
+
+
+void PRF_End_Frame()
+{
+    current[PRF_TOTAL] = Ms_Since( &frame_start );
+
+    memcpy( frame_times[next_frame], current, sizeof( current ) );
+    next_frame = ( next_frame + 1 ) % PRF_MAX_FRAMES;
+
+    if( no_of_frames < PRF_MAX_FRAMES )
+    {
+        no_of_frames++;
+    }
+
+    return;
+}
+
+
+int PRF_Toggle_Overlay()
+{
+    overlay_shown = !overlay_shown;
+
+    return overlay_shown;
+}
+
+
+int PRF_Overlay_Shown()
+{
+    return overlay_shown;
+}
+
+
+void PRF_Draw_Overlay()
+{
+    if( overlay_shown == 0 )
+    {
+        return;
+    }
+
+    uint32_t white = GRA_Create_Color( 0xff, 0xff, 0xff, 0xff );
+    uint32_t black = GRA_Create_Color( 0x00, 0x00, 0x00, 0xff );
+    float sorted[PRF_MAX_FRAMES];
+    float min, avg, p99;
+    char line[64];
+    int t, y = PRF_OVERLAY_Y;
+
+    GRA_Clear_Rectangle( 0, 0, PRF_OVERLAY_W, PRF_OVERLAY_Y * 2 + PRF_LINE_HEIGHT * ( PRF_NO_OF_TIMES + 2 ) );
+
+    sprintf( line, "ms over %d frames", no_of_frames );
+    GRA_Simple_Text( line, PRF_OVERLAY_X, y, white, black, 1 );
+    y += PRF_LINE_HEIGHT;
+
+    sprintf( line, "%-12s %7s %7s %7s", "stage", "min", "avg", "p99" );
+    GRA_Simple_Text( line, PRF_OVERLAY_X, y, white, black, 1 );
+    y += PRF_LINE_HEIGHT;
+
+    if( no_of_frames == 0 )
+    {
+        return;
+    }
+
+    for( t = 0; t < PRF_NO_OF_TIMES; t++ )
+    {
+        Time_Stats( t, sorted, &min, &avg, &p99 );
+
+        sprintf( line, "%-12s %7.3f %7.3f %7.3f", time_name[t], min, avg, p99 );
+        GRA_Simple_Text( line, PRF_OVERLAY_X, y, white, black, 1 );
+        y += PRF_LINE_HEIGHT;
+    }
+
+    return;
+}
+
+
+int PRF_Write_CSV( const char *filename )
+{
+    FILE *file = fopen( filename, "w" );
+
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create profile file" );
+        return 0;
+    }
+
+    int i, t;
+
+    fprintf( file, "frame" );
+    for( t = 0; t < PRF_NO_OF_TIMES; t++ )
+    {
+        fprintf( file, ",%s", time_name[t] );
+    }
+    fprintf( file, "\n" );
+
+    for( i = 0; i < no_of_frames; i++ )
+    {
+        fprintf( file, "%d", i );
+        for( t = 0; t < PRF_NO_OF_TIMES; t++ )
+        {
+            fprintf( file, ",%.4f", Stored_Frame( i )[t] );
+        }
+        fprintf( file, "\n" );
+    }
+
+    if( fclose( file ) != 0 )
+    {
+        UTI_Print_Error( "Unable to write profile file" );
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,58 @@
+//===================================================================
+//
+//  profile.h
+//
+//  times each stage of a frame and shows where the time goes
+//
+//===================================================================
+
+#ifndef __profile_h__
+#define __profile_h__
+
+
+//===================================================================
+//  CONSTANTS
+//===================================================================
+
+#define PRF_MAX_FRAMES          512         // frames kept, older ones are overwritten
+
+// the timed stages of a frame, in the order they run
+#define PRF_DRAW_INTERFACE      0
+#define PRF_DRAW_EDIT_SPRITE    1
+#define PRF_CHECK_INPUT         2
+#define PRF_MOUSE_INPUT         3
+#define PRF_REFRESH_WINDOW      4
+#define PRF_NO_OF_STAGES        5
+
+
+//===================================================================
+//  PROTOTYPES
+//===================================================================
+
+// starts timing a frame, stage times are zero until their stage runs
+void        PRF_Begin_Frame();
+
+// starts and stops the timer for stage, a stage run more than once in a frame adds up
+void        PRF_Start( int stage );
+void        PRF_Stop( int stage );
+
+// stores the frame's stage times and its total in the ring of the last PRF_MAX_FRAMES frames
+void        PRF_End_Frame();
+
+// shows or hides the overlay, returns 1 if it is now shown
+int         PRF_Toggle_Overlay();
+
+// returns 1 while the overlay is shown
+int         PRF_Overlay_Shown();
+
+// draws the min, average and 99th percentile time of each stage over the stored frames in the
+// top left corner of the screen, if the overlay is shown
+void        PRF_Draw_Overlay();
+
+// writes the stored frames to filename as CSV, oldest first, one line of stage times in
+// milliseconds to a frame. returns 1 on success
+int         PRF_Write_CSV( const char *filename );
+
+
+
+#endif // __profile_h__
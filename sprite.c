@@ -9,31 +9,119 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include "utility.h"
 #include "sprite.h"
 #include "defs.h"
+#include "thread.h"
 
 
 //====================================================================
 //  CONSTANTS
 //====================================================================
 
+#define SPRITE_ARENA_ALIGN          64          // cache line
+#define SPRITE_HUGE_PAGE            ( 1 << 21 ) // arenas this big are aligned to it and use huge pages
+#define SPRITE_ARENA_START          64          // sprites room is made for at first
+#define SPRITE_LOAD_BLOCK           64          // sprites a loader fills in at a time
+#define SPRITE_NIBBLES              ( SPRITE_SIZE / 2 )
+#define SPRITE_DEFINITIONS_START    64          // definitions room is made for at first, a power of 2
+#define SPRITE_THREAD_BATCH         4096        // sprites in each job of a bulk operation
 
 
+//====================================================================
+//  TYPES
+//====================================================================
+
+// a sprite held two pixels to a byte, the first in the low nibble, the same order as a packed
+// file. only sprites with no pixel above 15 fit
+struct packed_sprite_s {    uint8_t         nibbles[SPRITE_NIBBLES];
+                            uint32_t        palette;
+                       };
+
+typedef struct packed_sprite_s packed_sprite_type;
+
+// a sprite whose definition is shared, the same as a shared sprite record in a file
+struct shared_sprite_s {    uint32_t        definition;         // id of its definition
+                            uint32_t        palette;
+                       };
+
+typedef struct shared_sprite_s shared_sprite_type;
+
+// the sprites a bulk operation changes, first to end-1, or the sprites listed at those places in
+// index when it isn't NULL. each job of SPRITE_THREAD_BATCH of them can run on a thread of its own
+struct spr_batch_s {        const int       *index;
+                            int             first;
+                            int             end;
+                            int             op;                 // SPR_OP_
+                            int             value;
+                   };
+
+typedef struct spr_batch_s spr_batch_type;
 
 
 //====================================================================
 //  FILE VARIABLES
 //====================================================================
 
-static sprite_type                  *sprite[MAX_SPRITES];
+// every sprite is kept in one block in index order, so indices never change but the block
+// moves when it has to grow
+static sprite_type                  *sprite = NULL;
+static int                          sprite_capacity = 0;
 static int                          no_of_sprites = 0;
+static int                          sprites_borrowed = 0;       // sprite is memory we don't own
+
+// after SPR_Pack_Storage() the sprites are kept in packed_sprite instead, at half the size, until
+// a pixel above 15 is stored. sprite is NULL while they are
+static packed_sprite_type           *packed_sprite = NULL;
+static int                          sprites_packed = 0;
+
+// after SPR_Share_Storage() each sprite is kept in shared_sprite as the id of its definition,
+// and each different definition is kept once, packed if sprites are. changing a sprite swaps
+// its definition for another, so sprites that used the same one are left as they were
+static shared_sprite_type           *shared_sprite = NULL;
+static int                          sprites_shared = 0;
+
+// definitions by id with how many sprites use each, found by their hash through a table of
+// chains. ids no sprite uses are chained through definition_next from free_definition
+static uint8_t                      *definition_data = NULL;    // Definition_Size() each
+static uint32_t                     *definition_refs = NULL;
+static uint32_t                     *definition_hash = NULL;
+static int                          *definition_next = NULL;
+static int                          *definition_bucket = NULL;  // definition_capacity long
+static int                          definition_capacity = 0;
+static int                          definition_limit = 0;       // ids below this have been used
+static int                          no_of_definitions = 0;      // in use
+static int                          free_definition = -1;
+
+// bumped whenever a sprite changes so that anything drawn from it knows to redraw, values come
+// from one counter so a reused index never matches an old generation. sprite_capacity long
+static uint32_t                     *sprite_generation = NULL;
+static uint32_t                     generation_counter = 0;
+
+// sprites changed since the last save, see SPR_Get_Changed_Sprites(). generations above
+// saved_generation are changes, so a sprite is listed once however often it changes
+static int                          *changed_sprite = NULL;
+static int                          no_of_changed = 0;
+static int                          changed_capacity = 0;
+static uint32_t                     saved_generation = 0;
+
+// sprites given by SPR_Load_Sprites_Lazily() are filled in by the loader a block at a time, the
+// first time one of them is used. only sprites below lazy_end can be unloaded, block_loaded has
+// a flag for each SPRITE_LOAD_BLOCK of them
+static spr_loader_type              sprite_loader = NULL;
+static int                          lazy_end = 0;
+static uint8_t                      *block_loaded = NULL;
+static int                          blocks_unloaded = 0;
 
 
 static sprite_type                  spr_buffer;                 // for copy/paste
-static uint8_t                      spr_line_1[SPRITE_W];       // for shift/flip
-static uint8_t                      spr_line_2[SPRITE_W];
+static sprite_type                  spr_unpacked;               // a packed or shared sprite being used, see Open_Sprite()
+static sprite_type                  spr_load_buffer[SPRITE_LOAD_BLOCK];     // a block for the loader while packed or shared
+static uint8_t                      spr_definition[SPRITE_SIZE];            // see SPR_Get_Definition()
 
 //====================================================================
 //  PRIVATE FUNCTIONS
@@ -47,441 +135,2056 @@ void Copy_Sprite( sprite_type *spr1, sprite_type *spr2 )
     return;
 }
 
-void Copy_Line_To_Sprite( sprite_type *spr, uint8_t *line, int line_index )
+//==========================
+//  TRANSFORMS
+//==========================
+
+// each changes the SPRITE_SIZE pixels of one sprite in place. they keep no state, so any number
+// of sprites can be changed at once on different threads. a row of SPRITE_W (16) pixels is read
+// into two 64 bit words before any of it is written, as copying it through memory a byte out of
+// line stalls on every row
+
+static void Shift_Pixels_Left( uint8_t *pixels )
 {
-    if( line_index < 0 || line_index >= SPRITE_H )
+    uint8_t *row, first;
+    uint64_t low, high;
+
+    for( row = pixels; row < pixels + SPRITE_SIZE; row += SPRITE_W )
     {
-        return;
+        first = row[0];
+        memcpy( &low, row + 1, 8 );
+        memcpy( &high, row + 8, 8 );
+
+        memcpy( row, &low, 8 );
+        memcpy( row + 7, &high, 8 );
+        row[SPRITE_W-1] = first;
     }
 
-    int i, row_start = line_index * SPRITE_W;
-    
-    for( i = 0; i < SPRITE_W; i++ )
+    return;
+}
+
+
+static void Shift_Pixels_Right( uint8_t *pixels )
+{
+    uint8_t *row, last;
+    uint64_t low, high;
+
+    for( row = pixels; row < pixels + SPRITE_SIZE; row += SPRITE_W )
     {
-        spr->definition[row_start + i] = line[i];
+        last = row[SPRITE_W-1];
+        memcpy( &low, row, 8 );
+        memcpy( &high, row + 7, 8 );
+
+        memcpy( row + 1, &low, 8 );
+        memcpy( row + 8, &high, 8 );
+        row[0] = last;
     }
 
     return;
 }
 
 
-void Copy_Line_From_Sprite( sprite_type *spr, uint8_t *line, int line_index )
+static void Shift_Pixels_Up( uint8_t *pixels )
+{
+    uint8_t line[SPRITE_W];
+
+    memcpy( line, pixels, SPRITE_W );
+    memmove( pixels, pixels + SPRITE_W, SPRITE_SIZE - SPRITE_W );
+    memcpy( pixels + SPRITE_SIZE - SPRITE_W, line, SPRITE_W );
+
+    return;
+}
+
+
+static void Shift_Pixels_Down( uint8_t *pixels )
+{
+    uint8_t line[SPRITE_W];
+
+    memcpy( line, pixels + SPRITE_SIZE - SPRITE_W, SPRITE_W );
+    memmove( pixels + SPRITE_W, pixels, SPRITE_SIZE - SPRITE_W );
+    memcpy( pixels, line, SPRITE_W );
+
+    return;
+}
+
+
+// reverses the order of the bytes in a word, whichever way round they are stored. compilers
+// turn this into a single instruction
+static uint64_t Reverse_Bytes( uint64_t x )
+{
+    x = ( x >> 32 ) | ( x << 32 );
+    x = ( ( x & 0xffff0000ffff0000ull ) >> 16 ) | ( ( x & 0x0000ffff0000ffffull ) << 16 );
+    x = ( ( x & 0xff00ff00ff00ff00ull ) >> 8 ) | ( ( x & 0x00ff00ff00ff00ffull ) << 8 );
+
+    return x;
+}
+
+
+static void Flip_Pixels_Horizontal( uint8_t *pixels )
 {
-    if( line_index < 0 || line_index >= SPRITE_H )
+    uint8_t *row;
+    uint64_t low, high;
+
+    for( row = pixels; row < pixels + SPRITE_SIZE; row += SPRITE_W )
     {
-        return;
+        memcpy( &low, row, 8 );
+        memcpy( &high, row + 8, 8 );
+
+        low = Reverse_Bytes( low );
+        high = Reverse_Bytes( high );
+
+        memcpy( row, &high, 8 );
+        memcpy( row + 8, &low, 8 );
     }
 
-    int i, row_start = line_index * SPRITE_W;
+    return;
+}
+
+
+static void Flip_Pixels_Vertical( uint8_t *pixels )
+{
+    uint8_t line[SPRITE_W];
+    uint8_t *top = pixels, *bottom = pixels + SPRITE_SIZE - SPRITE_W;
 
-    for( i = 0; i < SPRITE_W; i++ )
+    for( ; top < bottom; top += SPRITE_W, bottom -= SPRITE_W )
     {
-        line[i] = spr->definition[row_start + i];
+        memcpy( line, top, SPRITE_W );
+        memcpy( top, bottom, SPRITE_W );
+        memcpy( bottom, line, SPRITE_W );
     }
 
     return;
 }
 
 
-//====================================================================
-//  PUBLIC FUNCTION BODIES
-//====================================================================
+// set all pixels to 0 (transparent)
+static void Clear_Pixels( uint8_t *pixels )
+{
+    memset( pixels, 0, SPRITE_SIZE );
 
-void SPR_Init()
+    return;
+}
+
+
+// indexed by SPR_OP_, NULL for operations that leave the pixels alone
+static void (*spr_transform[SPR_NO_OF_OPS])( uint8_t *pixels ) = {
+    Shift_Pixels_Left,
+    Shift_Pixels_Right,
+    Shift_Pixels_Up,
+    Shift_Pixels_Down,
+    Flip_Pixels_Horizontal,
+    Flip_Pixels_Vertical,
+    Clear_Pixels,
+    NULL
+};
+
+
+
+//==========================
+//  NIBBLE KERNELS
+//==========================
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#   define SPR_X86_KERNELS
+#   include <immintrin.h>
+#endif
+
+// packs and unpacks whole sprite definitions, SPRITE_SIZE pixels to SPRITE_NIBBLES bytes. pack
+// returns 0 if a pixel is above 15, nibbles are left undefined then
+struct spr_kernels_s    {
+                            const char      *name;
+
+                            int             (*pack)( uint8_t *nibbles, const uint8_t *pixels );
+                            void            (*unpack)( uint8_t *pixels, const uint8_t *nibbles );
+                        };
+typedef struct spr_kernels_s spr_kernels_type;
+
+static spr_kernels_type     *kernels            = NULL;         // set by Init_Kernels()
+
+
+static int Pack_Scalar( uint8_t *nibbles, const uint8_t *pixels )
 {
+    uint8_t bits = 0;
     int i;
 
-    for( i = 0; i < SPRITE_SIZE; i++ )
+    for( i = 0; i < SPRITE_NIBBLES; i++ )
     {
-        spr_buffer.definition[i] = 0;
+        bits |= pixels[2 * i] | pixels[2 * i + 1];
+        nibbles[i] = pixels[2 * i] | pixels[2 * i + 1] << 4;
     }
 
-    spr_buffer.palette = 0;
-    
-    
-    for( i = 0; i < SPRITE_W; i++ )
+    return bits <= 0x0f;
+}
+
+static void Unpack_Scalar( uint8_t *pixels, const uint8_t *nibbles )
+{
+    int i;
+
+    for( i = 0; i < SPRITE_NIBBLES; i++ )
     {
-        spr_line_1[i] = 0;
-        spr_line_2[i] = 0;
+        pixels[2 * i] = nibbles[i] & 0x0f;
+        pixels[2 * i + 1] = nibbles[i] >> 4;
     }
 
     return;
 }
 
+#ifdef SPR_X86_KERNELS
 
-void SPR_Add_Sprite()
+__attribute__(( target( "sse2" ) ))
+static int Pack_SSE2( uint8_t *nibbles, const uint8_t *pixels )
+{
+    __m128i low = _mm_set1_epi16( 0x00ff );
+    __m128i bits = _mm_setzero_si128();
+    int i;
+
+    for( i = 0; i < SPRITE_NIBBLES; i += 16 )
+    {
+        __m128i a = _mm_loadu_si128( (const __m128i *)( pixels + 2 * i ) );
+        __m128i b = _mm_loadu_si128( (const __m128i *)( pixels + 2 * i + 16 ) );
+
+        bits = _mm_or_si128( bits, _mm_or_si128( a, b ) );
+
+        // each pair of pixels is a 16 bit word, shifting the second one down to meet the first
+        // leaves their byte in the low half
+        a = _mm_and_si128( _mm_or_si128( a, _mm_srli_epi16( a, 4 ) ), low );
+        b = _mm_and_si128( _mm_or_si128( b, _mm_srli_epi16( b, 4 ) ), low );
+        _mm_storeu_si128( (__m128i *)( nibbles + i ), _mm_packus_epi16( a, b ) );
+    }
+
+    bits = _mm_and_si128( bits, _mm_set1_epi8( (char)0xf0 ) );
+
+    return _mm_movemask_epi8( _mm_cmpeq_epi8( bits, _mm_setzero_si128() ) ) == 0xffff;
+}
+
+__attribute__(( target( "sse2" ) ))
+static void Unpack_SSE2( uint8_t *pixels, const uint8_t *nibbles )
+{
+    __m128i mask = _mm_set1_epi8( 0x0f );
+    int i;
+
+    for( i = 0; i < SPRITE_NIBBLES; i += 16 )
+    {
+        __m128i n = _mm_loadu_si128( (const __m128i *)( nibbles + i ) );
+        __m128i first = _mm_and_si128( n, mask );
+        __m128i second = _mm_and_si128( _mm_srli_epi16( n, 4 ), mask );
+
+        _mm_storeu_si128( (__m128i *)( pixels + 2 * i ), _mm_unpacklo_epi8( first, second ) );
+        _mm_storeu_si128( (__m128i *)( pixels + 2 * i + 16 ), _mm_unpackhi_epi8( first, second ) );
+    }
+
+    return;
+}
+
+__attribute__(( target( "avx2" ) ))
+static int Pack_AVX2( uint8_t *nibbles, const uint8_t *pixels )
+{
+    __m256i low = _mm256_set1_epi16( 0x00ff );
+    __m256i bits = _mm256_setzero_si256();
+    int i;
+
+    for( i = 0; i < SPRITE_NIBBLES; i += 32 )
+    {
+        __m256i a = _mm256_loadu_si256( (const __m256i *)( pixels + 2 * i ) );
+        __m256i b = _mm256_loadu_si256( (const __m256i *)( pixels + 2 * i + 32 ) );
+
+        bits = _mm256_or_si256( bits, _mm256_or_si256( a, b ) );
+
+        a = _mm256_and_si256( _mm256_or_si256( a, _mm256_srli_epi16( a, 4 ) ), low );
+        b = _mm256_and_si256( _mm256_or_si256( b, _mm256_srli_epi16( b, 4 ) ), low );
+
+        // packing works within each 128 bit lane, put the quarters back in order
+        _mm256_storeu_si256( (__m256i *)( nibbles + i ), _mm256_permute4x64_epi64( _mm256_packus_epi16( a, b ), 0xd8 ) );
+    }
+
+    return _mm256_testz_si256( bits, _mm256_set1_epi8( (char)0xf0 ) );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void Unpack_AVX2( uint8_t *pixels, const uint8_t *nibbles )
+{
+    __m256i mask = _mm256_set1_epi8( 0x0f );
+    int i;
+
+    for( i = 0; i < SPRITE_NIBBLES; i += 32 )
+    {
+        __m256i n = _mm256_loadu_si256( (const __m256i *)( nibbles + i ) );
+        __m256i first = _mm256_and_si256( n, mask );
+        __m256i second = _mm256_and_si256( _mm256_srli_epi16( n, 4 ), mask );
+        __m256i lo = _mm256_unpacklo_epi8( first, second );
+        __m256i hi = _mm256_unpackhi_epi8( first, second );
+
+        // interleaving works within each 128 bit lane too
+        _mm256_storeu_si256( (__m256i *)( pixels + 2 * i ), _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+        _mm256_storeu_si256( (__m256i *)( pixels + 2 * i + 32 ), _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+    }
+
+    return;
+}
+
+#endif  // SPR_X86_KERNELS
+
+static spr_kernels_type     kernel_list[]       = {
+#ifdef SPR_X86_KERNELS
+                                                    { "avx2",   Pack_AVX2,   Unpack_AVX2   },
+                                                    { "sse2",   Pack_SSE2,   Unpack_SSE2   },
+#endif
+                                                    { "scalar", Pack_Scalar, Unpack_Scalar }
+                                                  };
+
+#define NO_OF_KERNELS           ( (int)( sizeof( kernel_list ) / sizeof( kernel_list[0] ) ) )
+
+
+// returns 1 if the cpu can run the given set of kernels
+static int Kernels_Supported( spr_kernels_type *k )
+{
+#ifdef SPR_X86_KERNELS
+    __builtin_cpu_init();
+
+    if( strcmp( k->name, "avx2" ) == 0 )
+    {
+        return __builtin_cpu_supports( "avx2" );
+    }
+
+    if( strcmp( k->name, "sse2" ) == 0 )
+    {
+        return __builtin_cpu_supports( "sse2" );
+    }
+#endif
+
+    return 1;
+}
+
+
+// picks the fastest kernels the cpu supports, the list is in order of preference
+static void Init_Kernels()
+{
+    int i;
+    for( i = 0; i < NO_OF_KERNELS && kernels == NULL; i++ )
+    {
+        if( Kernels_Supported( &kernel_list[i] ) )
+        {
+            kernels = &kernel_list[i];
+        }
+    }
+
+    return;
+}
+
+
+// milliseconds from start to end, for the benchmark
+static double Ms_Between( struct timespec *start, struct timespec *end )
+{
+    return ( end->tv_sec - start->tv_sec ) * 1000.0 + ( end->tv_nsec - start->tv_nsec ) / 1000000.0;
+}
+
+
+//==========================
+//  ARENA
+//==========================
+
+// returns uninitialized memory for size bytes of sprites
+static void *New_Arena( size_t size )
+{
+    void *arena;
+
+    if( size >= SPRITE_HUGE_PAGE )
+    {
+        // a whole file's worth of sprites is filled in at once, far fewer page faults this way
+        arena = UTI_EC_Aligned_Malloc( size, SPRITE_HUGE_PAGE );
+#ifdef MADV_HUGEPAGE
+        madvise( arena, size, MADV_HUGEPAGE );
+#endif
+    }
+    else
+    {
+        arena = UTI_EC_Aligned_Malloc( size, SPRITE_ARENA_ALIGN );
+    }
+
+    return arena;
+}
+
+
+// moves the sprites to a new arena of capacity sprites
+static void Move_Arena( int capacity )
+{
+    if( sprites_shared )
+    {
+        shared_sprite_type *arena = New_Arena( sizeof( shared_sprite_type ) * capacity );
+
+        if( no_of_sprites > 0 )
+        {
+            memcpy( arena, shared_sprite, sizeof( shared_sprite_type ) * no_of_sprites );
+        }
+
+        UTI_EC_Free( shared_sprite );
+        shared_sprite = arena;
+    }
+    else if( sprites_packed )
+    {
+        packed_sprite_type *arena = New_Arena( sizeof( packed_sprite_type ) * capacity );
+
+        if( no_of_sprites > 0 )
+        {
+            memcpy( arena, packed_sprite, sizeof( packed_sprite_type ) * no_of_sprites );
+        }
+
+        UTI_EC_Free( packed_sprite );
+        packed_sprite = arena;
+    }
+    else
+    {
+        sprite_type *arena = New_Arena( sizeof( sprite_type ) * capacity );
+
+        if( no_of_sprites > 0 )
+        {
+            memcpy( arena, sprite, sizeof( sprite_type ) * no_of_sprites );
+        }
+
+        if( sprites_borrowed == 0 )
+        {
+            UTI_EC_Free( sprite );
+        }
+
+        sprite = arena;
+        sprites_borrowed = 0;
+    }
+
+    sprite_generation = UTI_EC_Realloc( sprite_generation, sizeof( uint32_t ) * capacity );
+
+    int i;
+    for( i = sprite_capacity; i < capacity; i++ )
+    {
+        sprite_generation[i] = 0;
+    }
+
+    sprite_capacity = capacity;
+
+    return;
+}
+
+
+// makes sure there is room for count sprites, growing the arena if needed, returns 1 on success.
+// the capacity doubles so adding sprites one at a time stays cheap
+static int Reserve_Sprites( int count )
+{
+    if( count <= sprite_capacity )
+    {
+        return 1;
+    }
+
+    int capacity = ( sprite_capacity > 0 ) ? sprite_capacity : SPRITE_ARENA_START;
+    while( capacity < count )
+    {
+        capacity = ( capacity > INT_MAX / 2 ) ? count : capacity * 2;
+    }
+
+    if( (size_t)capacity > SIZE_MAX / sizeof( sprite_type ) )
+    {
+        return 0;
+    }
+
+    Move_Arena( capacity );
+
+    return 1;
+}
+
+
+// returns 1 if a sprite has been filled in, index must be valid
+static int Sprite_Is_Loaded( int index )
+{
+    return index >= lazy_end || block_loaded[index / SPRITE_LOAD_BLOCK];
+}
+
+
+//==========================
+//  SHARED DEFINITIONS
+//==========================
+
+// bytes each definition takes in definition_data
+static int Definition_Size()
+{
+    return sprites_packed ? SPRITE_NIBBLES : SPRITE_SIZE;
+}
+
+
+static uint32_t Hash_Definition( const uint8_t *data, int size )
+{
+    uint64_t hash = 0, word;
+    int i;
+
+    // eight bytes at a time, size is always a multiple of 8
+    for( i = 0; i < size; i += 8 )
+    {
+        memcpy( &word, data + i, 8 );
+        hash = ( hash ^ word ) * 0xff51afd7ed558ccdull;
+        hash ^= hash >> 32;
+    }
+
+    return (uint32_t)hash;
+}
+
+
+// hashes every definition in use again and rebuilds the chains, after they have been repacked or
+// the table has grown. ids no sprite uses keep their place in the free chain
+static void Chain_Definitions()
 {
+    int size = Definition_Size();
+    int i, bucket;
 
-    if( no_of_sprites < MAX_SPRITES )
+    for( i = 0; i < definition_capacity; i++ )
     {
+        definition_bucket[i] = -1;
+    }
+
+    for( i = 0; i < definition_limit; i++ )
+    {
+        if( definition_refs[i] > 0 )
+        {
+            definition_hash[i] = Hash_Definition( definition_data + (size_t)size * i, size );
+            bucket = definition_hash[i] & ( definition_capacity - 1 );
+            definition_next[i] = definition_bucket[bucket];
+            definition_bucket[bucket] = i;
+        }
+    }
+
+    return;
+}
+
+
+// doubles the room for definitions, the hash table grows with it so chains stay short
+static void Grow_Definitions()
+{
+    int capacity = ( definition_capacity > 0 ) ? definition_capacity * 2 : SPRITE_DEFINITIONS_START;
+
+    definition_data     = UTI_EC_Realloc( definition_data, (size_t)Definition_Size() * capacity );
+    definition_refs     = UTI_EC_Realloc( definition_refs, sizeof( uint32_t ) * capacity );
+    definition_hash     = UTI_EC_Realloc( definition_hash, sizeof( uint32_t ) * capacity );
+    definition_next     = UTI_EC_Realloc( definition_next, sizeof( int ) * capacity );
+    definition_bucket   = UTI_EC_Realloc( definition_bucket, sizeof( int ) * capacity );
+
+    definition_capacity = capacity;
+    Chain_Definitions();
+
+    return;
+}
+
+
+static void Free_Definitions()
+{
+    UTI_EC_Free( definition_data );
+    UTI_EC_Free( definition_refs );
+    UTI_EC_Free( definition_hash );
+    UTI_EC_Free( definition_next );
+    UTI_EC_Free( definition_bucket );
+
+    definition_data = NULL;
+    definition_refs = NULL;
+    definition_hash = NULL;
+    definition_next = NULL;
+    definition_bucket = NULL;
+    definition_capacity = 0;
+    definition_limit = 0;
+    no_of_definitions = 0;
+    free_definition = -1;
+
+    return;
+}
+
+
+// returns the id of the definition held as data, Definition_Size() bytes, adding it if no sprite
+// uses it yet. counts one more sprite using it
+static int Use_Definition( const uint8_t *data )
+{
+    int size = Definition_Size();
+    uint32_t hash = Hash_Definition( data, size );
+    int id, bucket;
+
+    for( id = definition_bucket[hash & ( definition_capacity - 1 )]; id >= 0; id = definition_next[id] )
+    {
+        if( definition_hash[id] == hash && memcmp( definition_data + (size_t)size * id, data, size ) == 0 )
+        {
+            definition_refs[id]++;
+            return id;
+        }
+    }
+
+    if( free_definition >= 0 )
+    {
+        id = free_definition;
+        free_definition = definition_next[id];
+    }
+    else
+    {
+        if( definition_limit == definition_capacity )
+        {
+            Grow_Definitions();
+        }
+
+        id = definition_limit++;
+    }
+
+    memcpy( definition_data + (size_t)size * id, data, size );
+    definition_refs[id] = 1;
+    definition_hash[id] = hash;
+
+    bucket = hash & ( definition_capacity - 1 );
+    definition_next[id] = definition_bucket[bucket];
+    definition_bucket[bucket] = id;
+    no_of_definitions++;
+
+    return id;
+}
+
+
+// counts one less sprite using a definition, it is freed once none do
+static void Drop_Definition( int id )
+{
+    if( --definition_refs[id] > 0 )
+    {
+        return;
+    }
+
+    int *link = &definition_bucket[definition_hash[id] & ( definition_capacity - 1 )];
+    while( *link != id )
+    {
+        link = &definition_next[*link];
+    }
+
+    *link = definition_next[id];
+    definition_next[id] = free_definition;
+    free_definition = id;
+    no_of_definitions--;
+
+    return;
+}
+
+
+// copies a definition out full size
+static void Copy_Definition( int id, uint8_t *pixels )
+{
+    if( sprites_packed )
+    {
+        kernels->unpack( pixels, definition_data + (size_t)SPRITE_NIBBLES * id );
+    }
+    else
+    {
+        memcpy( pixels, definition_data + (size_t)SPRITE_SIZE * id, SPRITE_SIZE );
+    }
+
+    return;
+}
+
+
+// converts every definition in use to packed or full size, setting sprites_packed to match.
+// returns 0, leaving them as they were, if one doesn't fit packed
+static int Repack_Definitions( int packed )
+{
+    int from = Definition_Size();
+    int to = packed ? SPRITE_NIBBLES : SPRITE_SIZE;
+    uint8_t *data = UTI_EC_Malloc( (size_t)to * definition_capacity );
+    int i;
+
+    for( i = 0; i < definition_limit; i++ )
+    {
+        if( definition_refs[i] == 0 )
+        {
+            continue;
+        }
+
+        if( packed == 0 )
+        {
+            kernels->unpack( data + (size_t)to * i, definition_data + (size_t)from * i );
+        }
+        else if( kernels->pack( data + (size_t)to * i, definition_data + (size_t)from * i ) == 0 )
+        {
+            UTI_EC_Free( data );
+            return 0;
+        }
+    }
+
+    UTI_EC_Free( definition_data );
+    definition_data = data;
+    sprites_packed = packed;
+    Chain_Definitions();
+
+    return 1;
+}
+
+
+// points a sprite at the definition matching spr, returns 0 if sprites are packed and it doesn't
+// fit
+static int Share_Sprite( int index, const sprite_type *spr )
+{
+    uint8_t nibbles[SPRITE_NIBBLES];
+    const uint8_t *data = spr->definition;
+
+    if( sprites_packed )
+    {
+        if( kernels->pack( nibbles, spr->definition ) == 0 )
+        {
+            return 0;
+        }
+
+        data = nibbles;
+    }
+
+    shared_sprite[index].definition = Use_Definition( data );
+    shared_sprite[index].palette = spr->palette;
+
+    return 1;
+}
+
+
+// goes back to keeping each sprite's definition with it, so that sprites can be filled in where
+// they lie
+static void Unshare_Storage()
+{
+    int size = Definition_Size();
+    int i;
+
+    if( sprites_packed )
+    {
+        packed_sprite = New_Arena( sizeof( packed_sprite_type ) * sprite_capacity );
+    }
+    else
+    {
+        sprite = New_Arena( sizeof( sprite_type ) * sprite_capacity );
+    }
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        if( Sprite_Is_Loaded( i ) == 0 )
+        {
+            continue;
+        }
+
+        const uint8_t *data = definition_data + (size_t)size * shared_sprite[i].definition;
+
+        if( sprites_packed )
+        {
+            memcpy( packed_sprite[i].nibbles, data, size );
+            packed_sprite[i].palette = shared_sprite[i].palette;
+        }
+        else
+        {
+            memcpy( sprite[i].definition, data, size );
+            sprite[i].palette = shared_sprite[i].palette;
+        }
+    }
+
+    Free_Definitions();
+    UTI_EC_Free( shared_sprite );
+
+    shared_sprite = NULL;
+    sprites_shared = 0;
+
+    printf( "Sprites are no longer shared, more sprites loaded\n" );
+
+    return;
+}
+
+
+//==========================
+//  LOADING AND STORING
+//==========================
+
+// stops loading sprites lazily, once they are all loaded or there are none left to load
+static void Finish_Lazy_Loading()
+{
+    UTI_EC_Free( block_loaded );
+
+    sprite_loader = NULL;
+    block_loaded = NULL;
+    lazy_end = 0;
+    blocks_unloaded = 0;
+
+    return;
+}
+
+
+// goes back to keeping sprites full size, when a pixel above 15 has to be stored. sprites the
+// loader hasn't filled in yet are left for it
+static void Unpack_Storage( const char *reason )
+{
+    if( sprites_shared )
+    {
+        Repack_Definitions( 0 );
+    }
+    else
+    {
+        sprite_type *arena = New_Arena( sizeof( sprite_type ) * sprite_capacity );
+        int i;
+
+        for( i = 0; i < no_of_sprites; i++ )
+        {
+            if( Sprite_Is_Loaded( i ) )
+            {
+                kernels->unpack( arena[i].definition, packed_sprite[i].nibbles );
+                arena[i].palette = packed_sprite[i].palette;
+            }
+        }
+
+        UTI_EC_Free( packed_sprite );
+
+        packed_sprite = NULL;
+        sprite = arena;
+        sprites_packed = 0;
+    }
+
+    printf( "Sprites are no longer packed, %s\n", reason );
+
+    return;
+}
+
+
+// stores a whole sprite however sprites are kept, going back to full size if it doesn't fit
+static void Put_Sprite( int index, const sprite_type *spr, const char *reason )
+{
+    if( sprites_shared )
+    {
+        if( Share_Sprite( index, spr ) == 0 )
+        {
+            Unpack_Storage( reason );
+            Share_Sprite( index, spr );
+        }
+    }
+    else if( sprites_packed && kernels->pack( packed_sprite[index].nibbles, spr->definition ) )
+    {
+        packed_sprite[index].palette = spr->palette;
+    }
+    else
+    {
+        if( sprites_packed )
+        {
+            Unpack_Storage( reason );
+        }
+
+        memcpy( &sprite[index], spr, sizeof( sprite_type ) );
+    }
+
+    return;
+}
+
+
+// fills in one block of sprites through the loader
+static void Load_Block( int block )
+{
+    int first = block * SPRITE_LOAD_BLOCK;
+    int count = ( lazy_end - first < SPRITE_LOAD_BLOCK ) ? lazy_end - first : SPRITE_LOAD_BLOCK;
+    int i;
+
+    if( sprites_packed == 0 && sprites_shared == 0 )
+    {
+        sprite_loader( first, count, &sprite[first] );
+    }
+    else
+    {
+        // loaded full size then stored. the block counts as loaded already so that going back to
+        // full size part way through takes the sprites stored so far with it
+        sprite_loader( first, count, spr_load_buffer );
+        block_loaded[block] = 1;
+
+        for( i = 0; i < count; i++ )
+        {
+            Put_Sprite( first + i, &spr_load_buffer[i], "the file has colours above 15" );
+        }
+    }
+
+    block_loaded[block] = 1;
+    if( --blocks_unloaded == 0 )
+    {
+        Finish_Lazy_Loading();
+    }
+
+    return;
+}
+
+
+// makes sure a sprite has been loaded before it is used, index must be valid
+static void Need_Sprite( int index )
+{
+    if( index < lazy_end && block_loaded[index / SPRITE_LOAD_BLOCK] == 0 )
+    {
+        Load_Block( index / SPRITE_LOAD_BLOCK );
+    }
+
+    return;
+}
+
+
+// loads every sprite still waiting for the loader
+static void Load_All_Sprites()
+{
+    int block;
+    for( block = 0; lazy_end > 0 && block * SPRITE_LOAD_BLOCK < lazy_end; block++ )
+    {
+        if( block_loaded[block] == 0 )
+        {
+            Load_Block( block );
+        }
+    }
+
+    return;
+}
+
+
+// mark a sprite as changed
+static void Touch_Sprite( int index )
+{
+    if( sprite_generation[index] <= saved_generation )
+    {
+        if( no_of_changed == changed_capacity )
+        {
+            changed_capacity = ( changed_capacity > 0 ) ? changed_capacity * 2 : SPRITE_ARENA_START;
+            changed_sprite = UTI_EC_Realloc( changed_sprite, sizeof( int ) * changed_capacity );
+        }
+
+        changed_sprite[no_of_changed++] = index;
+    }
+
+    sprite_generation[index] = ++generation_counter;
+
+    return;
+}
+
+
+// returns a sprite ready to be read or changed. when sprites are packed or shared it is a copy,
+// which Close_Sprite() stores back, so only one can be open at a time
+static sprite_type *Open_Sprite( int index )
+{
+    Need_Sprite( index );
+
+    if( sprites_shared )
+    {
+        Copy_Definition( shared_sprite[index].definition, spr_unpacked.definition );
+        spr_unpacked.palette = shared_sprite[index].palette;
+    }
+    else if( sprites_packed )
+    {
+        kernels->unpack( spr_unpacked.definition, packed_sprite[index].nibbles );
+        spr_unpacked.palette = packed_sprite[index].palette;
+    }
+    else
+    {
+        return &sprite[index];
+    }
+
+    return &spr_unpacked;
+}
+
+
+// marks a sprite from Open_Sprite() as changed, storing it back if it was a copy. a shared
+// sprite gets the definition matching what it is now, the one it had is left for any others
+static void Close_Sprite( int index )
+{
+    if( sprites_shared )
+    {
+        Drop_Definition( shared_sprite[index].definition );
+    }
+
+    if( sprites_packed || sprites_shared )
+    {
+        Put_Sprite( index, &spr_unpacked, "colours above 15 used" );
+    }
+
+    Touch_Sprite( index );
+
+    return;
+}
+
+
+//==========================
+//  BULK OPERATIONS
+//==========================
+
+// changes the sprites in one job of a batch, which must be loaded and not shared. each job only
+// uses the memory of its own sprites, so jobs can run on threads of their own, a job for THR_Run()
+static void Change_Batch( void *data, int job )
+{
+    spr_batch_type *batch = data;
+    void (*transform)( uint8_t *pixels ) = spr_transform[batch->op];
+    uint8_t pixels[SPRITE_SIZE];
+    int first = batch->first + job * SPRITE_THREAD_BATCH;
+    int end = ( batch->end - first > SPRITE_THREAD_BATCH ) ? first + SPRITE_THREAD_BATCH : batch->end;
+    int n, i;
+
+    for( n = first; n < end; n++ )
+    {
+        i = ( batch->index != NULL ) ? batch->index[n] : n;
+
+        if( transform == NULL )
+        {
+            if( sprites_packed )
+            {
+                packed_sprite[i].palette = batch->value;
+            }
+            else
+            {
+                sprite[i].palette = batch->value;
+            }
+        }
+        else if( sprites_packed )
+        {
+            // no transform adds a colour, so the sprite always packs again
+            kernels->unpack( pixels, packed_sprite[i].nibbles );
+            transform( pixels );
+            kernels->pack( packed_sprite[i].nibbles, pixels );
+        }
+        else
+        {
+            transform( sprite[i].definition );
+        }
+    }
+
+    return;
+}
+
+
+// changes the sprites first to end-1, or those listed there in index, which mustn't repeat.
+// large numbers are shared between a thread for each cpu
+static void Change_Sprites( const int *index, int first, int end, int op, int value )
+{
+    spr_batch_type batch = { index, first, end, op, value };
+
+    THR_Run( Change_Batch, &batch, ( end - first + SPRITE_THREAD_BATCH - 1 ) / SPRITE_THREAD_BATCH,
+             THR_Get_Number_Of_CPUs() );
+
+    return;
+}
+
+
+// changes shared sprites as Change_Sprites() does. the sprites are done one at a time, but a
+// definition other sprites share is only changed once, the sprites after take the one it became
+static void Change_Shared( const int *index, int first, int end, int op, int value )
+{
+    void (*transform)( uint8_t *pixels ) = spr_transform[op];
+    int limit = definition_limit;
+    int *changed_to = UTI_EC_Malloc( sizeof( int ) * ( limit + 1 ) );
+    int n, i, from;
+
+    for( i = 0; i < limit; i++ )
+    {
+        changed_to[i] = -1;
+    }
+
+    for( n = first; n < end; n++ )
+    {
+        i = ( index != NULL ) ? index[n] : n;
+
+        if( transform == NULL )
+        {
+            shared_sprite[i].palette = value;
+            continue;
+        }
+
+        from = shared_sprite[i].definition;
+        if( changed_to[from] >= 0 )
+        {
+            shared_sprite[i].definition = changed_to[from];
+            definition_refs[changed_to[from]]++;
+            Drop_Definition( from );
+            continue;
+        }
+
+        sprite_type *spr = Open_Sprite( i );
+        transform( spr->definition );
+
+        // a shared definition is kept until the end, so its id isn't reused while it is remembered
+        if( definition_refs[from] == 1 )
+        {
+            Drop_Definition( from );
+            Put_Sprite( i, spr, "colours above 15 used" );
+        }
+        else
+        {
+            Put_Sprite( i, spr, "colours above 15 used" );
+            changed_to[from] = shared_sprite[i].definition;
+        }
+    }
+
+    for( i = 0; i < limit; i++ )
+    {
+        if( changed_to[i] >= 0 )
+        {
+            Drop_Definition( i );
+        }
+    }
+
+    UTI_EC_Free( changed_to );
+
+    return;
+}
+
+
+//====================================================================
+//  PUBLIC FUNCTION BODIES
+//====================================================================
+
+void SPR_Init()
+{
+    int i;
+
+    for( i = 0; i < SPRITE_SIZE; i++ )
+    {
+        spr_buffer.definition[i] = 0;
+    }
+
+    spr_buffer.palette = 0;
+
+    return;
+}
+
+
+void SPR_Add_Sprite()
+{
+
+    if( Reserve_Sprites( no_of_sprites + 1 ) )
+    {
+        if( sprites_shared )
+        {
+            static const sprite_type blank_sprite;
+            Share_Sprite( no_of_sprites, &blank_sprite );
+        }
+        else if( sprites_packed )
+        {
+            memset( &packed_sprite[no_of_sprites], 0, sizeof( packed_sprite_type ) );
+        }
+        else
+        {
+            // set all bytes of sprite definition to '0'
+            int i;
+            for( i = 0; i < SPRITE_SIZE; i++ )
+            {
+                sprite[no_of_sprites].definition[i] = 0x00;
+            }
+
+            sprite[no_of_sprites].palette = 0;
+        }
+
+        Touch_Sprite( no_of_sprites );
+
+        no_of_sprites++;
+        return;
+    
+    }
+
+    UTI_Print_Error( "Cannot add sprite, out of memory" );
+    
+    return;
+    
+}
+
+
+// set all sprite pixels to 0 (transparent)
+void SPR_Clear_Sprite( int index )
+{
+    if( index < 0 || index >= no_of_sprites )
+    {
+        UTI_Print_Error( "Invalid sprite index" );
+        return;
+    }
+
+    sprite_type *spr = Open_Sprite( index );
+
+    Clear_Pixels( spr->definition );
+
+    Close_Sprite( index );
+
+    return;
+}
+
+
+// copy given sprite to the buffer, return 1 on success
+int SPR_Copy_Sprite( int index )
+{
+    if( index < 0 || index >= no_of_sprites )
+    {
+        UTI_Print_Error( "Invalid sprite index" );
+        return 0;
+    }
+
+    Copy_Sprite( Open_Sprite( index ), &spr_buffer );
+
+    return 1;
+}
+
+// copy sprite buffer to current sprite
+int SPR_Paste_Sprite( int index )
+{
+    if( index < 0 || index >= no_of_sprites )
+    {
+        UTI_Print_Error( "Invalid sprite index" );
+        return 0;
+    }
+
+    Copy_Sprite( &spr_buffer, Open_Sprite( index ) );
+
+    Close_Sprite( index );
+
+    return 1;
+}
+
+
+// remove the last sprite on the list
+void SPR_Remove_Sprite()
+{
+    // check there are more than 1 sprite, must be at least one sprite to display
+    if( no_of_sprites > 1 )
+    {
+        no_of_sprites--;
+
+        if( sprites_shared && Sprite_Is_Loaded( no_of_sprites ) )
+        {
+            Drop_Definition( shared_sprite[no_of_sprites].definition );
+        }
+    }
+
+    // a sprite added back in its place starts blank, it mustn't be loaded over
+    if( no_of_sprites < lazy_end )
+    {
+        int block = ( no_of_sprites + SPRITE_LOAD_BLOCK - 1 ) / SPRITE_LOAD_BLOCK;
+        int last_block = ( lazy_end + SPRITE_LOAD_BLOCK - 1 ) / SPRITE_LOAD_BLOCK;
+
+        for( ; block < last_block; block++ )
+        {
+            blocks_unloaded -= ( block_loaded[block] == 0 );
+        }
+
+        lazy_end = no_of_sprites;
+        if( blocks_unloaded == 0 )
+        {
+            Finish_Lazy_Loading();
+        }
+    }
+
+    return;
+}
+
+
+// Set a particular pixel in the sprite definition
+void SPR_Set_Pixel( int sprite_index, int pixel_index, uint8_t pixel_value )
+{
+    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    {
+        printf( "Sprite index = %d\n", sprite_index );
+        UTI_Print_Debug( "Invalid sprite index" );
+        return;
+    }
+
+    if( pixel_index < 0 || pixel_index >= SPRITE_SIZE )
+    {
+        printf( "Pixel index = %d\n", pixel_index );
+        UTI_Print_Debug( "Invalid pixel index" );
+        return;
+    }
+
+    if( pixel_value > PAL_MAIN_SIZE )
+    {
+        printf( "Colour/Palette index = %d\n", pixel_value );
+        UTI_Print_Debug( "Invalid palette colour index" );
+        return;
+    }
+
+    if( sprites_shared )
+    {
+        // copied on write, the sprite may end up sharing another definition
+        Open_Sprite( sprite_index )->definition[pixel_index] = pixel_value;
+        Close_Sprite( sprite_index );
+        return;
+    }
+
+    Need_Sprite( sprite_index );
+
+    if( sprites_packed && pixel_value > 0x0f )
+    {
+        Unpack_Storage( "colours above 15 used" );
+    }
+
+    if( sprites_packed )
+    {
+        uint8_t *nibble = &packed_sprite[sprite_index].nibbles[pixel_index / 2];
+        int shift = ( pixel_index & 1 ) * 4;
+
+        *nibble = ( *nibble & ~( 0x0f << shift ) ) | pixel_value << shift;
+    }
+    else
+    {
+        sprite[sprite_index].definition[pixel_index] = pixel_value;
+    }
+
+    Touch_Sprite( sprite_index );
+
+    return;
+}
+
+
+// retrieve the color index of a given sprite pixel, returns 0 (transparency) on failure
+uint8_t SPR_Get_Pixel( int sprite_index, int pixel_index )
+{
+
+    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    {
+        UTI_Print_Debug( "Invalid sprite index" );
+        return 0;
+    }
+
+    if( pixel_index < 0 || pixel_index >= SPRITE_SIZE )
+    {
+        printf( "Pixel Index = %d\n", pixel_index );
+        UTI_Print_Debug( "Invalid pixel index" );
+        return 0;
+    }
+
+    Need_Sprite( sprite_index );
+
+    if( sprites_shared )
+    {
+        const uint8_t *data = definition_data + (size_t)Definition_Size() * shared_sprite[sprite_index].definition;
+
+        return sprites_packed ? ( data[pixel_index / 2] >> ( pixel_index & 1 ) * 4 ) & 0x0f : data[pixel_index];
+    }
+
+    if( sprites_packed )
+    {
+        return ( packed_sprite[sprite_index].nibbles[pixel_index / 2] >> ( pixel_index & 1 ) * 4 ) & 0x0f;
+    }
+
+    return sprite[sprite_index].definition[pixel_index];
+
+}
+
+
+int SPR_Get_Sprite_Palette_Index( int sprite_index )
+{
+    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    {
+        UTI_Print_Debug( "Invalid Sprite index" );
+        return 0;
+    }
+
+    Need_Sprite( sprite_index );
+
+    if( sprites_shared )
+    {
+        return shared_sprite[sprite_index].palette;
+    }
+
+    if( sprites_packed )
+    {
+        return packed_sprite[sprite_index].palette;
+    }
+
+    return sprite[sprite_index].palette;
+}
+
+
+void SPR_Set_Sprite_Palette_Index( int sprite_index, int palette_index )
+{
+    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    {
+        return;
+    }
+
+    Need_Sprite( sprite_index );
+
+    if( sprites_shared )
+    {
+        shared_sprite[sprite_index].palette = palette_index;
+    }
+    else if( sprites_packed )
+    {
+        packed_sprite[sprite_index].palette = palette_index;
+    }
+    else
+    {
+        sprite[sprite_index].palette = palette_index;
+    }
+
+    Touch_Sprite( sprite_index );
+
+    return;
+}
+
+
+// returns a value that changes every time the sprite is edited, 0 for an invalid index
+uint32_t SPR_Get_Sprite_Generation( int sprite_index )
+{
+    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    {
+        return 0;
+    }
+
+    return sprite_generation[sprite_index];
+}
+
+
+// return the current number of sprites
+int SPR_Get_Number_Of_Sprites()
+{
+    return no_of_sprites;
+}
+
+
+// keeps the sprites two pixels to a byte, halving their memory, as long as no pixel is above 15.
+// returns 1 if they are packed
+int SPR_Pack_Storage()
+{
+    if( sprites_packed )
+    {
+        return 1;
+    }
+
+    Init_Kernels();
+
+    if( sprites_shared )
+    {
+        // only the definitions need packing
+        if( Repack_Definitions( 1 ) == 0 )
+        {
+            printf( "Sprites have colours above 15, sprites are not packed\n" );
+            return 0;
+        }
+
+        printf( "Packed %d shared definitions with %s kernels\n", no_of_definitions, kernels->name );
+        return 1;
+    }
+
+    if( Reserve_Sprites( 1 ) == 0 )
+    {
+        return 0;
+    }
+
+    packed_sprite_type *arena = New_Arena( sizeof( packed_sprite_type ) * sprite_capacity );
+    int i;
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        // sprites still to be loaded are packed as they are
+        if( Sprite_Is_Loaded( i ) == 0 )
+        {
+            continue;
+        }
+
+        if( kernels->pack( arena[i].nibbles, sprite[i].definition ) == 0 )
+        {
+            printf( "Sprite %d has colours above 15, sprites are not packed\n", i );
+            UTI_EC_Free( arena );
+            return 0;
+        }
+
+        arena[i].palette = sprite[i].palette;
+    }
+
+    if( sprites_borrowed == 0 )
+    {
+        UTI_EC_Free( sprite );
+    }
+
+    sprite = NULL;
+    sprites_borrowed = 0;
+    packed_sprite = arena;
+    sprites_packed = 1;
+
+    printf( "Packed %d sprites with %s kernels, %zu KB instead of %zu KB\n", no_of_sprites, kernels->name,
+            sizeof( packed_sprite_type ) * sprite_capacity / 1024, sizeof( sprite_type ) * sprite_capacity / 1024 );
+
+    return 1;
+}
+
+
+// keeps each different sprite definition once, shared by every sprite that has it, and prints
+// how many there are. returns 1 on success
+int SPR_Share_Storage()
+{
+    if( sprites_shared )
+    {
+        return 1;
+    }
+
+    if( Reserve_Sprites( 1 ) == 0 )
+    {
+        return 0;
+    }
+
+    size_t record_size = sprites_packed ? sizeof( packed_sprite_type ) : sizeof( sprite_type );
+    shared_sprite_type *arena = New_Arena( sizeof( shared_sprite_type ) * sprite_capacity );
+    int i, loaded = 0;
+
+    Grow_Definitions();
+
+    for( i = 0; i < no_of_sprites; i++ )
+    {
+        // sprites still to be loaded are shared as they are
+        if( Sprite_Is_Loaded( i ) == 0 )
+        {
+            continue;
+        }
+
+        if( sprites_packed )
+        {
+            arena[i].definition = Use_Definition( packed_sprite[i].nibbles );
+            arena[i].palette = packed_sprite[i].palette;
+        }
+        else
+        {
+            arena[i].definition = Use_Definition( sprite[i].definition );
+            arena[i].palette = sprite[i].palette;
+        }
+
+        loaded++;
+    }
+
+    if( sprites_borrowed == 0 )
+    {
+        UTI_EC_Free( sprite );
+    }
+
+    UTI_EC_Free( packed_sprite );
+
+    sprite = NULL;
+    packed_sprite = NULL;
+    sprites_borrowed = 0;
+    shared_sprite = arena;
+    sprites_shared = 1;
+
+    size_t shared_size = sizeof( shared_sprite_type ) * sprite_capacity +
+                         ( Definition_Size() + 4 * sizeof( uint32_t ) ) * (size_t)definition_capacity;
+
+    printf( "Sharing %d definitions between %d sprites, %.2f sprites each, %zu KB instead of %zu KB\n",
+            no_of_definitions, loaded, (double)loaded / ( no_of_definitions > 0 ? no_of_definitions : 1 ),
+            shared_size / 1024, record_size * sprite_capacity / 1024 );
+
+    if( loaded < no_of_sprites )
+    {
+        printf( "The other %d sprites are shared as they are loaded\n", no_of_sprites - loaded );
+    }
+
+    return 1;
+}
+
+
+// returns how many different sprite definitions are kept, 0 unless sprites are shared
+int SPR_Get_Number_Of_Definitions()
+{
+    return sprites_shared ? no_of_definitions : 0;
+}
+
+
+// returns how sprites are kept now as SPR_STORAGE_ flags
+int SPR_Get_Storage()
+{
+    return ( sprites_packed ? SPR_STORAGE_PACKED : 0 ) | ( sprites_shared ? SPR_STORAGE_SHARED : 0 );
+}
+
+
+// clean up function
+void SPR_Free()
+{
+    if( sprites_borrowed == 0 )
+    {
+        UTI_EC_Free( sprite );
+    }
+
+    UTI_EC_Free( packed_sprite );
+    UTI_EC_Free( shared_sprite );
+    UTI_EC_Free( sprite_generation );
+    UTI_EC_Free( changed_sprite );
+    Free_Definitions();
+    Finish_Lazy_Loading();
+
+    sprite = NULL;
+    packed_sprite = NULL;
+    sprites_packed = 0;
+    shared_sprite = NULL;
+    sprites_shared = 0;
+    sprite_generation = NULL;
+    sprite_capacity = 0;
+    sprites_borrowed = 0;
+    no_of_sprites = 0;
+
+    changed_sprite = NULL;
+    no_of_changed = 0;
+    changed_capacity = 0;
+
+    return;
+}
+
+
+//==========================
+//  SPRITE SHIFT/FLIP
+//==========================
+
+void SPR_Shift_Left( int index )
+{
+    if( index < 0 || index >= no_of_sprites )
+    {
+        UTI_Print_Error( "Invalid sprite index" );
+        return;
+    }
+
+    sprite_type *spr = Open_Sprite( index );
+
+    Shift_Pixels_Left( spr->definition );
+
+    Close_Sprite( index );
+
+    return;
+}
+
+void SPR_Shift_Right( int index ) 
+{
+    if( index < 0 || index >= no_of_sprites )
+    {
+        UTI_Print_Error( "Invalid sprite index" );
+        return;
+    }
+
+    sprite_type *spr = Open_Sprite( index );
+
+    Shift_Pixels_Right( spr->definition );
+
+    Close_Sprite( index );
+
+    return;
+}
+
+void SPR_Shift_Up( int index )
+{
+    if( index < 0 || index >= no_of_sprites )
+    {
+        return;
+    }
 
-        sprite[no_of_sprites] = UTI_EC_Malloc( sizeof( sprite_type ) );
-        
-        // set all bytes of sprite definition to '0'
-        int i;
-        for( i = 0; i < SPRITE_SIZE; i++ )
-        {
-            sprite[no_of_sprites]->definition[i] = 0x00;
-        }
+    sprite_type *spr = Open_Sprite( index );
 
-        sprite[no_of_sprites]->palette = 0;
+    Shift_Pixels_Up( spr->definition );
 
-        no_of_sprites++;
-        return;
-    
-    }
+    Close_Sprite( index );
 
-    UTI_Print_Debug( "Cannot add sprite, limit reached" );
-    
     return;
-    
 }
 
 
-// set all sprite pixels to 0 (transparent)
-void SPR_Clear_Sprite( int index )
+void SPR_Shift_Down( int index )
 {
     if( index < 0 || index >= no_of_sprites )
     {
-        UTI_Print_Error( "Invalid sprite index" );
         return;
     }
 
-    int i;
-    for( i = 0; i < SPRITE_SIZE; i++ )
-    {
-        sprite[index]->definition[i] = 0;
-    }
+    sprite_type *spr = Open_Sprite( index );
+
+    Shift_Pixels_Down( spr->definition );
+
+    Close_Sprite( index );
 
     return;
 }
 
 
-// copy given sprite to the buffer, return 1 on success
-int SPR_Copy_Sprite( int index )
+
+void SPR_Flip_Horizontal( int index )
 {
     if( index < 0 || index >= no_of_sprites )
     {
         UTI_Print_Error( "Invalid sprite index" );
-        return 0;
+        return;
     }
 
-    Copy_Sprite( sprite[index], &spr_buffer );
+    sprite_type *spr = Open_Sprite( index );
 
-    return 1;
+    Flip_Pixels_Horizontal( spr->definition );
+
+    Close_Sprite( index );
+
+    return;
 }
 
-// copy sprite buffer to current sprite
-int SPR_Paste_Sprite( int index )
+
+
+void SPR_Flip_Vertical( int index )
 {
+    
     if( index < 0 || index >= no_of_sprites )
     {
         UTI_Print_Error( "Invalid sprite index" );
-        return 0;
+        return;
     }
 
-    Copy_Sprite( &spr_buffer, sprite[index] );
+    sprite_type *spr = Open_Sprite( index );
 
-    return 1;
+    Flip_Pixels_Vertical( spr->definition );
+
+    Close_Sprite( index );
+
+    return;
 }
 
 
-// remove the last sprite on the list
-void SPR_Remove_Sprite()
+
+//==========================
+//  BULK OPERATIONS
+//==========================
+
+// applies an SPR_OP_ operation to sprites first to end-1, return 1 on success
+int SPR_Change_Range( int op, int first, int end, int value )
 {
-    // check there are more than 1 sprite, must be at least one sprite to display
-    if( no_of_sprites > 1 )
+    if( op < 0 || op >= SPR_NO_OF_OPS )
     {
-        UTI_EC_Free( sprite[--no_of_sprites] );
+        UTI_Print_Error( "Invalid sprite operation" );
+        return 0;
     }
 
-    return;
-}
-
+    if( first < 0 || end > no_of_sprites || first > end )
+    {
+        UTI_Print_Error( "Invalid sprite range" );
+        return 0;
+    }
 
-// Set a particular pixel in the sprite definition
-void SPR_Set_Pixel( int sprite_index, int pixel_index, uint8_t pixel_value )
-{
-    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    int i;
+    for( i = first; i < end; i++ )
     {
-        printf( "Sprite index = %d\n", sprite_index );
-        UTI_Print_Debug( "Invalid sprite index" );
-        return;
+        Need_Sprite( i );
     }
 
-    if( pixel_index < 0 || pixel_index >= SPRITE_SIZE )
+    // loading can change how sprites are kept, so this is only decided now
+    if( sprites_shared )
     {
-        printf( "Pixel index = %d\n", pixel_index );
-        UTI_Print_Debug( "Invalid pixel index" );
-        return;
+        Change_Shared( NULL, first, end, op, value );
+    }
+    else
+    {
+        Change_Sprites( NULL, first, end, op, value );
     }
 
-    if( pixel_value > PAL_MAIN_SIZE )
+    for( i = first; i < end; i++ )
     {
-        printf( "Colour/Palette index = %d\n", pixel_value );
-        UTI_Print_Debug( "Invalid palette colour index" );
-        return;
+        Touch_Sprite( i );
     }
 
-    sprite[sprite_index]->definition[pixel_index] = pixel_value;
-    return;
+    return 1;
 }
 
 
-// retrieve the color index of a given sprite pixel, returns 0 (transparency) on failure
-uint8_t SPR_Get_Pixel( int sprite_index, int pixel_index )
+// applies an SPR_OP_ operation to the count sprites listed in index, each once however often it
+// is listed. return 1 on success, nothing is changed if an index is invalid
+int SPR_Change_Selection( int op, const int *index, int count, int value )
 {
-
-    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    if( op < 0 || op >= SPR_NO_OF_OPS || count < 0 )
     {
-        UTI_Print_Debug( "Invalid sprite index" );
+        UTI_Print_Error( "Invalid sprite operation" );
         return 0;
     }
 
-    if( pixel_index < 0 || pixel_index >= SPRITE_SIZE )
+    int no_of_words = ( no_of_sprites + 63 ) / 64;
+    int i, bit, n = 0;
+
+    // a bit is set for each sprite listed and they are read back in index order, so they are
+    // visited once each, front to back, and split between threads without two having the same one
+    uint64_t *listed = UTI_EC_Malloc( sizeof( uint64_t ) * ( no_of_words + 1 ) );
+    memset( listed, 0, sizeof( uint64_t ) * ( no_of_words + 1 ) );
+
+    for( i = 0; i < count; i++ )
     {
-        printf( "Pixel Index = %d\n", pixel_index );
-        UTI_Print_Debug( "Invalid pixel index" );
-        return 0;
+        if( index[i] < 0 || index[i] >= no_of_sprites )
+        {
+            UTI_Print_Error( "Invalid sprite index" );
+            UTI_EC_Free( listed );
+            return 0;
+        }
+
+        listed[index[i] / 64] |= (uint64_t)1 << ( index[i] % 64 );
     }
 
-    return sprite[sprite_index]->definition[pixel_index];
+    int *sorted = UTI_EC_Malloc( sizeof( int ) * ( count + 1 ) );
 
-}
+    for( i = 0; i < no_of_words; i++ )
+    {
+        for( bit = 0; listed[i] != 0 && bit < 64; bit++ )
+        {
+            if( listed[i] & (uint64_t)1 << bit )
+            {
+                sorted[n++] = i * 64 + bit;
+            }
+        }
+    }
 
+    UTI_EC_Free( listed );
 
-int SPR_Get_Sprite_Palette_Index( int sprite_index )
-{
-    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    for( i = 0; i < n; i++ )
     {
-        UTI_Print_Debug( "Invalid Sprite index" );
-        return 0;
+        Need_Sprite( sorted[i] );
     }
 
-    return sprite[sprite_index]->palette;
-}
-
+    if( sprites_shared )
+    {
+        Change_Shared( sorted, 0, n, op, value );
+    }
+    else
+    {
+        Change_Sprites( sorted, 0, n, op, value );
+    }
 
-void SPR_Set_Sprite_Palette_Index( int sprite_index, int palette_index )
-{
-    if( sprite_index < 0 || sprite_index >= no_of_sprites )
+    for( i = 0; i < n; i++ )
     {
-        return;
+        Touch_Sprite( sorted[i] );
     }
 
-    sprite[sprite_index]->palette = palette_index;
+    UTI_EC_Free( sorted );
 
-    return;
+    return 1;
 }
 
 
-// return the current number of sprites
-int SPR_Get_Number_Of_Sprites()
-{
-    return no_of_sprites;
-}
 
+//=============================
+//  FILE I/O
+//=============================
 
-// clean up function
-void SPR_Free()
+// return pointer to the sprite definition
+uint8_t         *SPR_Get_Sprite( int index )
 {
-    int i;
-    for( i = 0; i < no_of_sprites; i++ )
+    if( index >= 0 && index < no_of_sprites )
     {
-        UTI_EC_Free( sprite[i] );
+        return Open_Sprite( index )->definition;
     }
 
-    return;
+    return NULL;
 }
 
-
-//==========================
-//  SPRITE SHIFT/FLIP
-//==========================
-
-void SPR_Shift_Left( int index )
+// adds count sprites to the end of the list and returns them to be filled in, so a whole file's 
+// worth can be read in one go. returns NULL if there is no room
+sprite_type     *SPR_Load_Sprites( int count )
 {
-    if( index < 0 || index >= no_of_sprites )
+    if( count < 0 || Reserve_Sprites( no_of_sprites + count ) == 0 )
     {
-        UTI_Print_Error( "Invalid sprite index" );
-        return;
+        UTI_Print_Error( "Cannot add sprites, out of memory" );
+        return NULL;
     }
-    
-    int line, i;
-    uint8_t temp;
 
-    for( line = 0; line < SPRITE_H; line++ )
+    // they are filled in full size where they lie
+    if( sprites_shared )
     {
-        Copy_Line_From_Sprite( sprite[index], spr_line_1, line );
-        temp = spr_line_1[0];
-        for( i = 1; i < SPRITE_W; i++ )
-        {
-            spr_line_1[i-1] = spr_line_1[i];
-        }
+        Unshare_Storage();
+    }
+
+    if( sprites_packed )
+    {
+        Unpack_Storage( "more sprites loaded" );
+    }
 
-        spr_line_1[SPRITE_W-1] = temp;
+    sprite_type *first = &sprite[no_of_sprites];
 
-        Copy_Line_To_Sprite( sprite[index], spr_line_1, line );
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        Touch_Sprite( no_of_sprites++ );
     }
 
-    return;
+    return first;
 }
 
-void SPR_Shift_Right( int index ) 
+
+// uses count sprites the caller already has in memory as the sprite list, without copying them.
+// the memory must stay valid until SPR_Own_Sprites() or SPR_Free(), it is written to when sprites
+// are edited. if there are already sprites they are copied instead. returns 1 on success
+int             SPR_Borrow_Sprites( sprite_type *sprites, int count )
 {
-    if( index < 0 || index >= no_of_sprites )
+    if( count < 0 )
     {
-        UTI_Print_Error( "Invalid sprite index" );
-        return;
+        return 0;
     }
-    
-    int line, i;
-    uint8_t temp;
 
-    for( line = 0; line < SPRITE_H; line++ )
+    if( sprite != NULL || sprites_packed || sprites_shared || no_of_sprites > 0 )
     {
-        Copy_Line_From_Sprite( sprite[index], spr_line_1, line );
-        temp = spr_line_1[SPRITE_W-1];
-        for( i = SPRITE_W-2; i >= 0; i-- )
+        sprite_type *dest = SPR_Load_Sprites( count );
+        if( dest == NULL )
         {
-            spr_line_1[i+1] = spr_line_1[i];
+            return 0;
         }
 
-        spr_line_1[0] = temp;
+        memcpy( dest, sprites, sizeof( sprite_type ) * count );
+        return 1;
+    }
+
+    sprite = sprites;
+    sprite_capacity = count;
+    sprites_borrowed = 1;
+    sprite_generation = UTI_EC_Realloc( sprite_generation, sizeof( uint32_t ) * ( count > 0 ? count : 1 ) );
+    memset( sprite_generation, 0, sizeof( uint32_t ) * count );
 
-        Copy_Line_To_Sprite( sprite[index], spr_line_1, line );
+    while( no_of_sprites < count )
+    {
+        Touch_Sprite( no_of_sprites++ );
     }
 
-    return;
+    return 1;
 }
 
-void SPR_Shift_Up( int index )
+
+// adds count sprites to the end of the list that are filled in by loader the first time they are
+// used, a block at a time, so a file's sprites don't have to be read before they are needed. only
+// one set of sprites can be waiting for a loader. returns 1 on success
+int             SPR_Load_Sprites_Lazily( int count, spr_loader_type loader )
 {
-    if( index < 0 || index >= no_of_sprites )
+    if( lazy_end > 0 || loader == NULL )
     {
-        return;
+        UTI_Print_Error( "Cannot load sprites lazily, already loading" );
+        return 0;
     }
 
-    int i;
-    
-    Copy_Line_From_Sprite( sprite[index], spr_line_2, 0 );
-
-    for( i = 1; i <= SPRITE_H-1; i++ )
+    if( count == 0 )
     {
-        Copy_Line_From_Sprite( sprite[index], spr_line_1, i );
-        Copy_Line_To_Sprite( sprite[index], spr_line_1, i-1 );
+        return 1;
     }
 
-    Copy_Line_To_Sprite( sprite[index], spr_line_2, SPRITE_H-1 );
+    int first = no_of_sprites;
+    if( SPR_Load_Sprites( count ) == NULL )
+    {
+        return 0;
+    }
 
-    return;
-}
+    // blocks are counted from sprite 0, so any before first are already loaded
+    int no_of_blocks = ( no_of_sprites + SPRITE_LOAD_BLOCK - 1 ) / SPRITE_LOAD_BLOCK;
 
+    block_loaded = UTI_EC_Malloc( no_of_blocks );
+    memset( block_loaded, 1, no_of_blocks );
 
-void SPR_Shift_Down( int index )
-{
-    if( index < 0 || index >= no_of_sprites )
+    int block = first / SPRITE_LOAD_BLOCK;
+    if( first % SPRITE_LOAD_BLOCK != 0 )
     {
-        return;
+        // shares a block with sprites that are already here, fill in the new ones now
+        int part = SPRITE_LOAD_BLOCK - first % SPRITE_LOAD_BLOCK;
+        loader( first, ( part < count ) ? part : count, &sprite[first] );
+        block++;
     }
 
-    int i;
-    
-    Copy_Line_From_Sprite( sprite[index], spr_line_2, SPRITE_H-1 );
-
-    for( i = SPRITE_H-1; i >= 0; i-- )
+    sprite_loader = loader;
+    lazy_end = no_of_sprites;
+    for( ; block < no_of_blocks; block++ )
     {
-        Copy_Line_From_Sprite( sprite[index], spr_line_1, i );
-        Copy_Line_To_Sprite( sprite[index], spr_line_1, i+1 );
+        block_loaded[block] = 0;
+        blocks_unloaded++;
     }
 
-    Copy_Line_To_Sprite( sprite[index], spr_line_2, 0 );
+    if( blocks_unloaded == 0 )
+    {
+        Finish_Lazy_Loading();
+    }
 
-    return;
+    return 1;
 }
 
 
-
-void SPR_Flip_Horizontal( int index )
+// loads any of count sprites from first that haven't been yet, so they are ready before they are
+// drawn. indices outside the list are ignored
+void            SPR_Prefetch_Sprites( int first, int count )
 {
-    if( index < 0 || index >= no_of_sprites )
+    if( first < 0 )
     {
-        UTI_Print_Error( "Invalid sprite index" );
-        return;
+        count += first;
+        first = 0;
     }
 
-    int i, line;
-    uint8_t temp;
+    int last = ( count > lazy_end - first ) ? lazy_end : first + count;
+    int block;
 
-    for( line = 0; line < SPRITE_H; line++ )
+    for( block = first / SPRITE_LOAD_BLOCK; lazy_end > 0 && block * SPRITE_LOAD_BLOCK < last; block++ )
     {
-        Copy_Line_From_Sprite( sprite[index], spr_line_1, line );
-        for( i = 0; i < SPRITE_W/2; i++ )
+        if( block_loaded[block] == 0 )
         {
-            temp = spr_line_1[i];
-            spr_line_1[i] = spr_line_1[(SPRITE_W-1)-i];
-            spr_line_1[(SPRITE_W-1)-i] = temp;
+            Load_Block( block );
         }
-
-        Copy_Line_To_Sprite( sprite[index], spr_line_1, line );
     }
 
     return;
 }
 
 
-
-void SPR_Flip_Vertical( int index )
+// copies borrowed sprites into memory of the sprite code's own and loads any that haven't been,
+// after this the memory given to SPR_Borrow_Sprites() and the loader are no longer used
+void            SPR_Own_Sprites()
 {
-    
-    if( index < 0 || index >= no_of_sprites )
+    Load_All_Sprites();
+
+    if( sprites_borrowed )
     {
-        UTI_Print_Error( "Invalid sprite index" );
-        return;
+        Move_Arena( ( sprite_capacity > 0 ) ? sprite_capacity : SPRITE_ARENA_START );
     }
 
-    int i;
+    return;
+}
 
-    for( i = 0; i < SPRITE_H/2; i++ )
-    {
-        Copy_Line_From_Sprite( sprite[index], spr_line_1, i );
-        Copy_Line_From_Sprite( sprite[index], spr_line_2, (SPRITE_H-1) - i );
-        Copy_Line_To_Sprite( sprite[index], spr_line_2, i );
-        Copy_Line_To_Sprite( sprite[index], spr_line_1, (SPRITE_H-1) - i );
-    }
+
+// returns the indices of sprites added or changed since SPR_Mark_Sprites_Saved(), in the order
+// they first changed. indices of sprites since removed are included. count is set to how many
+const int       *SPR_Get_Changed_Sprites( int *count )
+{
+    *count = no_of_changed;
+
+    return changed_sprite;
+}
+
+
+// clears the list of changed sprites, call once they have been saved
+void            SPR_Mark_Sprites_Saved()
+{
+    no_of_changed = 0;
+    saved_generation = generation_counter;
 
     return;
 }
 
 
+// returns every sprite in index order, SPR_Get_Number_Of_Sprites() long
+const sprite_type *SPR_Get_Sprites()
+{
+    if( sprites_packed || sprites_shared )
+    {
+        return NULL;
+    }
 
-//=============================
-//  FILE I/O
-//=============================
+    Load_All_Sprites();
 
-// return pointer to the sprite definition
-uint8_t         *SPR_Get_Sprite( int index )
+    return sprite;
+}
+
+
+// returns the id of the definition a sprite shares, or -1 if sprites aren't shared or the index
+// is invalid. ids are below SPR_Get_Definition_Id_Limit()
+int             SPR_Get_Definition_Id( int index )
 {
-    if( index >= 0 && index < no_of_sprites )
+    if( sprites_shared == 0 || index < 0 || index >= no_of_sprites )
     {
-        return sprite[index]->definition;
+        return -1;
     }
 
-    return NULL;
+    Need_Sprite( index );
+
+    return shared_sprite[index].definition;
+}
+
+
+// returns one more than the highest definition id there has been
+int             SPR_Get_Definition_Id_Limit()
+{
+    return sprites_shared ? definition_limit : 0;
 }
 
-// take pointer from file
-int             SPR_Load_Sprite( sprite_type *definition )
+
+// returns the SPRITE_SIZE pixels of a shared definition, a copy valid until the next call. NULL
+// if the id isn't in use
+const uint8_t   *SPR_Get_Definition( int id )
 {
-    if( no_of_sprites >= MAX_SPRITES )
+    if( sprites_shared == 0 || id < 0 || id >= definition_limit || definition_refs[id] == 0 )
     {
-        UTI_Print_Debug( "Cannot add sprite, limit reached" );
-        return 0;
+        return NULL;
     }
 
-    sprite[no_of_sprites++] = definition;
+    Copy_Definition( id, spr_definition );
 
-    return 1;
+    return spr_definition;
 }
 
 
@@ -498,14 +2201,82 @@ void SPR_DEBUG_Show_Sprite( int sprite_index )
         UTI_Print_Debug( "Not a valid sprite index" );
         return;
     }
+
+    sprite_type *spr = Open_Sprite( sprite_index );
  
     int i;
 
     for( i = 0; i < SPRITE_SIZE; i++ )
     {
-        printf( "%x%s", sprite[sprite_index]->definition[i], ( i % 16 == 15 ) ? "\n" : " " );
+        printf( "%x%s", spr->definition[i], ( i % 16 == 15 ) ? "\n" : " " );
     }
 
     return;
 }
 
+
+// times packing and unpacking count sprites with each set of kernels the cpu supports and prints
+// the results
+void SPR_Benchmark_Kernels( int count, int iterations )
+{
+    uint8_t *pixels = UTI_EC_Malloc( (size_t)SPRITE_SIZE * count );
+    uint8_t *nibbles = UTI_EC_Malloc( (size_t)SPRITE_NIBBLES * count );
+    struct timespec start, end;
+    double pack_ms, unpack_ms;
+    int i, k, n;
+
+    for( i = 0; i < SPRITE_SIZE * count; i++ )
+    {
+        pixels[i] = ( i * 7 + i / 13 ) & 0x0f;
+    }
+
+    // touched first so the first kernels timed don't pay for the page faults
+    memset( nibbles, 0, (size_t)SPRITE_NIBBLES * count );
+
+    // megabytes of full size sprites per run
+    double mb = (double)SPRITE_SIZE * count / ( 1024.0 * 1024.0 );
+
+    printf( "Sprite kernels, %d sprites, %d iterations\n", count, iterations );
+    printf( "%-8s %20s %20s\n", "kernels", "pack", "unpack" );
+
+    for( k = 0; k < NO_OF_KERNELS; k++ )
+    {
+        spr_kernels_type *kern = &kernel_list[k];
+
+        if( Kernels_Supported( kern ) == 0 )
+        {
+            printf( "%-8s not supported\n", kern->name );
+            continue;
+        }
+
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        for( i = 0; i < iterations; i++ )
+        {
+            for( n = 0; n < count; n++ )
+            {
+                kern->pack( nibbles + (size_t)SPRITE_NIBBLES * n, pixels + (size_t)SPRITE_SIZE * n );
+            }
+        }
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        pack_ms = Ms_Between( &start, &end ) / iterations;
+
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        for( i = 0; i < iterations; i++ )
+        {
+            for( n = 0; n < count; n++ )
+            {
+                kern->unpack( pixels + (size_t)SPRITE_SIZE * n, nibbles + (size_t)SPRITE_NIBBLES * n );
+            }
+        }
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        unpack_ms = Ms_Between( &start, &end ) / iterations;
+
+        printf( "%-8s %7.3fms %6.0fMB/s %7.3fms %6.0fMB/s\n",
+                kern->name, pack_ms, mb * 1000.0 / pack_ms, unpack_ms, mb * 1000.0 / unpack_ms );
+    }
+
+    UTI_EC_Free( pixels );
+    UTI_EC_Free( nibbles );
+
+    return;
+}
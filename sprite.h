@@ -17,12 +17,23 @@
 #include "defs.h"
 
 //====================================================================
-//  CONSTANTS
+//  DEFINES
 //====================================================================
 
-
-#define MAX_SPRITES             1024
-
+// operations for SPR_Change_Range() and SPR_Change_Selection()
+#define SPR_OP_SHIFT_LEFT           0
+#define SPR_OP_SHIFT_RIGHT          1
+#define SPR_OP_SHIFT_UP             2
+#define SPR_OP_SHIFT_DOWN           3
+#define SPR_OP_FLIP_HORIZONTAL      4
+#define SPR_OP_FLIP_VERTICAL        5
+#define SPR_OP_CLEAR                6
+#define SPR_OP_SET_PALETTE          7       // value is the palette index
+#define SPR_NO_OF_OPS               8
+
+// how sprites are kept in memory, see SPR_Get_Storage()
+#define SPR_STORAGE_PACKED          0x01    // two pixels to a byte, see SPR_Pack_Storage()
+#define SPR_STORAGE_SHARED          0x02    // each definition once, see SPR_Share_Storage()
 
 //====================================================================
 //  TYPES
@@ -34,6 +45,9 @@ struct sprite_s {   uint8_t         definition[SPRITE_SIZE];            // sprit
 
 typedef struct sprite_s sprite_type;
 
+// fills in count sprites from index first, used to load sprites the first time they are needed
+typedef void (*spr_loader_type)( int first, int count, sprite_type *sprites );
+
 
 //====================================================================
 //  PROTOTYPES
@@ -81,6 +95,28 @@ int SPR_Get_Sprite_Palette_Index( int sprite_index );
 void SPR_Set_Sprite_Palette_Index( int sprite_index, int palette_index );
 
 
+// returns a value that changes every time the sprite is edited, 0 for an invalid index. it doesn't
+// load a sprite the loader hasn't filled in, that keeps the value it was added with until edited
+uint32_t SPR_Get_Sprite_Generation( int sprite_index );
+
+
+// keeps the sprites two pixels to a byte, halving their memory, as long as no pixel is above 15.
+// storing a pixel above 15 later goes back to full size. returns 1 if they are packed
+int SPR_Pack_Storage();
+
+// keeps each different sprite definition once, shared by every sprite that has it, and prints
+// how many there are. a changed sprite gets a definition of its own or one that matches, the
+// others are left as they were. returns 1 on success
+int SPR_Share_Storage();
+
+// returns how many different sprite definitions are kept, 0 unless sprites are shared
+int SPR_Get_Number_Of_Definitions();
+
+// returns how sprites are kept now as SPR_STORAGE_ flags, 0 when each is kept full size. it can
+// change as sprites are edited or loaded
+int SPR_Get_Storage();
+
+
 // free allocated sprite memory
 void SPR_Free();
 
@@ -100,16 +136,74 @@ void SPR_Flip_Horizontal( int index );
 
 void SPR_Flip_Vertical( int index );
 
+//==========================
+//  BULK OPERATIONS
+//==========================
+
+// applies an SPR_OP_ operation to sprites first to end-1, the same as calling the single sprite
+// function for each but in one pass, spread across threads when there are thousands. return 1
+// on success
+int SPR_Change_Range( int op, int first, int end, int value );
+
+// applies an SPR_OP_ operation to the count sprites listed in index, each once however often it
+// is listed. return 1 on success, nothing is changed if an index is invalid
+int SPR_Change_Selection( int op, const int *index, int count, int value );
+
 
 //=============================
 //  FILE I/O
 //=============================
 
-// return pointer to the sprite definition
+// return pointer to the sprite definition, sprites are stored together so this is only valid 
+// until the next sprite is added. when they are packed or shared it is a copy, valid until the
+// next call and not to be written to
 uint8_t         *SPR_Get_Sprite( int index );
 
-// load from file
-int             SPR_Load_Sprite( sprite_type *definition );
+// adds count sprites to the end of the list and returns them to be filled in, so a whole file's 
+// worth can be read in one go. packed or shared sprites go back to full size. returns NULL if there
+// is no room
+sprite_type     *SPR_Load_Sprites( int count );
+
+// uses count sprites the caller already has in memory as the sprite list, without copying them.
+// the memory must stay valid until SPR_Own_Sprites() or SPR_Free(), it is written to when sprites
+// are edited. if there are already sprites they are copied instead. returns 1 on success
+int             SPR_Borrow_Sprites( sprite_type *sprites, int count );
+
+// adds count sprites to the end of the list that are filled in by loader the first time they are
+// used, a block at a time, so a file's sprites don't have to be read before they are needed. only
+// one set of sprites can be waiting for a loader. returns 1 on success
+int             SPR_Load_Sprites_Lazily( int count, spr_loader_type loader );
+
+// loads any of count sprites from first that haven't been yet, so they are ready before they are
+// drawn. indices outside the list are ignored
+void            SPR_Prefetch_Sprites( int first, int count );
+
+// copies borrowed sprites into memory of the sprite code's own and loads any that haven't been,
+// after this the memory given to SPR_Borrow_Sprites() and the loader are no longer used
+void            SPR_Own_Sprites();
+
+// returns the indices of sprites added or changed since SPR_Mark_Sprites_Saved(), in the order
+// they first changed. indices of sprites since removed are included. count is set to how many
+const int       *SPR_Get_Changed_Sprites( int *count );
+
+// clears the list of changed sprites, call once they have been saved
+void            SPR_Mark_Sprites_Saved();
+
+// returns every sprite in index order, SPR_Get_Number_Of_Sprites() long, for writing in one go.
+// only valid until the next sprite is added. NULL when they are packed or shared, use
+// SPR_Get_Sprite()
+const sprite_type *SPR_Get_Sprites();
+
+// returns the id of the definition a sprite shares, or -1 if sprites aren't shared or the index
+// is invalid. ids are below SPR_Get_Definition_Id_Limit(), sprites with the same id are the same
+int             SPR_Get_Definition_Id( int index );
+
+// returns one more than the highest definition id there has been
+int             SPR_Get_Definition_Id_Limit();
+
+// returns the SPRITE_SIZE pixels of a shared definition, a copy valid until the next call. NULL
+// if the id isn't in use
+const uint8_t   *SPR_Get_Definition( int id );
 
 //===================================
 //  TESTING AND DEBUG
@@ -118,4 +212,8 @@ int             SPR_Load_Sprite( sprite_type *definition );
 // test sprite is made
 void SPR_DEBUG_Show_Sprite( int index );
 
+// times packing and unpacking count sprites with each set of kernels the cpu supports and prints
+// the results
+void SPR_Benchmark_Kernels( int count, int iterations );
+
 #endif // __sprite_h__
@@ -0,0 +1,310 @@
+//====================================================================
+//
+//  thread.c
+//
+//  runs a number of independent jobs across threads
+//
+//====================================================================
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "utility.h"
+#include "thread.h"
+
+
+//====================================================================
+//  CONSTANTS
+//====================================================================
+
+#define THR_CACHE_LINE              64
+
+
+//====================================================================
+//  TYPES
+//====================================================================
+
+// the jobs a thread has left, next to end-1. the thread takes from the front and others take
+// from the back. each is on a cache line of its own so threads don't slow each other down
+struct thr_queue_s {    pthread_mutex_t     lock;
+                        int                 next;
+                        int                 end;
+                   } __attribute__(( aligned( THR_CACHE_LINE ) ));
+
+typedef struct thr_queue_s thr_queue_type;
+
+// the run being shared out, the workers are started the first time they are needed and wait for
+// the next run between them
+struct thr_pool_s {     thr_job_type        job;
+                        void                *data;
+                        int                 no_of_threads;      // taking part in the run, caller included
+                        thr_queue_type      queue[THR_MAX_THREADS];
+                  };
+
+typedef struct thr_pool_s thr_pool_type;
+
+
+//====================================================================
+//  GLOBALS
+//====================================================================
+
+// run_lock is held by the thread whose run it is, lock by any thread changing what is below it
+static pthread_mutex_t      run_lock            = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t      lock                = PTHREAD_MUTEX_INITIALIZER;
+
+static thr_pool_type        pool;
+static pthread_once_t       queues_once         = PTHREAD_ONCE_INIT;
+
+static pthread_t            thread[THR_MAX_THREADS];
+static int                  no_of_started       = 1;            // this thread counts as the first
+static int                  woken[THR_MAX_THREADS];             // set for each worker a run wants
+static int                  no_of_working       = 0;            // workers still busy with the run
+static int                  stopping            = 0;            // set to end the workers
+
+static pthread_cond_t       run_started         = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t       run_finished        = PTHREAD_COND_INITIALIZER;
+
+
+//====================================================================
+//  PRIVATE FUNCTIONS
+//====================================================================
+
+// returns the next job in a queue, -1 if it is empty
+static int Take_Job( thr_queue_type *queue )
+{
+    int index = -1;
+
+    pthread_mutex_lock( &queue->lock );
+    if( queue->next < queue->end )
+    {
+        index = queue->next++;
+    }
+    pthread_mutex_unlock( &queue->lock );
+
+    return index;
+}
+
+
+// moves the back half of the first queue found with jobs left onto the thief's own, which is
+// empty. returns 0 if every queue is empty
+static int Steal_Jobs( int thief )
+{
+    thr_queue_type *victim, *own = &pool.queue[thief];
+    int i, first, end, left;
+
+    for( i = 1; i < pool.no_of_threads; i++ )
+    {
+        victim = &pool.queue[( thief + i ) % pool.no_of_threads];
+
+        pthread_mutex_lock( &victim->lock );
+        left = victim->end - victim->next;
+        end = victim->end;
+        first = end - ( left + 1 ) / 2;
+        if( left > 0 )
+        {
+            victim->end = first;
+        }
+        pthread_mutex_unlock( &victim->lock );
+
+        if( left > 0 )
+        {
+            pthread_mutex_lock( &own->lock );
+            own->next = first;
+            own->end = end;
+            pthread_mutex_unlock( &own->lock );
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// does jobs until every queue is empty
+static void Run_Jobs( int id )
+{
+    int index;
+
+    for( ;; )
+    {
+        index = Take_Job( &pool.queue[id] );
+        if( index >= 0 )
+        {
+            pool.job( pool.data, index );
+        }
+        else if( Steal_Jobs( id ) == 0 )
+        {
+            break;
+        }
+    }
+
+    return;
+}
+
+
+// a worker thread, it waits until a run wants it then helps with it
+static void *Run_Worker( void *data )
+{
+    int id = (int)(intptr_t)data;
+
+    pthread_mutex_lock( &lock );
+    for( ;; )
+    {
+        while( woken[id] == 0 && stopping == 0 )
+        {
+            pthread_cond_wait( &run_started, &lock );
+        }
+
+        if( stopping )
+        {
+            break;
+        }
+
+        woken[id] = 0;
+
+        pthread_mutex_unlock( &lock );
+        Run_Jobs( id );
+        pthread_mutex_lock( &lock );
+
+        if( --no_of_working == 0 )
+        {
+            pthread_cond_signal( &run_finished );
+        }
+    }
+    pthread_mutex_unlock( &lock );
+
+    return NULL;
+}
+
+
+// makes the queue locks, once before the first run that is shared out
+static void Init_Queues()
+{
+    int t;
+
+    for( t = 0; t < THR_MAX_THREADS; t++ )
+    {
+        pthread_mutex_init( &pool.queue[t].lock, NULL );
+    }
+
+    return;
+}
+
+
+// starts workers until there are no_of_threads threads, this one included. returns how many
+// there are, fewer if a thread couldn't be started
+static int Start_Workers( int no_of_threads )
+{
+    int t;
+
+    pthread_mutex_lock( &lock );
+    for( t = no_of_started; t < no_of_threads; t++ )
+    {
+        if( pthread_create( &thread[t], NULL, Run_Worker, (void *)(intptr_t)t ) != 0 )
+        {
+            UTI_Print_Error( "Unable to start a thread" );
+            break;
+        }
+        no_of_started++;
+    }
+    pthread_mutex_unlock( &lock );
+
+    return no_of_started;
+}
+
+
+//====================================================================
+//  PUBLIC FUNCTIONS
+//====================================================================
+
+// returns the number of processors threads can run on, at least 1
+int         THR_Get_Number_Of_CPUs()
+{
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+
+    return ( cpus < 1 ) ? 1 : ( cpus > THR_MAX_THREADS ) ? THR_MAX_THREADS : (int)cpus;
+}
+
+
+// runs job( data, index ) for every index from 0 to count-1 on no_of_threads threads, returns
+// once every job is done
+void        THR_Run( thr_job_type job, void *data, int count, int no_of_threads )
+{
+    int t;
+
+    no_of_threads = ( no_of_threads > count ) ? count : no_of_threads;
+    no_of_threads = ( no_of_threads > THR_MAX_THREADS ) ? THR_MAX_THREADS : no_of_threads;
+
+    // nothing to share out, or the workers are busy with a run this is part of or another
+    // thread's
+    if( no_of_threads <= 1 || pthread_mutex_trylock( &run_lock ) != 0 )
+    {
+        for( t = 0; t < count; t++ )
+        {
+            job( data, t );
+        }
+        return;
+    }
+
+    pthread_once( &queues_once, Init_Queues );
+    no_of_threads = Start_Workers( no_of_threads );
+
+    pthread_mutex_lock( &lock );
+
+    pool.job = job;
+    pool.data = data;
+    pool.no_of_threads = no_of_threads;
+
+    for( t = 0; t < no_of_threads; t++ )
+    {
+        pool.queue[t].next = (int)( (int64_t)count * t / no_of_threads );
+        pool.queue[t].end = (int)( (int64_t)count * ( t + 1 ) / no_of_threads );
+        woken[t] = ( t > 0 );
+    }
+
+    no_of_working = no_of_threads - 1;
+    pthread_cond_broadcast( &run_started );
+    pthread_mutex_unlock( &lock );
+
+    // this thread is the first worker
+    Run_Jobs( 0 );
+
+    pthread_mutex_lock( &lock );
+    while( no_of_working > 0 )
+    {
+        pthread_cond_wait( &run_finished, &lock );
+    }
+    pthread_mutex_unlock( &lock );
+
+    pthread_mutex_unlock( &run_lock );
+
+    return;
+}
+
+
+// ends the worker threads, THR_Run() starts them again if it is used after
+void        THR_Stop_Threads()
+{
+    int t;
+
+    pthread_mutex_lock( &run_lock );
+
+    pthread_mutex_lock( &lock );
+    stopping = 1;
+    pthread_cond_broadcast( &run_started );
+    pthread_mutex_unlock( &lock );
+
+    for( t = 1; t < no_of_started; t++ )
+    {
+        pthread_join( thread[t], NULL );
+    }
+
+    no_of_started = 1;
+    stopping = 0;
+
+    pthread_mutex_unlock( &run_lock );
+
+    return;
+}
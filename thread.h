@@ -0,0 +1,48 @@
+//===================================================================
+//
+//  thread.h
+//
+//  runs a number of independent jobs across threads
+//
+//===================================================================
+
+#ifndef __thread_h__
+#define __thread_h__
+
+
+//===================================================================
+//  CONSTANTS
+//===================================================================
+
+#define THR_MAX_THREADS         64
+
+
+//===================================================================
+//  TYPES
+//===================================================================
+
+// does job number index of those given to THR_Run()
+typedef void (*thr_job_type)( void *data, int index );
+
+
+//===================================================================
+//  PROTOTYPES
+//===================================================================
+
+// returns the number of processors threads can run on, at least 1
+int         THR_Get_Number_Of_CPUs();
+
+// runs job( data, index ) for every index from 0 to count-1 on no_of_threads threads (up to
+// THR_MAX_THREADS), this one included. each thread starts on its own share of the indices, lowest
+// first, and takes half of what another has left when it runs out. jobs must only share what
+// they don't change. the other threads are started the first time they are needed and wait for
+// the next call after. a call made while another is running, from a job or another thread, runs
+// its jobs on the calling thread. returns once every job is done
+void        THR_Run( thr_job_type job, void *data, int count, int no_of_threads );
+
+// ends the threads THR_Run() started, call before exiting
+void        THR_Stop_Threads();
+
+
+
+#endif // __thread_h__
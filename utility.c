@@ -5,6 +5,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "utility.h"
 
@@ -35,6 +37,32 @@ void *UTI_EC_Malloc( size_t size )
 }
 
 
+// error checked realloc call
+void *UTI_EC_Realloc( void *ptr, size_t size )
+{
+    ptr = realloc( ptr, size );
+    if( ptr == NULL )
+    {
+        UTI_Fatal_Error( "<UTI_EC_Realloc>: Unable to allocate memory" );
+    }
+
+    return ptr;
+}
+
+
+// error checked aligned malloc call
+void *UTI_EC_Aligned_Malloc( size_t size, size_t alignment )
+{
+    void *ptr = NULL;
+    if( posix_memalign( &ptr, alignment, size ) != 0 )
+    {
+        UTI_Fatal_Error( "<UTI_EC_Aligned_Malloc>: Unable to allocate memory" );
+    }
+
+    return ptr;
+}
+
+
 // error checked free
 void UTI_EC_Free( void *ptr )
 {
@@ -48,3 +76,65 @@ void UTI_EC_Free( void *ptr )
 
     return;
 }
+
+
+// CRC-32 lookup, one table per byte of an 8 byte block so eight bytes are folded in per step
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;     // threads can all checksum at once
+
+static void Build_CRC_Table()
+{
+    uint32_t crc;
+    int i, j;
+    for( i = 0; i < 256; i++ )
+    {
+        crc = i;
+        for( j = 0; j < 8; j++ )
+        {
+            crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xedb88320 : crc >> 1;
+        }
+        crc_table[0][i] = crc;
+    }
+
+    for( i = 0; i < 256; i++ )
+    {
+        for( j = 1; j < 8; j++ )
+        {
+            crc_table[j][i] = ( crc_table[j-1][i] >> 8 ) ^ crc_table[0][crc_table[j-1][i] & 0xff];
+        }
+    }
+
+    return;
+}
+
+
+// continues a CRC-32 (the zlib/PNG one) over length more bytes, start with a crc of 0
+uint32_t UTI_CRC32( uint32_t crc, const void *data, size_t length )
+{
+    const uint8_t *byte = data;
+
+    pthread_once( &crc_table_once, Build_CRC_Table );
+
+    crc = ~crc;
+
+    while( length >= 8 )
+    {
+        // bytes are folded in one at a time so this doesn't depend on the host's byte order
+        uint32_t low = crc ^ ( byte[0] | byte[1] << 8 | byte[2] << 16 | (uint32_t)byte[3] << 24 );
+
+        crc = crc_table[7][low & 0xff] ^ crc_table[6][( low >> 8 ) & 0xff] ^
+              crc_table[5][( low >> 16 ) & 0xff] ^ crc_table[4][low >> 24] ^
+              crc_table[3][byte[4]] ^ crc_table[2][byte[5]] ^
+              crc_table[1][byte[6]] ^ crc_table[0][byte[7]];
+
+        byte += 8;
+        length -= 8;
+    }
+
+    while( length-- > 0 )
+    {
+        crc = ( crc >> 8 ) ^ crc_table[0][( crc ^ *byte++ ) & 0xff];
+    }
+
+    return ~crc;
+}
@@ -5,6 +5,8 @@
 #ifndef __utility_h__
 #define __utility_h__
 
+#include <stdint.h>
+
 #define DEBUG       1
 
 // check c version for __func__ or __FUNCTION__ use
@@ -36,7 +38,20 @@ void UTI_Fatal_Error( char *msg );
 void *UTI_EC_Malloc( size_t size );
 
 
+// error checked realloc call
+void *UTI_EC_Realloc( void *ptr, size_t size );
+
+
+// error checked malloc call, memory starts on a multiple of alignment (a power of 2 and a 
+// multiple of sizeof( void * )), free with UTI_EC_Free
+void *UTI_EC_Aligned_Malloc( size_t size, size_t alignment );
+
+
 // free malloc'd memory, ignores null pointers
 void UTI_EC_Free( void *ptr );
 
+
+// continues a CRC-32 (the zlib/PNG one) over length more bytes, start with a crc of 0
+uint32_t UTI_CRC32( uint32_t crc, const void *data, size_t length );
+
 #endif // __utility_h__